@@ -2,7 +2,7 @@
 EXE=GB-emulator
 
 # Special rules and targets
-.PHONY: all build clean help
+.PHONY: all build bench recompiler clean help
 
 # Rules and targets
 all: build
@@ -11,11 +11,19 @@ build:
 	@cd src && $(MAKE) -f MakefileLinux.mk
 	@cp -f src/$(EXE) ./
 
+bench:
+	@cd bench && $(MAKE) -f MakefileLinux.mk run
+
+recompiler:
+	@cd recompiler && $(MAKE) -f MakefileLinux.mk
+
 # test: build
 # 	@cd test && $(MAKE)
 
 clean:
 	@cd src && $(MAKE) -f MakefileLinux.mk clean
+	@cd bench && $(MAKE) -f MakefileLinux.mk clean
+	@cd recompiler && $(MAKE) -f MakefileLinux.mk clean
 # @cd test && $(MAKE) -f MakefileLinux.mk clean
 	@rm -f $(EXE)
 
@@ -23,6 +31,8 @@ help:
 	@echo "Usage:"
 	@echo "  make [all]\t\tBuild"
 	@echo "  make build\t\tBuild the software"
+	@echo "  make bench\t\tRun the CPU benchmarks"
+	@echo "  make recompiler\tBuild the ahead of time recompiler"
 # @echo "  make test\t\tRun all the tests"
 	@echo "  make clean\t\tRemove all files generated by make"
 	@echo "  make help\t\tDisplay this help"
@@ -0,0 +1,46 @@
+# Variables
+BENCHS=bench-table bench-unfused bench-threaded bench-jit bench-tiles
+
+# Usual compilation flags
+CFLAGS=-std=c11 -Wall -Wextra -O2
+CPPFLAGS=-I../include
+LDFLAGS=-lm -lSDL2 -lpthread
+
+SRC=bench.c ../src/cpu.c ../src/memory.c ../src/cartridge.c ../src/scheduler.c ../src/ppu.c ../src/timer.c ../src/mbc.c ../src/interrupt.c ../src/jit.c ../src/trace.c ../src/tiles.c ../src/palette.c
+HEADERS=../src/cpu_core.h ../include/cpu.h ../include/memory.h ../include/cartridge.h ../include/common.h ../include/scheduler.h ../include/ppu.h ../include/timer.h ../include/mbc.h ../include/interrupt.h ../include/jit.h ../include/trace.h ../include/tiles.h ../include/palette.h
+
+# Special rules and targets
+.PHONY: all run clean help
+
+# Rules and targets
+all: $(BENCHS)
+
+bench-table: $(SRC) $(HEADERS)
+	$(CC) $(CFLAGS) $(CPPFLAGS) -o $@ $(SRC) $(LDFLAGS)
+
+bench-unfused: $(SRC) $(HEADERS)
+	$(CC) $(CFLAGS) $(CPPFLAGS) -DCPU_NO_FUSION -o $@ $(SRC) $(LDFLAGS)
+
+bench-threaded: $(SRC) $(HEADERS)
+	$(CC) $(CFLAGS) $(CPPFLAGS) -DCPU_DISPATCH_THREADED -o $@ $(SRC) $(LDFLAGS)
+
+bench-jit: $(SRC) $(HEADERS)
+	$(CC) $(CFLAGS) $(CPPFLAGS) -DCPU_JIT -o $@ $(SRC) $(LDFLAGS)
+
+bench-tiles: tiles.c ../src/tiles.c ../include/tiles.h
+	$(CC) $(CFLAGS) $(CPPFLAGS) -o $@ tiles.c ../src/tiles.c
+
+run: all
+	@for bench in $(filter-out bench-tiles,$(BENCHS)); do ./$$bench $(ROM); done
+	@./bench-tiles
+
+clean:
+	@rm -f *~ *.o $(BENCHS)
+
+help:
+	@echo "Usage:"
+	@echo "  make [all]\t\tBuild the benchmarks"
+	@echo "  make run [ROM=<ROM>]\tCompare the CPU dispatch strategies and the fused pairs, then the tile decoders"
+	@echo "  make bench-tiles\tBuild the check and timing of the tile decoders against the scalar one"
+	@echo "  make clean\t\tRemove all files generated by make"
+	@echo "  make help\t\tDisplay this help"
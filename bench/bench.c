@@ -0,0 +1,115 @@
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <time.h>
+
+#include <memory.h>
+#include <cpu.h>
+#include <cartridge.h>
+#include <scheduler.h>
+#include <ppu.h>
+#include <timer.h>
+#include <interrupt.h>
+
+#define DEFAULT_NB_CYCLES 1000000000ULL
+#define DMG_CLOCK_HZ 4194304.0
+
+#if defined(CPU_DISPATCH_THREADED)
+#define DISPATCH_NAME "threaded"
+#elif defined(CPU_JIT)
+#define DISPATCH_NAME "jit"
+#elif defined(CPU_NO_FUSION)
+#define DISPATCH_NAME "unfused"
+#else
+#define DISPATCH_NAME "table"
+#endif
+
+/*
+    Synthetic workload using the implemented opcodes only
+    0x0100: LD SP, FFFE / LD HL, C000 / LD B, 00
+    0x0108: LD A, (HL) / INC A / LDI (HL), A / CALL 0120 / DEC B / JR NZ, 0108
+    0x0111: LD HL, C000 / JP 0106
+    0x0120: PUSH BC / AND 0F / XOR C / OR B / CP 10 / SWAP A / POP BC / RET
+*/
+static uint8_t bench_program[] = {
+    0x31, 0xfe, 0xff,
+    0x21, 0x00, 0xc0,
+    0x06, 0x00,
+    0x7e,
+    0x3c,
+    0x22,
+    0xcd, 0x20, 0x01,
+    0x05,
+    0x20, 0xf7,
+    0x21, 0x00, 0xc0,
+    0xc3, 0x06, 0x01,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0xc5,
+    0xe6, 0x0f,
+    0xa9,
+    0xb0,
+    0xfe, 0x10,
+    0xcb, 0x37,
+    0xc1,
+    0xc9};
+
+static void print_usage(const char *filename)
+{
+    fprintf(stderr, "Usage: %s [ROM] [NB_CYCLES]\n", filename);
+}
+
+int main(int argc, char const *argv[])
+{
+    uint64_t nb_cycles = DEFAULT_NB_CYCLES;
+
+    if (argc > 3)
+    {
+        print_usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    scheduler_init();
+    memory_init();
+    if (argc >= 2)
+        cartridge_load_rom(argv[1]);
+    else
+        memory_write(bench_program, 0x100, sizeof(bench_program));
+    if (argc == 3)
+        nb_cycles = strtoull(argv[2], NULL, 10);
+
+    cpu_init();
+    interrupt_init();
+    ppu_init();
+    timer_init();
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    // Same loop as the emulator, without the SDL input handling
+    while (scheduler_clock < nb_cycles && cpu_is_running())
+    {
+        uint64_t deadline = scheduler_next_deadline();
+        if (deadline > nb_cycles)
+            deadline = nb_cycles;
+
+        cpu_run(deadline - scheduler_clock);
+        scheduler_run_events();
+    }
+    uint64_t clock_cycles = scheduler_clock;
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    fprintf(stdout, "[%s] %" PRIu64 " cycles in %.3fs: %.1f emulated MHz (x%.1f)\n",
+            DISPATCH_NAME, clock_cycles, elapsed, clock_cycles / elapsed / 1e6, clock_cycles / elapsed / DMG_CLOCK_HZ);
+    fprintf(stdout, "[%s] %" PRIu64 " instructions in %" PRIu64 " dispatches (%.1f%% fewer)\n",
+            DISPATCH_NAME, cpu_get_nb_exec_inst(), cpu_get_nb_dispatches(),
+            100.0 * (cpu_get_nb_exec_inst() - cpu_get_nb_dispatches()) / cpu_get_nb_exec_inst());
+    if (cpu_get_skipped_cycles())
+        fprintf(stdout, "[%s] %" PRIu64 " cycles skipped in idle loops\n", DISPATCH_NAME, cpu_get_skipped_cycles());
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,95 @@
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include <tiles.h>
+
+#define NB_PAIRS 0x10000          // Every (low, high) plane pair
+#define NB_VRAM_ROWS (384 * 8)    // Whole tile data
+#define DEFAULT_NB_ITERATIONS 20000
+
+static uint8_t rows[NB_PAIRS * 2 + 1];
+static uint8_t expected[NB_PAIRS * 8];
+static uint8_t indices[NB_PAIRS * 8 + 1];
+
+static void print_usage(const char *filename)
+{
+    fprintf(stderr, "Usage: %s [NB_ITERATIONS]\n", filename);
+}
+
+// Compare every plane pair, with every row count up to 40 and unaligned
+// buffers so that the tails of the SIMD decoders are covered too
+static int check_decoder(tiles_decoder_t decode)
+{
+    decode(rows, NB_PAIRS, indices);
+    if (memcmp(indices, expected, sizeof(expected)))
+        return EXIT_FAILURE;
+
+    for (uint32_t nb_rows = 0; nb_rows <= 40; nb_rows++)
+    {
+        memset(indices, 0xff, sizeof(indices));
+        decode(rows + 1, nb_rows, indices + 1);
+
+        uint8_t reference[40 * 8];
+        tiles_get_decoder(TILES_DECODER_SCALAR)(rows + 1, nb_rows, reference);
+        if (memcmp(indices + 1, reference, nb_rows * 8) || indices[1 + nb_rows * 8] != 0xff)
+            return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char const *argv[])
+{
+    uint32_t nb_iterations = DEFAULT_NB_ITERATIONS;
+
+    if (argc > 2)
+    {
+        print_usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    if (argc == 2)
+        nb_iterations = strtoul(argv[1], NULL, 10);
+
+    for (uint32_t pair = 0; pair < NB_PAIRS; pair++)
+    {
+        rows[pair * 2] = pair & 0xff;
+        rows[pair * 2 + 1] = pair >> 8;
+    }
+    tiles_get_decoder(TILES_DECODER_SCALAR)(rows, NB_PAIRS, expected);
+
+    int status = EXIT_SUCCESS;
+    for (tiles_decoder_kind_t kind = 0; kind < TILES_DECODER_COUNT; kind++)
+    {
+        tiles_decoder_t decode = tiles_get_decoder(kind);
+        if (decode == NULL)
+        {
+            fprintf(stdout, "[%s] not supported by the host\n", tiles_decoder_names[kind]);
+            continue;
+        }
+
+        if (check_decoder(decode) != EXIT_SUCCESS)
+        {
+            fprintf(stdout, "[%s] differs from the scalar decoder\n", tiles_decoder_names[kind]);
+            status = EXIT_FAILURE;
+            continue;
+        }
+
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (uint32_t i = 0; i < nb_iterations; i++)
+            decode(rows + (i % 16) * 2, NB_VRAM_ROWS, indices);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        fprintf(stdout, "[%s] bit exact, whole tile data decoded in %.2fus (%.0f Mrows/s)\n",
+                tiles_decoder_names[kind], elapsed / nb_iterations * 1e6,
+                (double)NB_VRAM_ROWS * nb_iterations / elapsed / 1e6);
+    }
+
+    return status;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <cpu.h>
+
+/*
+    Ahead of time translation of a ROM
+    The recompiler walks the code of a ROM and writes a translation unit
+    with one function per basic block, built into the emulator with
+    -DCPU_AOT. A translation is only used when the CPU decodes the very same
+    block from the ROM, everything else (RAM, code the walk missed) keeps
+    running through the interpreter.
+*/
+typedef void (*aot_block_t)(cpu_registers_t *regs);
+
+typedef struct
+{
+    uint32_t rom_offset; // First instruction, bank * MEMORY_ROM_BANK_SIZE + offset in the bank
+    uint16_t end_pc;     // Address following the last instruction
+    aot_block_t run;
+} aot_entry_t;
+
+// Defined by the generated translation unit, the entries are sorted by ROM offset
+// The global checksum of the header tells the ROM it was generated from
+extern const uint16_t aot_rom_checksum;
+extern const uint32_t aot_nb_entries;
+extern const aot_entry_t aot_entries[];
+
+// Run an instruction the recompiler didn't inline, PC already past it
+// Return the clock cycles spent on top of the duration of the opcode
+uint8_t cpu_execute_opcode(cpu_registers_t *regs, uint8_t opcode, uint16_t operand);
\ No newline at end of file
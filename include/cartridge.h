@@ -9,7 +9,28 @@
 #define CARTRIDGE_HEADER_CGB_ONLY 0xc0
 #define CARTRIDGE_HEADER_TYPE 0x147
 #define CARTRIDGE_HEADER_ROM_SIZE 0x148
+#define CARTRIDGE_HEADER_ROM_SIZE_MAX 0x08 // 8 MiB
 #define CARTRIDGE_HEADER_RAM_SIZE 0x149
+#define CARTRIDGE_HEADER_GLOBAL_CHECKSUM 0x14e // Big endian
+#define CARTRIDGE_HEADER_END 0x150
+
+#define CARTRIDGE_TYPE_ROM_ONLY 0x00
+#define CARTRIDGE_TYPE_MBC1 0x01
+#define CARTRIDGE_TYPE_MBC1_RAM 0x02
+#define CARTRIDGE_TYPE_MBC1_RAM_BATTERY 0x03
+#define CARTRIDGE_TYPE_ROM_RAM 0x08
+#define CARTRIDGE_TYPE_ROM_RAM_BATTERY 0x09
+#define CARTRIDGE_TYPE_MBC3_TIMER_BATTERY 0x0f
+#define CARTRIDGE_TYPE_MBC3_TIMER_RAM_BATTERY 0x10
+#define CARTRIDGE_TYPE_MBC3 0x11
+#define CARTRIDGE_TYPE_MBC3_RAM 0x12
+#define CARTRIDGE_TYPE_MBC3_RAM_BATTERY 0x13
+#define CARTRIDGE_TYPE_MBC5 0x19
+#define CARTRIDGE_TYPE_MBC5_RAM 0x1a
+#define CARTRIDGE_TYPE_MBC5_RAM_BATTERY 0x1b
+#define CARTRIDGE_TYPE_MBC5_RUMBLE 0x1c
+#define CARTRIDGE_TYPE_MBC5_RUMBLE_RAM 0x1d
+#define CARTRIDGE_TYPE_MBC5_RUMBLE_RAM_BATTERY 0x1e
 
 typedef enum
 {
@@ -23,10 +44,15 @@ typedef struct
     char title[CARTRIDGE_HEADER_TITLE_SIZE];
     cgb_mode_t mode;
     uint8_t type;
-    uint8_t rom_size; // # of banks
-    uint8_t ram_size; // # of banks
+    uint16_t rom_size; // # of banks
+    uint8_t ram_size;  // # of banks
 } cartridge_t;
 
 void cartridge_load_rom(const char *filepath);
 
+void cartridge_destroy(void);
+
+// Whole ROM image, the banks are mapped from it
+const uint8_t *cartridge_get_rom(uint64_t *size);
+
 void cartridge_print_infos(void);
\ No newline at end of file
@@ -2,6 +2,7 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <stddef.h>
 
 #define VERBOSE_NONE 0
 #define VERBOSE_CPU 1
@@ -11,11 +12,94 @@
 
 extern uint8_t verbose;
 
+// Also used by the code translated ahead of time (see aot.h)
+typedef struct
+{
+    union
+    {
+        struct
+        {
+            uint8_t f;
+            uint8_t a;
+        };
+        uint16_t af;
+    };
+
+    union
+    {
+        struct
+        {
+            uint8_t c;
+            uint8_t b;
+        };
+        uint16_t bc;
+    };
+
+    union
+    {
+        struct
+        {
+            uint8_t e;
+            uint8_t d;
+        };
+        uint16_t de;
+    };
+
+    union
+    {
+        struct
+        {
+            uint8_t l;
+            uint8_t h;
+        };
+        uint16_t hl;
+    };
+
+    uint16_t sp;
+    uint16_t pc;
+
+    // Lazy flags, F is computed from the last ALU operation when it is read
+    // (see cpu.c). C is kept apart since INC and DEC leave it untouched
+    uint8_t flags_kind;
+    uint8_t flags_op1;
+    uint8_t flags_op2;
+    uint8_t flags_result; // Z is set when it is 0
+    bool flags_carry;
+
+} cpu_registers_t;
+
 void cpu_init(void);
 
+// Execute instructions until the cycle budget is spent, a scheduler event is due
+// or the debugger needs to step. scheduler_clock is advanced as they execute
+// A halted CPU jumps straight to the next event
+// Return Clock Cycles
+uint64_t cpu_run(uint64_t cycle_budget);
+
+// Execute a single instruction
 // Return Clock Cycles
 uint64_t cpu_execute_inst(void);
 
+// Drop the decoded instructions of a RAM page that has been written
+void cpu_invalidate_code_page(uint8_t page);
+
+// Prompt for debugger commands while the CPU is stopped, no-op otherwise
 void cpu_debugger(void);
 
-bool cpu_is_running(void);
\ No newline at end of file
+// Stop the CPU in the debugger at its next cpu_run, safe from a signal handler
+void cpu_request_break(void);
+
+// Write the instruction at addr in text, with its operand
+// Return its length in bytes
+uint8_t cpu_disassemble(uint16_t addr, char *text, size_t size);
+
+bool cpu_is_running(void);
+
+// Return the clock cycles skipped in idle loops polling the PPU
+uint64_t cpu_get_skipped_cycles(void);
+
+// Return the instructions executed, skipped idle loops included
+uint64_t cpu_get_nb_exec_inst(void);
+
+// Return the decoded entries dispatched, a fused pair of instructions counts once
+uint64_t cpu_get_nb_dispatches(void);
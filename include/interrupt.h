@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define INTERRUPT_VECTOR_START 0x40
+#define INTERRUPT_VECTOR_SIZE 0x08
+#define INTERRUPT_MASK 0x1f
+#define INTERRUPT_DISPATCH_DURATION 20
+
+/*
+    Non zero when the CPU has to call interrupt_acknowledge before its next
+    fetch: an enabled interrupt can be taken, an EI is about to set IME or
+    the CPU is halted. Only recomputed when IE, IF, IME or the HALT state
+    change, so the CPU tests a single byte per instruction.
+*/
+extern uint8_t interrupt_pending;
+
+void interrupt_init(void);
+
+// Set the flag of an interrupt in IF
+void interrupt_request(uint8_t flag);
+
+// Write IE or IF from the bus
+void interrupt_write_reg(uint16_t reg_addr, uint8_t val);
+
+// DI and RETI, take effect immediately
+void interrupt_set_ime(bool enabled);
+
+// EI, IME is set after the next instruction
+void interrupt_enable_delayed(void);
+
+// Stop the CPU until an enabled interrupt is requested, even with IME off
+void interrupt_halt(void);
+
+bool interrupt_is_halted(void);
+
+// Wake up the CPU and take the highest priority interrupt if IME allows it
+// Return the address of its vector or 0 if none was taken
+uint16_t interrupt_acknowledge(void);
\ No newline at end of file
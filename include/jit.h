@@ -0,0 +1,84 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+    x86-64 code emitter for the CPU recompiler
+    A compiled block receives a context pointer (the register file), every
+    access is relative to it. The clock cycles are accumulated at compile
+    time and added to scheduler_clock before every call and at the end.
+    The block returns the number of decoded entries it ran, fewer than the
+    whole block when an exit check stopped it.
+    The arena is never writable and executable at once: a block is written
+    to read/write pages which are made read/execute once it is finished.
+*/
+typedef uint8_t (*jit_block_t)(void *context);
+
+// 8 bits operations on A, the operand is loaded by one of the
+// jit_emit_*_operand emitters first
+typedef enum
+{
+    JIT_ALU_ADD = 0,
+    JIT_ALU_SUB,
+    JIT_ALU_AND,
+    JIT_ALU_XOR,
+    JIT_ALU_OR,
+    JIT_ALU_CP, // SUB without storing the result
+} jit_alu_op_t;
+
+// Map the executable arena, return False if the host can't run the JIT
+bool jit_init(void);
+
+// Drop every compiled block at once
+void jit_reset(void);
+
+// Start a block, return False if the arena is full
+bool jit_begin(void);
+
+void jit_add_cycles(uint8_t cycles);
+
+void jit_emit_store_8(uint8_t offset, uint8_t val);
+
+void jit_emit_store_16(uint8_t offset, uint16_t val);
+
+void jit_emit_copy_8(uint8_t dst_offset, uint8_t src_offset);
+
+// Add to a 16 bits field without touching anything else
+void jit_emit_add_16(uint8_t offset, int8_t val);
+
+void jit_emit_load_operand(uint8_t offset);
+
+void jit_emit_load_imm_operand(uint8_t val);
+
+// Read the byte at the address held in a 16 bits field through the page
+// tables, the slow path of the bus is called with the clock up to date
+void jit_emit_read_operand(uint8_t addr_offset);
+
+void jit_emit_store_operand(uint8_t offset);
+
+// Write an 8 bits field at the address held in a 16 bits field, like
+// jit_emit_read_operand. A write through the slow path is remembered for
+// the next jit_emit_exit_check
+void jit_emit_write_8(uint8_t addr_offset, uint8_t src_offset);
+
+// A = A op operand, the lazy flags of cpu_registers_t (cpu.h) are recorded
+// with the given kind
+void jit_emit_alu_8(jit_alu_op_t op, uint8_t flags_kind);
+
+// INC or DEC of an 8 bits field, the carry is left untouched
+void jit_emit_inc_8(uint8_t offset, bool decrement, uint8_t flags_kind);
+
+// Set PC to target and add the cycles of the taken branch when the byte
+// field is zero (if_zero) or not
+void jit_emit_branch(uint8_t flag_offset, bool if_zero, uint16_t target, uint8_t taken_cycles);
+
+// Leave the block with PC set to pc if check(context, arg_1, arg_2) returns
+// True, nb_done entries are reported. With after_slow_write, the check is
+// only called when a write of jit_emit_write_8 took the slow path
+void jit_emit_exit_check(bool after_slow_write, void *check, const void *arg_1, uint32_t arg_2, uint16_t pc, uint8_t nb_done);
+
+// Call function(context, arg_1, arg_2) and add the cycles it returns
+void jit_emit_call(void *function, uint8_t arg_1, uint16_t arg_2);
+
+jit_block_t jit_end(uint8_t nb_done);
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Select the controller from the cartridge type and map the initial banks
+// Writes to battery backed RAM are tracked per page for mbc_flush_ram
+void mbc_init(uint8_t type, uint8_t *rom, uint16_t rom_banks, uint8_t *ram, uint8_t ram_banks, bool battery);
+
+// ROM bank mapped at addr, 0 outside of the ROM area
+uint16_t mbc_get_rom_bank(uint16_t addr);
+
+// Writes to the ROM area are commands for the controller
+void mbc_write(uint16_t addr, uint8_t val);
+
+// External RAM accesses that are not mapped (RAM disabled, RTC registers)
+uint8_t mbc_read_ram(uint16_t addr);
+
+void mbc_write_ram(uint16_t addr, uint8_t val);
+
+// Call flush on every external RAM range written since the last call
+void mbc_flush_ram(void (*flush)(uint8_t *data, uint32_t size));
\ No newline at end of file
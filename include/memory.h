@@ -2,9 +2,14 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
 
 #define MEMORY_ROM_BANK_SIZE 0x4000
+#define MEMORY_EXTERNAL_RAM_BANK_SIZE 0x2000
 #define MEMORY_SIZE 0x10000
+#define MEMORY_PAGE_SIZE 0x100
+#define MEMORY_NB_PAGES (MEMORY_SIZE / MEMORY_PAGE_SIZE)
+#define MEMORY_OAM_SIZE 0xa0
 #define MEMORY_END_ADDR 0xffff
 
 #define MEMORY_ROM_BANK_0_START_ADDR 0x0000
@@ -16,8 +21,16 @@
 #define MEMORY_RST_28 0x0028
 #define MEMORY_RST_30 0x0030
 #define MEMORY_RST_38 0x0038
+#define MEMORY_ROM_BANK_N_START_ADDR 0x4000
 #define MEMORY_VRAM_START_ADDR 0x8000
+#define MEMORY_TILE_MAPS_START_ADDR 0x9800
+#define MEMORY_EXTERNAL_RAM_START_ADDR 0xa000
+#define MEMORY_WRAM_START_ADDR 0xc000
+#define MEMORY_ECHO_RAM_START_ADDR 0xe000
+#define MEMORY_OAM_START_ADDR 0xfe00
+#define MEMORY_UNUSABLE_START_ADDR 0xfea0
 #define MEMORY_IO_START_ADDR 0xff00
+#define MEMORY_HRAM_START_ADDR 0xff80
 #define MEMORY_REG_DIV 0xff04
 #define MEMORY_REG_TIMA 0xff05
 #define MEMORY_REG_TMA 0xff06
@@ -47,6 +60,7 @@
 #define MEMORY_REG_SCX 0xff43
 #define MEMORY_REG_LY 0xff44
 #define MEMORY_REG_LYC 0xff45
+#define MEMORY_REG_DMA 0xff46
 #define MEMORY_REG_BGP 0xff47
 #define MEMORY_REG_OBP0 0xff48
 #define MEMORY_REG_OBP1 0xff49
@@ -69,33 +83,92 @@
 #define MEMORY_IEF_SERIAL 3
 #define MEMORY_IEF_JOYPAD 4
 
-#define MEMORY_STAT_COINCID_INT 6  // LYC=LY Coincidence Interrupt
-#define MEMORY_STAT_OAM_INT 5      // Mode 2 OAM Interrupt
-#define MEMORY_STAT_VBLANK_INT 4   // Mode 1 V-Blank Interrupt
-#define MEMORY_STAT_HBLANK_INT 3   // Mode 0 H-Blank Interrupt
-#define MEMORY_STAT_COINCID_FLAG 2 // Coincidence Flag
-#define MEMORY_STAT_MODE1 1        // Mode Flag 1/2
-#define MEMORY_STAT_MODE0 0        // Mode Flag 2/2
+#define MEMORY_STAT_COINCID_INT 6      // LYC=LY Coincidence Interrupt
+#define MEMORY_STAT_OAM_INT 5          // Mode 2 OAM Interrupt
+#define MEMORY_STAT_VBLANK_INT 4       // Mode 1 V-Blank Interrupt
+#define MEMORY_STAT_HBLANK_INT 3       // Mode 0 H-Blank Interrupt
+#define MEMORY_STAT_COINCID_FLAG 2     // Coincidence Flag
+#define MEMORY_STAT_MODE1 1            // Mode Flag 1/2
+#define MEMORY_STAT_MODE0 0            // Mode Flag 2/2
+#define MEMORY_STAT_MODE_MASK 0x3      // Bit 0-1
+#define MEMORY_STAT_READ_ONLY_MASK 0x7 // Bit 0-2
 
 #define MEMORY_TAC_TIMER_ENABLED 2
 #define MEMORY_TAC_INPUT_CLOCK_MASK 0x3 // Bit 0-1
 
 void memory_init(void);
 
+/*
+    Page tables of the bus, one host pointer per 256 bytes page.
+    A NULL entry sends the access to the slow path (I/O registers, OAM,
+    unusable range and read only areas), every other access is a single
+    indexed load or store.
+*/
+extern uint8_t *memory_read_pages[MEMORY_NB_PAGES];
+extern uint8_t *memory_write_pages[MEMORY_NB_PAGES];
+
+// Point the pages of [start_addr, end_addr) to a host buffer
+void memory_map_pages(uint16_t start_addr, uint32_t end_addr, uint8_t *host, bool writable);
+
+// Send the accesses of [start_addr, end_addr) to the slow path
+void memory_unmap_pages(uint16_t start_addr, uint32_t end_addr);
+
+// Send the writes of a page to the slow path until the next one, which
+// drops the instructions the CPU decoded from it
+void memory_watch_code_page(uint8_t page);
+
 void memory_read(uint8_t buff[], uint16_t mem_start_addr, uint16_t size);
 
-uint8_t memory_read_8(uint16_t mem_start_addr);
+uint8_t memory_read_slow(uint16_t mem_start_addr);
+
+static inline uint8_t memory_read_8(uint16_t mem_start_addr)
+{
+    uint8_t *page = memory_read_pages[mem_start_addr / MEMORY_PAGE_SIZE];
+    if (page != NULL)
+        return page[mem_start_addr % MEMORY_PAGE_SIZE];
+
+    return memory_read_slow(mem_start_addr);
+}
 
-uint16_t memory_read_16(uint16_t mem_start_addr);
+static inline uint16_t memory_read_16(uint16_t mem_start_addr)
+{
+    return memory_read_8(mem_start_addr) | (memory_read_8(mem_start_addr + 1) << 8);
+}
 
 void memory_write(uint8_t buff[], uint16_t mem_start_addr, uint16_t size);
 
-void memory_write_8(uint16_t mem_start_addr, uint8_t val);
+void memory_write_slow(uint16_t mem_start_addr, uint8_t val);
 
-void memory_write_16(uint16_t mem_start_addr, uint16_t val);
+static inline void memory_write_8(uint16_t mem_start_addr, uint8_t val)
+{
+    uint8_t *page = memory_write_pages[mem_start_addr / MEMORY_PAGE_SIZE];
+    if (page != NULL)
+    {
+        page[mem_start_addr % MEMORY_PAGE_SIZE] = val;
+        return;
+    }
+
+    memory_write_slow(mem_start_addr, val);
+}
+
+static inline void memory_write_16(uint16_t mem_start_addr, uint16_t val)
+{
+    memory_write_8(mem_start_addr, val & 0xff);
+    memory_write_8(mem_start_addr + 1, val >> 8);
+}
 
 void memory_print(uint16_t mem_start_addr, uint16_t size);
 
+// Host view of the memory from addr for the components fetching in bulk
+// (PPU), the owners are not synchronized
+const uint8_t *memory_get_host(uint16_t addr);
+
+// Raw register access for the components owning the register
+// (memory_read_8/memory_write_8 synchronize the owner first)
+uint8_t memory_read_reg(uint16_t reg_addr);
+
+void memory_write_reg(uint16_t reg_addr, uint8_t val);
+
 bool memory_get_reg_value(uint16_t reg_addr, uint8_t bit);
 
 void memory_write_reg_value(uint16_t reg_addr, uint8_t bit, bool value);
\ No newline at end of file
@@ -0,0 +1,606 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+    Opcode tables, shared by the CPU and the recompiler
+    X(opcode, handler, operand, clock cycles, clock cycles with the branch taken, flags, mnemonic)
+    The handlers are defined in cpu.c. The flags are given in the Z N H C
+    order: set from the result, 0 or 1 when forced and - when left untouched.
+    The CB prefixed table has no operand and a single duration, prefix
+    included, its handlers decode the bit and the register from the opcode
+*/
+typedef enum
+{
+    OPERAND_NONE,
+    OPERAND_D8,  // Immediate byte
+    OPERAND_A8,  // Address in the I/O page (FF00+nn)
+    OPERAND_S8,  // Signed offset added to SP
+    OPERAND_R8,  // Signed offset of a relative jump
+    OPERAND_CB,  // Opcode following the CB prefix
+    OPERAND_D16, // Immediate word
+    OPERAND_A16, // Address
+} cpu_operand_t;
+
+// Length of the whole instruction in bytes
+#define OPERAND_LENGTH(operand) ((operand) == OPERAND_NONE ? 1 : (operand) < OPERAND_D16 ? 2 : 3)
+
+#define CPU_OPCODES(X)  \
+    X(0x00, inst_nop,           OPERAND_NONE, 4,  4,  "----", "NOP") \
+    X(0x01, inst_ld_bc_nnnn,    OPERAND_D16,  12, 12, "----", "LD BC, nnnn") \
+    X(0x02, inst_unimplemented, OPERAND_NONE, 8,  8,  "----", "LD (BC), A") \
+    X(0x03, inst_inc_bc,        OPERAND_NONE, 8,  8,  "----", "INC BC") \
+    X(0x04, inst_inc_b,         OPERAND_NONE, 4,  4,  "Z0H-", "INC B") \
+    X(0x05, inst_dec_b,         OPERAND_NONE, 4,  4,  "Z1H-", "DEC B") \
+    X(0x06, inst_ld_b_nn,       OPERAND_D8,   8,  8,  "----", "LD B, nn") \
+    X(0x07, inst_unimplemented, OPERAND_NONE, 4,  4,  "000C", "RLCA") \
+    X(0x08, inst_unimplemented, OPERAND_A16,  20, 20, "----", "LD (nnnn), SP") \
+    X(0x09, inst_unimplemented, OPERAND_NONE, 8,  8,  "-0HC", "ADD HL, BC") \
+    X(0x0a, inst_unimplemented, OPERAND_NONE, 8,  8,  "----", "LD A, (BC)") \
+    X(0x0b, inst_dec_bc,        OPERAND_NONE, 8,  8,  "----", "DEC BC") \
+    X(0x0c, inst_inc_c,         OPERAND_NONE, 4,  4,  "Z0H-", "INC C") \
+    X(0x0d, inst_dec_c,         OPERAND_NONE, 4,  4,  "Z1H-", "DEC C") \
+    X(0x0e, inst_ld_c_nn,       OPERAND_D8,   8,  8,  "----", "LD C, nn") \
+    X(0x0f, inst_unimplemented, OPERAND_NONE, 4,  4,  "000C", "RRCA") \
+    X(0x10, inst_stop,          OPERAND_D8,   4,  4,  "----", "STOP") \
+    X(0x11, inst_ld_de_nnnn,    OPERAND_D16,  12, 12, "----", "LD DE, nnnn") \
+    X(0x12, inst_ld_ind_de_a,   OPERAND_NONE, 8,  8,  "----", "LD (DE), A") \
+    X(0x13, inst_inc_de,        OPERAND_NONE, 8,  8,  "----", "INC DE") \
+    X(0x14, inst_inc_d,         OPERAND_NONE, 4,  4,  "Z0H-", "INC D") \
+    X(0x15, inst_dec_d,         OPERAND_NONE, 4,  4,  "Z1H-", "DEC D") \
+    X(0x16, inst_ld_d_nn,       OPERAND_D8,   8,  8,  "----", "LD D, nn") \
+    X(0x17, inst_unimplemented, OPERAND_NONE, 4,  4,  "000C", "RLA") \
+    X(0x18, inst_jr,            OPERAND_R8,   12, 12, "----", "JR nn") \
+    X(0x19, inst_add_hl_de,     OPERAND_NONE, 8,  8,  "-0HC", "ADD HL, DE") \
+    X(0x1a, inst_ld_a_ind_de,   OPERAND_NONE, 8,  8,  "----", "LD A, (DE)") \
+    X(0x1b, inst_unimplemented, OPERAND_NONE, 8,  8,  "----", "DEC DE") \
+    X(0x1c, inst_inc_e,         OPERAND_NONE, 4,  4,  "Z0H-", "INC E") \
+    X(0x1d, inst_unimplemented, OPERAND_NONE, 4,  4,  "Z1H-", "DEC E") \
+    X(0x1e, inst_unimplemented, OPERAND_D8,   8,  8,  "----", "LD E, nn") \
+    X(0x1f, inst_unimplemented, OPERAND_NONE, 4,  4,  "000C", "RRA") \
+    X(0x20, inst_jr_nz,         OPERAND_R8,   8,  12, "----", "JR NZ, nn") \
+    X(0x21, inst_ld_hl_nnnn,    OPERAND_D16,  12, 12, "----", "LD HL, nnnn") \
+    X(0x22, inst_ldi_ind_hl_a,  OPERAND_NONE, 8,  8,  "----", "LDI (HL), A") \
+    X(0x23, inst_inc_hl,        OPERAND_NONE, 8,  8,  "----", "INC HL") \
+    X(0x24, inst_unimplemented, OPERAND_NONE, 4,  4,  "Z0H-", "INC H") \
+    X(0x25, inst_unimplemented, OPERAND_NONE, 4,  4,  "Z1H-", "DEC H") \
+    X(0x26, inst_unimplemented, OPERAND_D8,   8,  8,  "----", "LD H, nn") \
+    X(0x27, inst_unimplemented, OPERAND_NONE, 4,  4,  "Z-0C", "DAA") \
+    X(0x28, inst_jr_z,          OPERAND_R8,   8,  12, "----", "JR Z, nn") \
+    X(0x29, inst_unimplemented, OPERAND_NONE, 8,  8,  "-0HC", "ADD HL, HL") \
+    X(0x2a, inst_ldi_a_ind_hl,  OPERAND_NONE, 8,  8,  "----", "LDI A, (HL)") \
+    X(0x2b, inst_unimplemented, OPERAND_NONE, 8,  8,  "----", "DEC HL") \
+    X(0x2c, inst_unimplemented, OPERAND_NONE, 4,  4,  "Z0H-", "INC L") \
+    X(0x2d, inst_unimplemented, OPERAND_NONE, 4,  4,  "Z1H-", "DEC L") \
+    X(0x2e, inst_unimplemented, OPERAND_D8,   8,  8,  "----", "LD L, nn") \
+    X(0x2f, inst_cpl,           OPERAND_NONE, 4,  4,  "-11-", "CPL") \
+    X(0x30, inst_jr_nc,         OPERAND_R8,   8,  12, "----", "JR NC, nn") \
+    X(0x31, inst_ld_sp_nnnn,    OPERAND_D16,  12, 12, "----", "LD SP, nnnn") \
+    X(0x32, inst_ldd_ind_hl_a,  OPERAND_NONE, 8,  8,  "----", "LDD (HL), A") \
+    X(0x33, inst_unimplemented, OPERAND_NONE, 8,  8,  "----", "INC SP") \
+    X(0x34, inst_unimplemented, OPERAND_NONE, 12, 12, "Z0H-", "INC (HL)") \
+    X(0x35, inst_unimplemented, OPERAND_NONE, 12, 12, "Z1H-", "DEC (HL)") \
+    X(0x36, inst_ld_ind_hl_nn,  OPERAND_D8,   12, 12, "----", "LD (HL), nn") \
+    X(0x37, inst_unimplemented, OPERAND_NONE, 4,  4,  "-001", "SCF") \
+    X(0x38, inst_unimplemented, OPERAND_R8,   8,  12, "----", "JR C, nn") \
+    X(0x39, inst_unimplemented, OPERAND_NONE, 8,  8,  "-0HC", "ADD HL, SP") \
+    X(0x3a, inst_unimplemented, OPERAND_NONE, 8,  8,  "----", "LDD A, (HL)") \
+    X(0x3b, inst_unimplemented, OPERAND_NONE, 8,  8,  "----", "DEC SP") \
+    X(0x3c, inst_inc_a,         OPERAND_NONE, 4,  4,  "Z0H-", "INC A") \
+    X(0x3d, inst_unimplemented, OPERAND_NONE, 4,  4,  "Z1H-", "DEC A") \
+    X(0x3e, inst_ld_a_nn,       OPERAND_D8,   8,  8,  "----", "LD A, nn") \
+    X(0x3f, inst_ccf,           OPERAND_NONE, 4,  4,  "-00C", "CCF") \
+    X(0x40, inst_ld_b_b,        OPERAND_NONE, 4,  4,  "----", "LD B, B") \
+    X(0x41, inst_unimplemented, OPERAND_NONE, 4,  4,  "----", "LD B, C") \
+    X(0x42, inst_unimplemented, OPERAND_NONE, 4,  4,  "----", "LD B, D") \
+    X(0x43, inst_unimplemented, OPERAND_NONE, 4,  4,  "----", "LD B, E") \
+    X(0x44, inst_unimplemented, OPERAND_NONE, 4,  4,  "----", "LD B, H") \
+    X(0x45, inst_unimplemented, OPERAND_NONE, 4,  4,  "----", "LD B, L") \
+    X(0x46, inst_unimplemented, OPERAND_NONE, 8,  8,  "----", "LD B, (HL)") \
+    X(0x47, inst_ld_b_a,        OPERAND_NONE, 4,  4,  "----", "LD B, A") \
+    X(0x48, inst_unimplemented, OPERAND_NONE, 4,  4,  "----", "LD C, B") \
+    X(0x49, inst_unimplemented, OPERAND_NONE, 4,  4,  "----", "LD C, C") \
+    X(0x4a, inst_unimplemented, OPERAND_NONE, 4,  4,  "----", "LD C, D") \
+    X(0x4b, inst_unimplemented, OPERAND_NONE, 4,  4,  "----", "LD C, E") \
+    X(0x4c, inst_unimplemented, OPERAND_NONE, 4,  4,  "----", "LD C, H") \
+    X(0x4d, inst_unimplemented, OPERAND_NONE, 4,  4,  "----", "LD C, L") \
+    X(0x4e, inst_unimplemented, OPERAND_NONE, 8,  8,  "----", "LD C, (HL)") \
+    X(0x4f, inst_ld_c_a,        OPERAND_NONE, 4,  4,  "----", "LD C, A") \
+    X(0x50, inst_ld_d_b,        OPERAND_NONE, 4,  4,  "----", "LD D, B") \
+    X(0x51, inst_unimplemented, OPERAND_NONE, 4,  4,  "----", "LD D, C") \
+    X(0x52, inst_unimplemented, OPERAND_NONE, 4,  4,  "----", "LD D, D") \
+    X(0x53, inst_unimplemented, OPERAND_NONE, 4,  4,  "----", "LD D, E") \
+    X(0x54, inst_unimplemented, OPERAND_NONE, 4,  4,  "----", "LD D, H") \
+    X(0x55, inst_unimplemented, OPERAND_NONE, 4,  4,  "----", "LD D, L") \
+    X(0x56, inst_ld_d_ind_hl,   OPERAND_NONE, 8,  8,  "----", "LD D, (HL)") \
+    X(0x57, inst_unimplemented, OPERAND_NONE, 4,  4,  "----", "LD D, A") \
+    X(0x58, inst_unimplemented, OPERAND_NONE, 4,  4,  "----", "LD E, B") \
+    X(0x59, inst_unimplemented, OPERAND_NONE, 4,  4,  "----", "LD E, C") \
+    X(0x5a, inst_unimplemented, OPERAND_NONE, 4,  4,  "----", "LD E, D") \
+    X(0x5b, inst_unimplemented, OPERAND_NONE, 4,  4,  "----", "LD E, E") \
+    X(0x5c, inst_unimplemented, OPERAND_NONE, 4,  4,  "----", "LD E, H") \
+    X(0x5d, inst_unimplemented, OPERAND_NONE, 4,  4,  "----", "LD E, L") \
+    X(0x5e, inst_ld_e_ind_hl,   OPERAND_NONE, 8,  8,  "----", "LD E, (HL)") \
+    X(0x5f, inst_ld_e_a,        OPERAND_NONE, 4,  4,  "----", "LD E, A") \
+    X(0x60, inst_unimplemented, OPERAND_NONE, 4,  4,  "----", "LD H, B") \
+    X(0x61, inst_unimplemented, OPERAND_NONE, 4,  4,  "----", "LD H, C") \
+    X(0x62, inst_unimplemented, OPERAND_NONE, 4,  4,  "----", "LD H, D") \
+    X(0x63, inst_unimplemented, OPERAND_NONE, 4,  4,  "----", "LD H, E") \
+    X(0x64, inst_unimplemented, OPERAND_NONE, 4,  4,  "----", "LD H, H") \
+    X(0x65, inst_unimplemented, OPERAND_NONE, 4,  4,  "----", "LD H, L") \
+    X(0x66, inst_unimplemented, OPERAND_NONE, 8,  8,  "----", "LD H, (HL)") \
+    X(0x67, inst_ld_h_a,        OPERAND_NONE, 4,  4,  "----", "LD H, A") \
+    X(0x68, inst_unimplemented, OPERAND_NONE, 4,  4,  "----", "LD L, B") \
+    X(0x69, inst_unimplemented, OPERAND_NONE, 4,  4,  "----", "LD L, C") \
+    X(0x6a, inst_unimplemented, OPERAND_NONE, 4,  4,  "----", "LD L, D") \
+    X(0x6b, inst_unimplemented, OPERAND_NONE, 4,  4,  "----", "LD L, E") \
+    X(0x6c, inst_unimplemented, OPERAND_NONE, 4,  4,  "----", "LD L, H") \
+    X(0x6d, inst_unimplemented, OPERAND_NONE, 4,  4,  "----", "LD L, L") \
+    X(0x6e, inst_unimplemented, OPERAND_NONE, 8,  8,  "----", "LD L, (HL)") \
+    X(0x6f, inst_ld_l_a,        OPERAND_NONE, 4,  4,  "----", "LD L, A") \
+    X(0x70, inst_ld_ind_hl_b,   OPERAND_NONE, 8,  8,  "----", "LD (HL), B") \
+    X(0x71, inst_unimplemented, OPERAND_NONE, 8,  8,  "----", "LD (HL), C") \
+    X(0x72, inst_unimplemented, OPERAND_NONE, 8,  8,  "----", "LD (HL), D") \
+    X(0x73, inst_unimplemented, OPERAND_NONE, 8,  8,  "----", "LD (HL), E") \
+    X(0x74, inst_unimplemented, OPERAND_NONE, 8,  8,  "----", "LD (HL), H") \
+    X(0x75, inst_unimplemented, OPERAND_NONE, 8,  8,  "----", "LD (HL), L") \
+    X(0x76, inst_halt,          OPERAND_NONE, 4,  4,  "----", "HALT") \
+    X(0x77, inst_unimplemented, OPERAND_NONE, 8,  8,  "----", "LD (HL), A") \
+    X(0x78, inst_ld_a_b,        OPERAND_NONE, 4,  4,  "----", "LD A, B") \
+    X(0x79, inst_ld_a_c,        OPERAND_NONE, 4,  4,  "----", "LD A, C") \
+    X(0x7a, inst_unimplemented, OPERAND_NONE, 4,  4,  "----", "LD A, D") \
+    X(0x7b, inst_unimplemented, OPERAND_NONE, 4,  4,  "----", "LD A, E") \
+    X(0x7c, inst_ld_a_h,        OPERAND_NONE, 4,  4,  "----", "LD A, H") \
+    X(0x7d, inst_ld_a_l,        OPERAND_NONE, 4,  4,  "----", "LD A, L") \
+    X(0x7e, inst_ld_a_ind_hl,   OPERAND_NONE, 8,  8,  "----", "LD A, (HL)") \
+    X(0x7f, inst_ld_a_a,        OPERAND_NONE, 4,  4,  "----", "LD A, A") \
+    X(0x80, inst_add_a_b,       OPERAND_NONE, 4,  4,  "Z0HC", "ADD A, B") \
+    X(0x81, inst_add_a_c,       OPERAND_NONE, 4,  4,  "Z0HC", "ADD A, C") \
+    X(0x82, inst_unimplemented, OPERAND_NONE, 4,  4,  "Z0HC", "ADD A, D") \
+    X(0x83, inst_unimplemented, OPERAND_NONE, 4,  4,  "Z0HC", "ADD A, E") \
+    X(0x84, inst_unimplemented, OPERAND_NONE, 4,  4,  "Z0HC", "ADD A, H") \
+    X(0x85, inst_unimplemented, OPERAND_NONE, 4,  4,  "Z0HC", "ADD A, L") \
+    X(0x86, inst_unimplemented, OPERAND_NONE, 8,  8,  "Z0HC", "ADD A, (HL)") \
+    X(0x87, inst_add_a_a,       OPERAND_NONE, 4,  4,  "Z0HC", "ADD A, A") \
+    X(0x88, inst_unimplemented, OPERAND_NONE, 4,  4,  "Z0HC", "ADC A, B") \
+    X(0x89, inst_unimplemented, OPERAND_NONE, 4,  4,  "Z0HC", "ADC A, C") \
+    X(0x8a, inst_unimplemented, OPERAND_NONE, 4,  4,  "Z0HC", "ADC A, D") \
+    X(0x8b, inst_unimplemented, OPERAND_NONE, 4,  4,  "Z0HC", "ADC A, E") \
+    X(0x8c, inst_unimplemented, OPERAND_NONE, 4,  4,  "Z0HC", "ADC A, H") \
+    X(0x8d, inst_unimplemented, OPERAND_NONE, 4,  4,  "Z0HC", "ADC A, L") \
+    X(0x8e, inst_unimplemented, OPERAND_NONE, 8,  8,  "Z0HC", "ADC A, (HL)") \
+    X(0x8f, inst_unimplemented, OPERAND_NONE, 4,  4,  "Z0HC", "ADC A, A") \
+    X(0x90, inst_unimplemented, OPERAND_NONE, 4,  4,  "Z1HC", "SUB B") \
+    X(0x91, inst_unimplemented, OPERAND_NONE, 4,  4,  "Z1HC", "SUB C") \
+    X(0x92, inst_unimplemented, OPERAND_NONE, 4,  4,  "Z1HC", "SUB D") \
+    X(0x93, inst_unimplemented, OPERAND_NONE, 4,  4,  "Z1HC", "SUB E") \
+    X(0x94, inst_unimplemented, OPERAND_NONE, 4,  4,  "Z1HC", "SUB H") \
+    X(0x95, inst_unimplemented, OPERAND_NONE, 4,  4,  "Z1HC", "SUB L") \
+    X(0x96, inst_unimplemented, OPERAND_NONE, 8,  8,  "Z1HC", "SUB (HL)") \
+    X(0x97, inst_sub_a,         OPERAND_NONE, 4,  4,  "Z1HC", "SUB A") \
+    X(0x98, inst_unimplemented, OPERAND_NONE, 4,  4,  "Z1HC", "SBC A, B") \
+    X(0x99, inst_unimplemented, OPERAND_NONE, 4,  4,  "Z1HC", "SBC A, C") \
+    X(0x9a, inst_unimplemented, OPERAND_NONE, 4,  4,  "Z1HC", "SBC A, D") \
+    X(0x9b, inst_unimplemented, OPERAND_NONE, 4,  4,  "Z1HC", "SBC A, E") \
+    X(0x9c, inst_unimplemented, OPERAND_NONE, 4,  4,  "Z1HC", "SBC A, H") \
+    X(0x9d, inst_unimplemented, OPERAND_NONE, 4,  4,  "Z1HC", "SBC A, L") \
+    X(0x9e, inst_unimplemented, OPERAND_NONE, 8,  8,  "Z1HC", "SBC A, (HL)") \
+    X(0x9f, inst_unimplemented, OPERAND_NONE, 4,  4,  "Z1HC", "SBC A, A") \
+    X(0xa0, inst_unimplemented, OPERAND_NONE, 4,  4,  "Z010", "AND B") \
+    X(0xa1, inst_and_c,         OPERAND_NONE, 4,  4,  "Z010", "AND C") \
+    X(0xa2, inst_unimplemented, OPERAND_NONE, 4,  4,  "Z010", "AND D") \
+    X(0xa3, inst_unimplemented, OPERAND_NONE, 4,  4,  "Z010", "AND E") \
+    X(0xa4, inst_unimplemented, OPERAND_NONE, 4,  4,  "Z010", "AND H") \
+    X(0xa5, inst_unimplemented, OPERAND_NONE, 4,  4,  "Z010", "AND L") \
+    X(0xa6, inst_unimplemented, OPERAND_NONE, 8,  8,  "Z010", "AND (HL)") \
+    X(0xa7, inst_and_a,         OPERAND_NONE, 4,  4,  "Z010", "AND A") \
+    X(0xa8, inst_unimplemented, OPERAND_NONE, 4,  4,  "Z000", "XOR B") \
+    X(0xa9, inst_xor_c,         OPERAND_NONE, 4,  4,  "Z000", "XOR C") \
+    X(0xaa, inst_unimplemented, OPERAND_NONE, 4,  4,  "Z000", "XOR D") \
+    X(0xab, inst_unimplemented, OPERAND_NONE, 4,  4,  "Z000", "XOR E") \
+    X(0xac, inst_unimplemented, OPERAND_NONE, 4,  4,  "Z000", "XOR H") \
+    X(0xad, inst_unimplemented, OPERAND_NONE, 4,  4,  "Z000", "XOR L") \
+    X(0xae, inst_unimplemented, OPERAND_NONE, 8,  8,  "Z000", "XOR (HL)") \
+    X(0xaf, inst_xor_a,         OPERAND_NONE, 4,  4,  "Z000", "XOR A") \
+    X(0xb0, inst_or_b,          OPERAND_NONE, 4,  4,  "Z000", "OR B") \
+    X(0xb1, inst_or_c,          OPERAND_NONE, 4,  4,  "Z000", "OR C") \
+    X(0xb2, inst_unimplemented, OPERAND_NONE, 4,  4,  "Z000", "OR D") \
+    X(0xb3, inst_unimplemented, OPERAND_NONE, 4,  4,  "Z000", "OR E") \
+    X(0xb4, inst_unimplemented, OPERAND_NONE, 4,  4,  "Z000", "OR H") \
+    X(0xb5, inst_unimplemented, OPERAND_NONE, 4,  4,  "Z000", "OR L") \
+    X(0xb6, inst_unimplemented, OPERAND_NONE, 8,  8,  "Z000", "OR (HL)") \
+    X(0xb7, inst_unimplemented, OPERAND_NONE, 4,  4,  "Z000", "OR A") \
+    X(0xb8, inst_unimplemented, OPERAND_NONE, 4,  4,  "Z1HC", "CP B") \
+    X(0xb9, inst_unimplemented, OPERAND_NONE, 4,  4,  "Z1HC", "CP C") \
+    X(0xba, inst_unimplemented, OPERAND_NONE, 4,  4,  "Z1HC", "CP D") \
+    X(0xbb, inst_unimplemented, OPERAND_NONE, 4,  4,  "Z1HC", "CP E") \
+    X(0xbc, inst_unimplemented, OPERAND_NONE, 4,  4,  "Z1HC", "CP H") \
+    X(0xbd, inst_unimplemented, OPERAND_NONE, 4,  4,  "Z1HC", "CP L") \
+    X(0xbe, inst_unimplemented, OPERAND_NONE, 8,  8,  "Z1HC", "CP (HL)") \
+    X(0xbf, inst_cp_a,          OPERAND_NONE, 4,  4,  "Z1HC", "CP A") \
+    X(0xc0, inst_unimplemented, OPERAND_NONE, 8,  20, "----", "RET NZ") \
+    X(0xc1, inst_pop_bc,        OPERAND_NONE, 12, 12, "----", "POP BC") \
+    X(0xc2, inst_unimplemented, OPERAND_D16,  12, 16, "----", "JP NZ, nnnn") \
+    X(0xc3, inst_jp,            OPERAND_D16,  16, 16, "----", "JP nnnn") \
+    X(0xc4, inst_call_nz,       OPERAND_D16,  12, 24, "----", "CALL NZ, nnnn") \
+    X(0xc5, inst_push_bc,       OPERAND_NONE, 16, 16, "----", "PUSH BC") \
+    X(0xc6, inst_unimplemented, OPERAND_D8,   8,  8,  "Z0HC", "ADD A, nn") \
+    X(0xc7, inst_unimplemented, OPERAND_NONE, 16, 16, "----", "RST 00") \
+    X(0xc8, inst_ret_z,         OPERAND_NONE, 8,  20, "----", "RET Z") \
+    X(0xc9, inst_ret,           OPERAND_NONE, 16, 16, "----", "RET") \
+    X(0xca, inst_jp_z,          OPERAND_D16,  12, 16, "----", "JP Z, nnnn") \
+    X(0xcb, inst_prefix_cb,     OPERAND_CB,   8,  16, "----", "PREFIX CB") \
+    X(0xcc, inst_unimplemented, OPERAND_D16,  12, 24, "----", "CALL Z, nnnn") \
+    X(0xcd, inst_call,          OPERAND_D16,  24, 24, "----", "CALL nnnn") \
+    X(0xce, inst_unimplemented, OPERAND_D8,   8,  8,  "Z0HC", "ADC A, nn") \
+    X(0xcf, inst_unimplemented, OPERAND_NONE, 16, 16, "----", "RST 08") \
+    X(0xd0, inst_unimplemented, OPERAND_NONE, 8,  20, "----", "RET NC") \
+    X(0xd1, inst_pop_de,        OPERAND_NONE, 12, 12, "----", "POP DE") \
+    X(0xd2, inst_unimplemented, OPERAND_D16,  12, 16, "----", "JP NC, nnnn") \
+    X(0xd3, inst_unimplemented, OPERAND_NONE, 4,  4,  "----", "ILLEGAL") \
+    X(0xd4, inst_unimplemented, OPERAND_D16,  12, 24, "----", "CALL NC, nnnn") \
+    X(0xd5, inst_push_de,       OPERAND_NONE, 16, 16, "----", "PUSH DE") \
+    X(0xd6, inst_unimplemented, OPERAND_D8,   8,  8,  "Z1HC", "SUB nn") \
+    X(0xd7, inst_unimplemented, OPERAND_NONE, 16, 16, "----", "RST 10") \
+    X(0xd8, inst_unimplemented, OPERAND_NONE, 8,  20, "----", "RET C") \
+    X(0xd9, inst_reti,          OPERAND_NONE, 16, 16, "----", "RETI") \
+    X(0xda, inst_unimplemented, OPERAND_D16,  12, 16, "----", "JP C, nnnn") \
+    X(0xdb, inst_unimplemented, OPERAND_NONE, 4,  4,  "----", "ILLEGAL") \
+    X(0xdc, inst_unimplemented, OPERAND_D16,  12, 24, "----", "CALL C, nnnn") \
+    X(0xdd, inst_unimplemented, OPERAND_NONE, 4,  4,  "----", "ILLEGAL") \
+    X(0xde, inst_unimplemented, OPERAND_D8,   8,  8,  "Z1HC", "SBC A, nn") \
+    X(0xdf, inst_unimplemented, OPERAND_NONE, 16, 16, "----", "RST 18") \
+    X(0xe0, inst_ldh_ind_nn_a,  OPERAND_A8,   12, 12, "----", "LD (FF00+nn), A") \
+    X(0xe1, inst_pop_hl,        OPERAND_NONE, 12, 12, "----", "POP HL") \
+    X(0xe2, inst_ldh_ind_c_a,   OPERAND_NONE, 8,  8,  "----", "LD (FF00+C), A") \
+    X(0xe3, inst_unimplemented, OPERAND_NONE, 4,  4,  "----", "ILLEGAL") \
+    X(0xe4, inst_unimplemented, OPERAND_NONE, 4,  4,  "----", "ILLEGAL") \
+    X(0xe5, inst_push_hl,       OPERAND_NONE, 16, 16, "----", "PUSH HL") \
+    X(0xe6, inst_and_nn,        OPERAND_D8,   8,  8,  "Z010", "AND nn") \
+    X(0xe7, inst_unimplemented, OPERAND_NONE, 16, 16, "----", "RST 20") \
+    X(0xe8, inst_unimplemented, OPERAND_S8,   16, 16, "00HC", "ADD SP, nn") \
+    X(0xe9, inst_jp_hl,         OPERAND_NONE, 4,  4,  "----", "JP HL") \
+    X(0xea, inst_ld_ind_nnnn_a, OPERAND_A16,  16, 16, "----", "LD (nnnn), A") \
+    X(0xeb, inst_unimplemented, OPERAND_NONE, 4,  4,  "----", "ILLEGAL") \
+    X(0xec, inst_unimplemented, OPERAND_NONE, 4,  4,  "----", "ILLEGAL") \
+    X(0xed, inst_unimplemented, OPERAND_NONE, 4,  4,  "----", "ILLEGAL") \
+    X(0xee, inst_unimplemented, OPERAND_D8,   8,  8,  "Z000", "XOR nn") \
+    X(0xef, inst_rst_28,        OPERAND_NONE, 16, 16, "----", "RST 28") \
+    X(0xf0, inst_ldh_a_ind_nn,  OPERAND_A8,   12, 12, "----", "LD A, (FF00+nn)") \
+    X(0xf1, inst_pop_af,        OPERAND_NONE, 12, 12, "ZNHC", "POP AF") \
+    X(0xf2, inst_unimplemented, OPERAND_NONE, 8,  8,  "----", "LD A, (FF00+C)") \
+    X(0xf3, inst_di,            OPERAND_NONE, 4,  4,  "----", "DI") \
+    X(0xf4, inst_unimplemented, OPERAND_NONE, 4,  4,  "----", "ILLEGAL") \
+    X(0xf5, inst_push_af,       OPERAND_NONE, 16, 16, "----", "PUSH AF") \
+    X(0xf6, inst_unimplemented, OPERAND_D8,   8,  8,  "Z000", "OR nn") \
+    X(0xf7, inst_unimplemented, OPERAND_NONE, 16, 16, "----", "RST 30") \
+    X(0xf8, inst_unimplemented, OPERAND_S8,   12, 12, "00HC", "LD HL, SP+nn") \
+    X(0xf9, inst_unimplemented, OPERAND_NONE, 8,  8,  "----", "LD SP, HL") \
+    X(0xfa, inst_ld_a_ind_nnnn, OPERAND_A16,  16, 16, "----", "LD A, (nnnn)") \
+    X(0xfb, inst_ei,            OPERAND_NONE, 4,  4,  "----", "EI") \
+    X(0xfc, inst_unimplemented, OPERAND_NONE, 4,  4,  "----", "ILLEGAL") \
+    X(0xfd, inst_unimplemented, OPERAND_NONE, 4,  4,  "----", "ILLEGAL") \
+    X(0xfe, inst_cp_nn,         OPERAND_D8,   8,  8,  "Z1HC", "CP nn") \
+    X(0xff, inst_rst_38,        OPERAND_NONE, 16, 16, "----", "RST 38")
+
+#define CPU_CB_OPCODES(X)  \
+    X(0x00, inst_cb_rlc,  8,  "Z00C", "RLC B") \
+    X(0x01, inst_cb_rlc,  8,  "Z00C", "RLC C") \
+    X(0x02, inst_cb_rlc,  8,  "Z00C", "RLC D") \
+    X(0x03, inst_cb_rlc,  8,  "Z00C", "RLC E") \
+    X(0x04, inst_cb_rlc,  8,  "Z00C", "RLC H") \
+    X(0x05, inst_cb_rlc,  8,  "Z00C", "RLC L") \
+    X(0x06, inst_cb_rlc,  16, "Z00C", "RLC (HL)") \
+    X(0x07, inst_cb_rlc,  8,  "Z00C", "RLC A") \
+    X(0x08, inst_cb_rrc,  8,  "Z00C", "RRC B") \
+    X(0x09, inst_cb_rrc,  8,  "Z00C", "RRC C") \
+    X(0x0a, inst_cb_rrc,  8,  "Z00C", "RRC D") \
+    X(0x0b, inst_cb_rrc,  8,  "Z00C", "RRC E") \
+    X(0x0c, inst_cb_rrc,  8,  "Z00C", "RRC H") \
+    X(0x0d, inst_cb_rrc,  8,  "Z00C", "RRC L") \
+    X(0x0e, inst_cb_rrc,  16, "Z00C", "RRC (HL)") \
+    X(0x0f, inst_cb_rrc,  8,  "Z00C", "RRC A") \
+    X(0x10, inst_cb_rl,   8,  "Z00C", "RL B") \
+    X(0x11, inst_cb_rl,   8,  "Z00C", "RL C") \
+    X(0x12, inst_cb_rl,   8,  "Z00C", "RL D") \
+    X(0x13, inst_cb_rl,   8,  "Z00C", "RL E") \
+    X(0x14, inst_cb_rl,   8,  "Z00C", "RL H") \
+    X(0x15, inst_cb_rl,   8,  "Z00C", "RL L") \
+    X(0x16, inst_cb_rl,   16, "Z00C", "RL (HL)") \
+    X(0x17, inst_cb_rl,   8,  "Z00C", "RL A") \
+    X(0x18, inst_cb_rr,   8,  "Z00C", "RR B") \
+    X(0x19, inst_cb_rr,   8,  "Z00C", "RR C") \
+    X(0x1a, inst_cb_rr,   8,  "Z00C", "RR D") \
+    X(0x1b, inst_cb_rr,   8,  "Z00C", "RR E") \
+    X(0x1c, inst_cb_rr,   8,  "Z00C", "RR H") \
+    X(0x1d, inst_cb_rr,   8,  "Z00C", "RR L") \
+    X(0x1e, inst_cb_rr,   16, "Z00C", "RR (HL)") \
+    X(0x1f, inst_cb_rr,   8,  "Z00C", "RR A") \
+    X(0x20, inst_cb_sla,  8,  "Z00C", "SLA B") \
+    X(0x21, inst_cb_sla,  8,  "Z00C", "SLA C") \
+    X(0x22, inst_cb_sla,  8,  "Z00C", "SLA D") \
+    X(0x23, inst_cb_sla,  8,  "Z00C", "SLA E") \
+    X(0x24, inst_cb_sla,  8,  "Z00C", "SLA H") \
+    X(0x25, inst_cb_sla,  8,  "Z00C", "SLA L") \
+    X(0x26, inst_cb_sla,  16, "Z00C", "SLA (HL)") \
+    X(0x27, inst_cb_sla,  8,  "Z00C", "SLA A") \
+    X(0x28, inst_cb_sra,  8,  "Z00C", "SRA B") \
+    X(0x29, inst_cb_sra,  8,  "Z00C", "SRA C") \
+    X(0x2a, inst_cb_sra,  8,  "Z00C", "SRA D") \
+    X(0x2b, inst_cb_sra,  8,  "Z00C", "SRA E") \
+    X(0x2c, inst_cb_sra,  8,  "Z00C", "SRA H") \
+    X(0x2d, inst_cb_sra,  8,  "Z00C", "SRA L") \
+    X(0x2e, inst_cb_sra,  16, "Z00C", "SRA (HL)") \
+    X(0x2f, inst_cb_sra,  8,  "Z00C", "SRA A") \
+    X(0x30, inst_cb_swap, 8,  "Z000", "SWAP B") \
+    X(0x31, inst_cb_swap, 8,  "Z000", "SWAP C") \
+    X(0x32, inst_cb_swap, 8,  "Z000", "SWAP D") \
+    X(0x33, inst_cb_swap, 8,  "Z000", "SWAP E") \
+    X(0x34, inst_cb_swap, 8,  "Z000", "SWAP H") \
+    X(0x35, inst_cb_swap, 8,  "Z000", "SWAP L") \
+    X(0x36, inst_cb_swap, 16, "Z000", "SWAP (HL)") \
+    X(0x37, inst_cb_swap, 8,  "Z000", "SWAP A") \
+    X(0x38, inst_cb_srl,  8,  "Z00C", "SRL B") \
+    X(0x39, inst_cb_srl,  8,  "Z00C", "SRL C") \
+    X(0x3a, inst_cb_srl,  8,  "Z00C", "SRL D") \
+    X(0x3b, inst_cb_srl,  8,  "Z00C", "SRL E") \
+    X(0x3c, inst_cb_srl,  8,  "Z00C", "SRL H") \
+    X(0x3d, inst_cb_srl,  8,  "Z00C", "SRL L") \
+    X(0x3e, inst_cb_srl,  16, "Z00C", "SRL (HL)") \
+    X(0x3f, inst_cb_srl,  8,  "Z00C", "SRL A") \
+    X(0x40, inst_cb_bit,  8,  "Z01-", "BIT 0, B") \
+    X(0x41, inst_cb_bit,  8,  "Z01-", "BIT 0, C") \
+    X(0x42, inst_cb_bit,  8,  "Z01-", "BIT 0, D") \
+    X(0x43, inst_cb_bit,  8,  "Z01-", "BIT 0, E") \
+    X(0x44, inst_cb_bit,  8,  "Z01-", "BIT 0, H") \
+    X(0x45, inst_cb_bit,  8,  "Z01-", "BIT 0, L") \
+    X(0x46, inst_cb_bit,  12, "Z01-", "BIT 0, (HL)") \
+    X(0x47, inst_cb_bit,  8,  "Z01-", "BIT 0, A") \
+    X(0x48, inst_cb_bit,  8,  "Z01-", "BIT 1, B") \
+    X(0x49, inst_cb_bit,  8,  "Z01-", "BIT 1, C") \
+    X(0x4a, inst_cb_bit,  8,  "Z01-", "BIT 1, D") \
+    X(0x4b, inst_cb_bit,  8,  "Z01-", "BIT 1, E") \
+    X(0x4c, inst_cb_bit,  8,  "Z01-", "BIT 1, H") \
+    X(0x4d, inst_cb_bit,  8,  "Z01-", "BIT 1, L") \
+    X(0x4e, inst_cb_bit,  12, "Z01-", "BIT 1, (HL)") \
+    X(0x4f, inst_cb_bit,  8,  "Z01-", "BIT 1, A") \
+    X(0x50, inst_cb_bit,  8,  "Z01-", "BIT 2, B") \
+    X(0x51, inst_cb_bit,  8,  "Z01-", "BIT 2, C") \
+    X(0x52, inst_cb_bit,  8,  "Z01-", "BIT 2, D") \
+    X(0x53, inst_cb_bit,  8,  "Z01-", "BIT 2, E") \
+    X(0x54, inst_cb_bit,  8,  "Z01-", "BIT 2, H") \
+    X(0x55, inst_cb_bit,  8,  "Z01-", "BIT 2, L") \
+    X(0x56, inst_cb_bit,  12, "Z01-", "BIT 2, (HL)") \
+    X(0x57, inst_cb_bit,  8,  "Z01-", "BIT 2, A") \
+    X(0x58, inst_cb_bit,  8,  "Z01-", "BIT 3, B") \
+    X(0x59, inst_cb_bit,  8,  "Z01-", "BIT 3, C") \
+    X(0x5a, inst_cb_bit,  8,  "Z01-", "BIT 3, D") \
+    X(0x5b, inst_cb_bit,  8,  "Z01-", "BIT 3, E") \
+    X(0x5c, inst_cb_bit,  8,  "Z01-", "BIT 3, H") \
+    X(0x5d, inst_cb_bit,  8,  "Z01-", "BIT 3, L") \
+    X(0x5e, inst_cb_bit,  12, "Z01-", "BIT 3, (HL)") \
+    X(0x5f, inst_cb_bit,  8,  "Z01-", "BIT 3, A") \
+    X(0x60, inst_cb_bit,  8,  "Z01-", "BIT 4, B") \
+    X(0x61, inst_cb_bit,  8,  "Z01-", "BIT 4, C") \
+    X(0x62, inst_cb_bit,  8,  "Z01-", "BIT 4, D") \
+    X(0x63, inst_cb_bit,  8,  "Z01-", "BIT 4, E") \
+    X(0x64, inst_cb_bit,  8,  "Z01-", "BIT 4, H") \
+    X(0x65, inst_cb_bit,  8,  "Z01-", "BIT 4, L") \
+    X(0x66, inst_cb_bit,  12, "Z01-", "BIT 4, (HL)") \
+    X(0x67, inst_cb_bit,  8,  "Z01-", "BIT 4, A") \
+    X(0x68, inst_cb_bit,  8,  "Z01-", "BIT 5, B") \
+    X(0x69, inst_cb_bit,  8,  "Z01-", "BIT 5, C") \
+    X(0x6a, inst_cb_bit,  8,  "Z01-", "BIT 5, D") \
+    X(0x6b, inst_cb_bit,  8,  "Z01-", "BIT 5, E") \
+    X(0x6c, inst_cb_bit,  8,  "Z01-", "BIT 5, H") \
+    X(0x6d, inst_cb_bit,  8,  "Z01-", "BIT 5, L") \
+    X(0x6e, inst_cb_bit,  12, "Z01-", "BIT 5, (HL)") \
+    X(0x6f, inst_cb_bit,  8,  "Z01-", "BIT 5, A") \
+    X(0x70, inst_cb_bit,  8,  "Z01-", "BIT 6, B") \
+    X(0x71, inst_cb_bit,  8,  "Z01-", "BIT 6, C") \
+    X(0x72, inst_cb_bit,  8,  "Z01-", "BIT 6, D") \
+    X(0x73, inst_cb_bit,  8,  "Z01-", "BIT 6, E") \
+    X(0x74, inst_cb_bit,  8,  "Z01-", "BIT 6, H") \
+    X(0x75, inst_cb_bit,  8,  "Z01-", "BIT 6, L") \
+    X(0x76, inst_cb_bit,  12, "Z01-", "BIT 6, (HL)") \
+    X(0x77, inst_cb_bit,  8,  "Z01-", "BIT 6, A") \
+    X(0x78, inst_cb_bit,  8,  "Z01-", "BIT 7, B") \
+    X(0x79, inst_cb_bit,  8,  "Z01-", "BIT 7, C") \
+    X(0x7a, inst_cb_bit,  8,  "Z01-", "BIT 7, D") \
+    X(0x7b, inst_cb_bit,  8,  "Z01-", "BIT 7, E") \
+    X(0x7c, inst_cb_bit,  8,  "Z01-", "BIT 7, H") \
+    X(0x7d, inst_cb_bit,  8,  "Z01-", "BIT 7, L") \
+    X(0x7e, inst_cb_bit,  12, "Z01-", "BIT 7, (HL)") \
+    X(0x7f, inst_cb_bit,  8,  "Z01-", "BIT 7, A") \
+    X(0x80, inst_cb_res,  8,  "----", "RES 0, B") \
+    X(0x81, inst_cb_res,  8,  "----", "RES 0, C") \
+    X(0x82, inst_cb_res,  8,  "----", "RES 0, D") \
+    X(0x83, inst_cb_res,  8,  "----", "RES 0, E") \
+    X(0x84, inst_cb_res,  8,  "----", "RES 0, H") \
+    X(0x85, inst_cb_res,  8,  "----", "RES 0, L") \
+    X(0x86, inst_cb_res,  16, "----", "RES 0, (HL)") \
+    X(0x87, inst_cb_res,  8,  "----", "RES 0, A") \
+    X(0x88, inst_cb_res,  8,  "----", "RES 1, B") \
+    X(0x89, inst_cb_res,  8,  "----", "RES 1, C") \
+    X(0x8a, inst_cb_res,  8,  "----", "RES 1, D") \
+    X(0x8b, inst_cb_res,  8,  "----", "RES 1, E") \
+    X(0x8c, inst_cb_res,  8,  "----", "RES 1, H") \
+    X(0x8d, inst_cb_res,  8,  "----", "RES 1, L") \
+    X(0x8e, inst_cb_res,  16, "----", "RES 1, (HL)") \
+    X(0x8f, inst_cb_res,  8,  "----", "RES 1, A") \
+    X(0x90, inst_cb_res,  8,  "----", "RES 2, B") \
+    X(0x91, inst_cb_res,  8,  "----", "RES 2, C") \
+    X(0x92, inst_cb_res,  8,  "----", "RES 2, D") \
+    X(0x93, inst_cb_res,  8,  "----", "RES 2, E") \
+    X(0x94, inst_cb_res,  8,  "----", "RES 2, H") \
+    X(0x95, inst_cb_res,  8,  "----", "RES 2, L") \
+    X(0x96, inst_cb_res,  16, "----", "RES 2, (HL)") \
+    X(0x97, inst_cb_res,  8,  "----", "RES 2, A") \
+    X(0x98, inst_cb_res,  8,  "----", "RES 3, B") \
+    X(0x99, inst_cb_res,  8,  "----", "RES 3, C") \
+    X(0x9a, inst_cb_res,  8,  "----", "RES 3, D") \
+    X(0x9b, inst_cb_res,  8,  "----", "RES 3, E") \
+    X(0x9c, inst_cb_res,  8,  "----", "RES 3, H") \
+    X(0x9d, inst_cb_res,  8,  "----", "RES 3, L") \
+    X(0x9e, inst_cb_res,  16, "----", "RES 3, (HL)") \
+    X(0x9f, inst_cb_res,  8,  "----", "RES 3, A") \
+    X(0xa0, inst_cb_res,  8,  "----", "RES 4, B") \
+    X(0xa1, inst_cb_res,  8,  "----", "RES 4, C") \
+    X(0xa2, inst_cb_res,  8,  "----", "RES 4, D") \
+    X(0xa3, inst_cb_res,  8,  "----", "RES 4, E") \
+    X(0xa4, inst_cb_res,  8,  "----", "RES 4, H") \
+    X(0xa5, inst_cb_res,  8,  "----", "RES 4, L") \
+    X(0xa6, inst_cb_res,  16, "----", "RES 4, (HL)") \
+    X(0xa7, inst_cb_res,  8,  "----", "RES 4, A") \
+    X(0xa8, inst_cb_res,  8,  "----", "RES 5, B") \
+    X(0xa9, inst_cb_res,  8,  "----", "RES 5, C") \
+    X(0xaa, inst_cb_res,  8,  "----", "RES 5, D") \
+    X(0xab, inst_cb_res,  8,  "----", "RES 5, E") \
+    X(0xac, inst_cb_res,  8,  "----", "RES 5, H") \
+    X(0xad, inst_cb_res,  8,  "----", "RES 5, L") \
+    X(0xae, inst_cb_res,  16, "----", "RES 5, (HL)") \
+    X(0xaf, inst_cb_res,  8,  "----", "RES 5, A") \
+    X(0xb0, inst_cb_res,  8,  "----", "RES 6, B") \
+    X(0xb1, inst_cb_res,  8,  "----", "RES 6, C") \
+    X(0xb2, inst_cb_res,  8,  "----", "RES 6, D") \
+    X(0xb3, inst_cb_res,  8,  "----", "RES 6, E") \
+    X(0xb4, inst_cb_res,  8,  "----", "RES 6, H") \
+    X(0xb5, inst_cb_res,  8,  "----", "RES 6, L") \
+    X(0xb6, inst_cb_res,  16, "----", "RES 6, (HL)") \
+    X(0xb7, inst_cb_res,  8,  "----", "RES 6, A") \
+    X(0xb8, inst_cb_res,  8,  "----", "RES 7, B") \
+    X(0xb9, inst_cb_res,  8,  "----", "RES 7, C") \
+    X(0xba, inst_cb_res,  8,  "----", "RES 7, D") \
+    X(0xbb, inst_cb_res,  8,  "----", "RES 7, E") \
+    X(0xbc, inst_cb_res,  8,  "----", "RES 7, H") \
+    X(0xbd, inst_cb_res,  8,  "----", "RES 7, L") \
+    X(0xbe, inst_cb_res,  16, "----", "RES 7, (HL)") \
+    X(0xbf, inst_cb_res,  8,  "----", "RES 7, A") \
+    X(0xc0, inst_cb_set,  8,  "----", "SET 0, B") \
+    X(0xc1, inst_cb_set,  8,  "----", "SET 0, C") \
+    X(0xc2, inst_cb_set,  8,  "----", "SET 0, D") \
+    X(0xc3, inst_cb_set,  8,  "----", "SET 0, E") \
+    X(0xc4, inst_cb_set,  8,  "----", "SET 0, H") \
+    X(0xc5, inst_cb_set,  8,  "----", "SET 0, L") \
+    X(0xc6, inst_cb_set,  16, "----", "SET 0, (HL)") \
+    X(0xc7, inst_cb_set,  8,  "----", "SET 0, A") \
+    X(0xc8, inst_cb_set,  8,  "----", "SET 1, B") \
+    X(0xc9, inst_cb_set,  8,  "----", "SET 1, C") \
+    X(0xca, inst_cb_set,  8,  "----", "SET 1, D") \
+    X(0xcb, inst_cb_set,  8,  "----", "SET 1, E") \
+    X(0xcc, inst_cb_set,  8,  "----", "SET 1, H") \
+    X(0xcd, inst_cb_set,  8,  "----", "SET 1, L") \
+    X(0xce, inst_cb_set,  16, "----", "SET 1, (HL)") \
+    X(0xcf, inst_cb_set,  8,  "----", "SET 1, A") \
+    X(0xd0, inst_cb_set,  8,  "----", "SET 2, B") \
+    X(0xd1, inst_cb_set,  8,  "----", "SET 2, C") \
+    X(0xd2, inst_cb_set,  8,  "----", "SET 2, D") \
+    X(0xd3, inst_cb_set,  8,  "----", "SET 2, E") \
+    X(0xd4, inst_cb_set,  8,  "----", "SET 2, H") \
+    X(0xd5, inst_cb_set,  8,  "----", "SET 2, L") \
+    X(0xd6, inst_cb_set,  16, "----", "SET 2, (HL)") \
+    X(0xd7, inst_cb_set,  8,  "----", "SET 2, A") \
+    X(0xd8, inst_cb_set,  8,  "----", "SET 3, B") \
+    X(0xd9, inst_cb_set,  8,  "----", "SET 3, C") \
+    X(0xda, inst_cb_set,  8,  "----", "SET 3, D") \
+    X(0xdb, inst_cb_set,  8,  "----", "SET 3, E") \
+    X(0xdc, inst_cb_set,  8,  "----", "SET 3, H") \
+    X(0xdd, inst_cb_set,  8,  "----", "SET 3, L") \
+    X(0xde, inst_cb_set,  16, "----", "SET 3, (HL)") \
+    X(0xdf, inst_cb_set,  8,  "----", "SET 3, A") \
+    X(0xe0, inst_cb_set,  8,  "----", "SET 4, B") \
+    X(0xe1, inst_cb_set,  8,  "----", "SET 4, C") \
+    X(0xe2, inst_cb_set,  8,  "----", "SET 4, D") \
+    X(0xe3, inst_cb_set,  8,  "----", "SET 4, E") \
+    X(0xe4, inst_cb_set,  8,  "----", "SET 4, H") \
+    X(0xe5, inst_cb_set,  8,  "----", "SET 4, L") \
+    X(0xe6, inst_cb_set,  16, "----", "SET 4, (HL)") \
+    X(0xe7, inst_cb_set,  8,  "----", "SET 4, A") \
+    X(0xe8, inst_cb_set,  8,  "----", "SET 5, B") \
+    X(0xe9, inst_cb_set,  8,  "----", "SET 5, C") \
+    X(0xea, inst_cb_set,  8,  "----", "SET 5, D") \
+    X(0xeb, inst_cb_set,  8,  "----", "SET 5, E") \
+    X(0xec, inst_cb_set,  8,  "----", "SET 5, H") \
+    X(0xed, inst_cb_set,  8,  "----", "SET 5, L") \
+    X(0xee, inst_cb_set,  16, "----", "SET 5, (HL)") \
+    X(0xef, inst_cb_set,  8,  "----", "SET 5, A") \
+    X(0xf0, inst_cb_set,  8,  "----", "SET 6, B") \
+    X(0xf1, inst_cb_set,  8,  "----", "SET 6, C") \
+    X(0xf2, inst_cb_set,  8,  "----", "SET 6, D") \
+    X(0xf3, inst_cb_set,  8,  "----", "SET 6, E") \
+    X(0xf4, inst_cb_set,  8,  "----", "SET 6, H") \
+    X(0xf5, inst_cb_set,  8,  "----", "SET 6, L") \
+    X(0xf6, inst_cb_set,  16, "----", "SET 6, (HL)") \
+    X(0xf7, inst_cb_set,  8,  "----", "SET 6, A") \
+    X(0xf8, inst_cb_set,  8,  "----", "SET 7, B") \
+    X(0xf9, inst_cb_set,  8,  "----", "SET 7, C") \
+    X(0xfa, inst_cb_set,  8,  "----", "SET 7, D") \
+    X(0xfb, inst_cb_set,  8,  "----", "SET 7, E") \
+    X(0xfc, inst_cb_set,  8,  "----", "SET 7, H") \
+    X(0xfd, inst_cb_set,  8,  "----", "SET 7, L") \
+    X(0xfe, inst_cb_set,  16, "----", "SET 7, (HL)") \
+    X(0xff, inst_cb_set,  8,  "----", "SET 7, A")
+
+/*
+    Fused pairs
+    Recurring sequences the CPU runs from a single decoded entry, which
+    counts once against the length of a block. The recompiler counts them
+    the same way to cut its blocks where the CPU does.
+    X(first opcode, first handler, second opcode, second handler, mnemonic)
+    Build with -DCPU_NO_FUSION to run every instruction on its own
+*/
+#define CPU_FUSED_PAIRS(X) \
+    X(0xf0, inst_ldh_a_ind_nn, 0xfe, inst_cp_nn,        "LD A, (FF00+nn) / CP nn") \
+    X(0xf0, inst_ldh_a_ind_nn, 0xe6, inst_and_nn,       "LD A, (FF00+nn) / AND nn") \
+    X(0x05, inst_dec_b,        0x20, inst_jr_nz,        "DEC B / JR NZ, nn") \
+    X(0x0d, inst_dec_c,        0x20, inst_jr_nz,        "DEC C / JR NZ, nn") \
+    X(0x15, inst_dec_d,        0x20, inst_jr_nz,        "DEC D / JR NZ, nn") \
+    X(0x1a, inst_ld_a_ind_de,  0x22, inst_ldi_ind_hl_a, "LD A, (DE) / LDI (HL), A") \
+    X(0x2a, inst_ldi_a_ind_hl, 0x12, inst_ld_ind_de_a,  "LDI A, (HL) / LD (DE), A")
+
+// Control flow and interrupt state changes, the CPU also ends a block on an
+// unimplemented instruction
+static inline bool opcode_ends_block(uint8_t opcode)
+{
+    switch (opcode)
+    {
+    case 0x10: // STOP
+    case 0x18: // JR
+    case 0x20:
+    case 0x28:
+    case 0x30:
+    case 0x38:
+    case 0x76: // HALT
+    case 0xc0: // RET, JP, CALL, RST
+    case 0xc2:
+    case 0xc3:
+    case 0xc4:
+    case 0xc7:
+    case 0xc8:
+    case 0xc9:
+    case 0xca:
+    case 0xcc:
+    case 0xcd:
+    case 0xcf:
+    case 0xd0:
+    case 0xd2:
+    case 0xd4:
+    case 0xd7:
+    case 0xd8:
+    case 0xd9: // RETI
+    case 0xda:
+    case 0xdc:
+    case 0xdf:
+    case 0xe7:
+    case 0xe9: // JP HL
+    case 0xef:
+    case 0xf3: // DI
+    case 0xf7:
+    case 0xfb: // EI
+    case 0xff:
+        return true;
+    }
+
+    return false;
+}
\ No newline at end of file
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+    DMG palettes resolved to output colors
+    A palette register gives the shade (white to black) of each of the 4
+    color indices. Every palette is kept as a table of 4 colors in each
+    output format, rebuilt when its register is written, so drawing a pixel
+    is a single load.
+*/
+typedef enum
+{
+    PALETTE_FORMAT_ABGR1555 = 0,
+    PALETTE_FORMAT_RGB565,
+    PALETTE_FORMAT_XRGB8888,
+    PALETTE_FORMAT_COUNT,
+} palette_format_t;
+
+typedef enum
+{
+    PALETTE_BGP = 0,
+    PALETTE_OBP0,
+    PALETTE_OBP1,
+    PALETTE_COUNT,
+} palette_id_t;
+
+typedef struct
+{
+    uint16_t abgr1555[PALETTE_COUNT][4];
+    uint16_t rgb565[PALETTE_COUNT][4];
+    uint32_t xrgb8888[PALETTE_COUNT][4];
+} palette_tables_t;
+
+extern palette_tables_t palette_tables;
+
+// Opaque color from 8 bits channels, the low bits are dropped
+uint32_t palette_encode(palette_format_t format, uint8_t red, uint8_t green, uint8_t blue);
+
+// Rebuild the tables of a palette from the value of its register
+void palette_update(palette_id_t id, uint8_t reg);
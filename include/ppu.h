@@ -2,13 +2,56 @@
 
 #include <stdint.h>
 
+#include <palette.h>
+
 #define SCREEN_WIDTH 160
 #define SCREEN_HEIGHT 144
 #define FRAMERATE 60.0
 #define CLOCK_CYCLES_PER_SCANLINE 15
 
+// Format of the LCD pixels, ABGR1555 unless built with -DPPU_RGB565 or -DPPU_XRGB8888
+#if defined(PPU_XRGB8888)
+#define PPU_PIXEL_FORMAT PALETTE_FORMAT_XRGB8888
+#define PPU_PALETTE(id) palette_tables.xrgb8888[id]
+typedef uint32_t ppu_pixel_t;
+#elif defined(PPU_RGB565)
+#define PPU_PIXEL_FORMAT PALETTE_FORMAT_RGB565
+#define PPU_PALETTE(id) palette_tables.rgb565[id]
+typedef uint16_t ppu_pixel_t;
+#else
+#define PPU_PIXEL_FORMAT PALETTE_FORMAT_ABGR1555
+#define PPU_PALETTE(id) palette_tables.abgr1555[id]
+typedef uint16_t ppu_pixel_t;
+#endif
+
 void ppu_init(void);
 
 void ppu_destroy(void);
 
-void ppu_execute(uint64_t clock_cycles);
\ No newline at end of file
+// Catch up with the global clock
+void ppu_sync(void);
+
+// Return the clock of the next mode or LY change, STAT and LY hold still until then
+uint64_t ppu_next_transition(void);
+
+// Colors of the LCD, SCREEN_WIDTH x SCREEN_HEIGHT pixels in PPU_PIXEL_FORMAT
+// Complete when the frame count changes, until the next line is drawn
+const ppu_pixel_t *ppu_get_framebuffer(void);
+
+// Frames drawn since power on, counted at the start of the VBlank
+uint64_t ppu_get_nb_frames(void);
+
+void ppu_write_reg(uint16_t reg_addr, uint8_t val);
+
+// Write to the VRAM once the lines drawn so far are done, a write to the
+// tile data (0x8000-0x97FF) drops the decoded row
+void ppu_write_vram(uint16_t addr, uint8_t val);
+
+// Drop every decoded tile after a bulk write to the VRAM
+void ppu_invalidate_tiles(void);
+
+// Write to the OAM, a new Y moves the sprite to the lines it now covers
+void ppu_write_oam(uint16_t addr, uint8_t val);
+
+// Index the sprites of the whole OAM again after a bulk write to it
+void ppu_invalidate_sprites(void);
\ No newline at end of file
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stdint.h>
+
+#define SCHEDULER_NO_EVENT UINT64_MAX
+
+typedef enum
+{
+    SCHEDULER_EVENT_PPU = 0,
+    SCHEDULER_EVENT_TIMER,
+    SCHEDULER_EVENT_SAVE,
+    SCHEDULER_EVENT_COUNT,
+} scheduler_event_t;
+
+// Called once the global clock has reached the deadline of the event
+typedef void (*scheduler_callback_t)(uint64_t deadline);
+
+extern uint64_t scheduler_clock;    // Clock cycles elapsed since power on
+extern uint64_t scheduler_deadline; // Deadline of the earliest pending event
+
+void scheduler_init(void);
+
+void scheduler_register(scheduler_event_t event, scheduler_callback_t callback);
+
+// Schedule (or reschedule) an event at an absolute clock cycle
+void scheduler_schedule(scheduler_event_t event, uint64_t deadline);
+
+void scheduler_cancel(scheduler_event_t event);
+
+// Return the deadline of the earliest pending event or SCHEDULER_NO_EVENT
+uint64_t scheduler_next_deadline(void);
+
+// Run every event whose deadline has been reached
+void scheduler_run_events(void);
\ No newline at end of file
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+    2bpp tile rows decoder
+    A row is 2 bytes, the low bit plane then the high one, and gives 8 color
+    indices (0-3) starting from the leftmost pixel (bit 7). The SIMD decoders
+    interleave the planes of 8 or 16 rows at once and leave the remaining
+    rows to the scalar one.
+*/
+typedef void (*tiles_decoder_t)(const uint8_t *rows, uint32_t nb_rows, uint8_t *indices);
+
+typedef enum
+{
+    TILES_DECODER_SCALAR = 0,
+    TILES_DECODER_SSE2,
+    TILES_DECODER_AVX2,
+    TILES_DECODER_COUNT,
+} tiles_decoder_kind_t;
+
+extern const char *const tiles_decoder_names[TILES_DECODER_COUNT];
+
+// Pick the fastest decoder the host supports
+void tiles_init(void);
+
+// Return NULL if the host can't run it
+tiles_decoder_t tiles_get_decoder(tiles_decoder_kind_t kind);
+
+// Decode with the decoder picked by tiles_init, the scalar one until then
+void tiles_decode_rows(const uint8_t *rows, uint32_t nb_rows, uint8_t *indices);
+
+// Single row, inlined where a call through the decoder would cost more than the decoding
+static inline void tiles_decode_row(const uint8_t row[2], uint8_t indices[8])
+{
+    uint8_t low = row[0];
+    uint8_t high = row[1];
+
+    for (uint8_t pixel = 0; pixel < 8; pixel++)
+    {
+        indices[pixel] = ((high >> 6) & 2) | (low >> 7);
+        low <<= 1;
+        high <<= 1;
+    }
+}
@@ -2,4 +2,9 @@
 
 #include <stdint.h>
 
-void timer_execute(uint64_t clock_cycles);
\ No newline at end of file
+void timer_init(void);
+
+// Bring DIV and TIMA up to date with the global clock
+void timer_sync(void);
+
+void timer_write_reg(uint16_t reg_addr, uint8_t val);
\ No newline at end of file
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+    Binary instruction trace
+    The file starts with a trace_header_t followed by one trace_record_t per
+    executed instruction, both in host byte order. Every field of a record is
+    a delta against the previous record (the first one against zeros and the
+    start clock): the clock is subtracted, the other fields are XORed, so a
+    field that did not change is 0 and a reader rebuilds the state by
+    accumulating the records.
+*/
+#define TRACE_MAGIC "GBTRACE"
+#define TRACE_VERSION 1
+
+typedef struct
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint64_t start_clock; // scheduler_clock when the recording started
+} trace_header_t;
+
+typedef struct
+{
+    uint32_t cycles; // Elapsed since the previous instruction started
+    uint16_t pc;
+    uint16_t bank; // ROM bank mapped at PC
+    uint16_t af;
+    uint16_t bc;
+    uint16_t de;
+    uint16_t hl;
+    uint16_t sp;
+    uint8_t opcode;
+    uint8_t reserved;
+} trace_record_t;
+
+// Create the file and start the writer thread
+// Return False if the file can't be created
+bool trace_start(const char *filename);
+
+// Write the remaining records and close the file, no-op if not recording
+void trace_stop(void);
+
+// State before the execution of the instruction at pc, at scheduler_clock
+void trace_record(uint16_t pc, uint8_t opcode, uint16_t af, uint16_t bc, uint16_t de, uint16_t hl, uint16_t sp);
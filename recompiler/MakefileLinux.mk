@@ -0,0 +1,31 @@
+# Variables
+EXE=recompiler
+
+# Usual compilation flags
+CFLAGS=-std=c11 -Wall -Wextra -O2
+CPPFLAGS=-I../include
+# CPPFLAGS=-I../include -DCPU_NO_FUSION, to translate for a CPU built without the fused pairs
+
+HEADERS=../include/opcodes.h ../include/memory.h ../include/cartridge.h ../include/common.h
+
+# Special rules and targets
+.PHONY: all translate clean help
+
+# Rules and targets
+all: $(EXE)
+
+$(EXE): recompiler.c $(HEADERS)
+	$(CC) $(CFLAGS) $(CPPFLAGS) -o $@ $<
+
+translate: $(EXE)
+	./$(EXE) $(ROM) $(OUTPUT) $(ENTRIES)
+
+clean:
+	@rm -f *~ *.o $(EXE)
+
+help:
+	@echo "Usage:"
+	@echo "  make [all]\t\t\t\t\tBuild the recompiler"
+	@echo "  make translate ROM=<ROM> OUTPUT=<FILE.c>\tTranslate a ROM to C, ENTRIES=<BANK:ADDRESS ...> adds entry points"
+	@echo "  make clean\t\t\t\t\tRemove all files generated by make"
+	@echo "  make help\t\t\t\t\tDisplay this help"
\ No newline at end of file
@@ -0,0 +1,428 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include <opcodes.h>
+#include <memory.h>
+#include <cartridge.h>
+#include <common.h>
+
+/*
+    Static recompiler
+    Walks the code of a ROM by recursive descent from the entry point, the
+    RST and the interrupt vectors, then writes a C translation unit with one
+    function per basic block (see aot.h). The blocks are cut exactly like
+    the block cache of the CPU cuts them, any other block runs through the
+    interpreter.
+*/
+
+#define ENTRY_POINT 0x100
+#define BLOCK_MAX_ENTRIES 16 // Same limit as the block cache of the CPU, a fused pair is one entry
+#define MAX_ROM_SIZE (MEMORY_ROM_BANK_SIZE << 9)
+
+#define OPCODE_LENGTH(opcode, handler, operand, ...) [opcode] = OPERAND_LENGTH(operand),
+#define OPCODE_CYCLES(opcode, handler, operand, cycles, ...) [opcode] = cycles,
+#define OPCODE_HANDLER_NAME(opcode, handler, ...) [opcode] = #handler,
+#define OPCODE_MNEMONIC(opcode, handler, operand, cycles, taken_cycles, flags, mnemonic) [opcode] = mnemonic,
+#define FUSED_PAIR(first, first_handler, second, second_handler, mnemonic) {first, second},
+
+static const uint8_t opcode_lengths[256] = {CPU_OPCODES(OPCODE_LENGTH)};
+static const uint8_t opcode_cycles[256] = {CPU_OPCODES(OPCODE_CYCLES)};
+static const char *const opcode_handler_names[256] = {CPU_OPCODES(OPCODE_HANDLER_NAME)};
+static const char *const opcode_mnemonics[256] = {CPU_OPCODES(OPCODE_MNEMONIC)};
+#ifndef CPU_NO_FUSION
+static const uint8_t fused_pairs[][2] = {CPU_FUSED_PAIRS(FUSED_PAIR)};
+#endif
+
+static const uint16_t vectors[] = {
+    MEMORY_RST_00, MEMORY_RST_08, MEMORY_RST_10, MEMORY_RST_18,
+    MEMORY_RST_20, MEMORY_RST_28, MEMORY_RST_30, MEMORY_RST_38,
+    0x40, 0x48, 0x50, 0x58, 0x60, // VBlank, LCD STAT, Timer, Serial, Joypad
+};
+
+static const char *const reg_8_names[8] = {"b", "c", "d", "e", "h", "l", NULL, "a"};
+static const char *const reg_16_names[4] = {"bc", "de", "hl", "sp"};
+
+static uint8_t *rom = NULL;
+static uint32_t rom_size = 0;
+
+static bool *block_starts = NULL; // One flag per ROM offset
+static uint32_t *pending = NULL;  // Block starts left to walk
+static uint32_t nb_pending = 0;
+
+static uint32_t get_rom_offset(uint32_t bank, uint16_t addr)
+{
+    if (addr < MEMORY_ROM_BANK_N_START_ADDR)
+        return addr;
+    return bank * MEMORY_ROM_BANK_SIZE + (addr - MEMORY_ROM_BANK_N_START_ADDR);
+}
+
+static uint16_t get_addr(uint32_t rom_offset)
+{
+    if (rom_offset < MEMORY_ROM_BANK_SIZE)
+        return rom_offset;
+    return MEMORY_ROM_BANK_N_START_ADDR + rom_offset % MEMORY_ROM_BANK_SIZE;
+}
+
+// Bank mapped at 0x4000 when the code at this offset runs, bank 0 code is
+// assumed to call into the bank selected at boot
+static uint32_t get_bank(uint32_t rom_offset)
+{
+    uint32_t bank = rom_offset / MEMORY_ROM_BANK_SIZE;
+    return bank == 0 ? 1 : bank;
+}
+
+static void add_block_start(uint32_t bank, uint16_t addr)
+{
+    // RAM and I/O are left to the interpreter
+    if (addr >= MEMORY_VRAM_START_ADDR)
+        return;
+
+    uint32_t rom_offset = get_rom_offset(bank, addr);
+    if (rom_offset >= rom_size || block_starts[rom_offset])
+        return;
+
+    block_starts[rom_offset] = true;
+    pending[nb_pending++] = rom_offset;
+}
+
+// Every CB prefixed instruction is implemented
+static bool is_implemented(uint8_t opcode)
+{
+    return strcmp(opcode_handler_names[opcode], "inst_unimplemented") != 0;
+}
+
+static uint16_t get_operand(uint32_t rom_offset, uint8_t length)
+{
+    if (length == 3)
+        return rom[rom_offset + 1] | rom[rom_offset + 2] << 8;
+    if (length == 2)
+        return rom[rom_offset + 1];
+    return 0;
+}
+
+// Return False if the execution can't fall through the instruction
+static bool follow_branches(uint32_t bank, uint16_t addr, uint8_t opcode, uint16_t operand)
+{
+    uint16_t next_addr = addr + opcode_lengths[opcode];
+
+    switch (opcode)
+    {
+    case 0x18: // JR
+        add_block_start(bank, next_addr + (int8_t)operand);
+        return false;
+
+    case 0x20: // JR cc
+    case 0x28:
+    case 0x30:
+    case 0x38:
+        add_block_start(bank, next_addr + (int8_t)operand);
+        return true;
+
+    case 0xc3: // JP
+        add_block_start(bank, operand);
+        return false;
+
+    case 0xc2: // JP cc, CALL, CALL cc
+    case 0xca:
+    case 0xd2:
+    case 0xda:
+    case 0xc4:
+    case 0xcc:
+    case 0xcd:
+    case 0xd4:
+    case 0xdc:
+        add_block_start(bank, operand);
+        return true;
+
+    case 0xc9: // RET, RETI, JP HL
+    case 0xd9:
+    case 0xe9:
+        return false;
+    }
+
+    // RST, its vector is walked from the start
+    return true;
+}
+
+static void walk_block(uint32_t rom_offset)
+{
+    uint32_t bank = get_bank(rom_offset);
+    uint16_t addr = get_addr(rom_offset);
+
+    while (true)
+    {
+        uint8_t opcode = rom[rom_offset];
+        uint8_t length = opcode_lengths[opcode];
+
+        // Stay in the bank, the next one is not mapped after it
+        if (rom_offset + length > rom_size || addr + length > (addr < MEMORY_ROM_BANK_N_START_ADDR ? MEMORY_ROM_BANK_N_START_ADDR : MEMORY_VRAM_START_ADDR))
+            return;
+
+        uint16_t operand = get_operand(rom_offset, length);
+        if (!is_implemented(opcode))
+            return;
+
+        if (opcode_ends_block(opcode))
+        {
+            if (follow_branches(bank, addr, opcode, operand))
+                add_block_start(bank, addr + length);
+            return;
+        }
+
+        rom_offset += length;
+        addr += length;
+    }
+}
+
+// Return False if the instruction has to go through its handler
+static bool write_inline_inst(FILE *output, uint8_t opcode, uint16_t operand)
+{
+    uint8_t dst = (opcode >> 3) & 0x07;
+    uint8_t src = opcode & 0x07;
+
+    // The handler stops the CPU on the instructions it doesn't implement yet
+    if (!is_implemented(opcode))
+        return false;
+
+    if (opcode == 0x00) // NOP
+    {
+        fprintf(output, "    // NOP\n");
+    }
+    else if (opcode < 0x40 && src == 0x06 && dst != 0x06) // LD r, nn
+    {
+        fprintf(output, "    regs->%s = 0x%02x; // %s\n", reg_8_names[dst], operand, opcode_mnemonics[opcode]);
+    }
+    else if ((opcode & 0xcf) == 0x01) // LD rr, nnnn
+    {
+        fprintf(output, "    regs->%s = 0x%04x; // %s\n", reg_16_names[opcode >> 4], operand, opcode_mnemonics[opcode]);
+    }
+    else if ((opcode & 0xc7) == 0x03) // INC rr, DEC rr
+    {
+        fprintf(output, "    regs->%s%s; // %s\n", reg_16_names[opcode >> 4], opcode & 0x08 ? "--" : "++", opcode_mnemonics[opcode]);
+    }
+    else if (opcode >= 0x40 && opcode < 0x80 && src != 0x06 && dst != 0x06) // LD r, r
+    {
+        fprintf(output, "    regs->%s = regs->%s; // %s\n", reg_8_names[dst], reg_8_names[src], opcode_mnemonics[opcode]);
+    }
+    else if (opcode == 0xc3) // JP nnnn
+    {
+        fprintf(output, "    regs->pc = 0x%04x; // %s\n", operand, opcode_mnemonics[opcode]);
+    }
+    else
+    {
+        return false;
+    }
+
+    return true;
+}
+
+// Same translation as the JIT: simple register operations are written in C,
+// every other instruction calls its handler with PC already past it
+static void write_inst(FILE *output, uint8_t opcode, uint16_t operand, uint16_t next_addr, uint32_t *pending_cycles, bool *pc_stored)
+{
+    if (write_inline_inst(output, opcode, operand))
+    {
+        *pending_cycles += opcode_cycles[opcode];
+        *pc_stored = opcode == 0xc3;
+        return;
+    }
+
+    // The handler may read the clock, hand it the cycles spent so far
+    if (*pending_cycles)
+        fprintf(output, "    scheduler_clock += %u;\n", *pending_cycles);
+    *pending_cycles = 0;
+
+    fprintf(output, "    regs->pc = 0x%04x;\n", next_addr);
+    fprintf(output, "    cycles = cpu_execute_opcode(regs, 0x%02x, 0x%04x); // %s\n", opcode, operand, opcode_mnemonics[opcode]);
+    fprintf(output, "    scheduler_clock += cycles;\n");
+    *pending_cycles = opcode_cycles[opcode];
+    *pc_stored = true;
+}
+
+// True if the CPU merges the instruction into the entry of the previous one
+static bool is_fused(uint8_t previous_opcode, uint8_t opcode)
+{
+#ifdef CPU_NO_FUSION
+    (void)previous_opcode;
+    (void)opcode;
+    return false;
+#else
+    for (uint8_t i = 0; i < sizeof(fused_pairs) / sizeof(fused_pairs[0]); i++)
+    {
+        if (fused_pairs[i][0] == previous_opcode && fused_pairs[i][1] == opcode)
+            return true;
+    }
+    return false;
+#endif
+}
+
+// Cut the block like decode_block does: at most BLOCK_MAX_ENTRIES entries,
+// the second instruction of a pair joins the entry of the first one
+// Return the address following the last instruction, 0 if the first one crosses the page
+static uint16_t write_block(FILE *output, uint32_t rom_offset)
+{
+    uint16_t addr = get_addr(rom_offset);
+    uint32_t page_end = (addr / MEMORY_PAGE_SIZE + 1) * MEMORY_PAGE_SIZE;
+    uint32_t pending_cycles = 0;
+    bool pc_stored = true;
+    bool ended = false; // On a control flow instruction, not on a cut
+    uint8_t nb_inst = 0;
+    uint8_t nb_entries = 0;
+    uint8_t previous_opcode = 0;
+    bool last_is_pair = false; // The last entry can't take a third instruction
+
+    while (nb_entries < BLOCK_MAX_ENTRIES)
+    {
+        uint8_t opcode = rom[rom_offset];
+        uint8_t length = opcode_lengths[opcode];
+        if (rom_offset + length > rom_size || addr + length > page_end)
+            break;
+
+        if (nb_inst == 0)
+            fprintf(output, "\n// 0x%04x (bank %u)\nstatic void block_%06x(cpu_registers_t *regs)\n{\n    UNUSED uint8_t cycles;\n\n",
+                    addr, rom_offset / MEMORY_ROM_BANK_SIZE, rom_offset);
+
+        uint16_t operand = get_operand(rom_offset, length);
+        write_inst(output, opcode, operand, addr + length, &pending_cycles, &pc_stored);
+        last_is_pair = nb_inst && !last_is_pair && is_fused(previous_opcode, opcode);
+        if (!last_is_pair)
+            nb_entries++;
+        previous_opcode = opcode;
+        nb_inst++;
+        rom_offset += length;
+        addr += length;
+
+        ended = opcode_ends_block(opcode) || !is_implemented(opcode);
+        if (ended)
+            break;
+    }
+
+    if (nb_inst == 0)
+        return 0;
+
+    // The CPU decodes the rest as the next block
+    if (!ended)
+        add_block_start(get_bank(rom_offset), addr);
+
+    if (pending_cycles)
+        fprintf(output, "    scheduler_clock += %u;\n", pending_cycles);
+    if (!pc_stored)
+        fprintf(output, "    regs->pc = 0x%04x;\n", addr);
+    fprintf(output, "}\n");
+
+    return addr;
+}
+
+static bool load_rom(const char *filepath)
+{
+    FILE *file = fopen(filepath, "rb");
+    if (file == NULL)
+    {
+        fprintf(stderr, P_ERROR "Can't open file %s\n", filepath);
+        return false;
+    }
+
+    rom = malloc(MAX_ROM_SIZE);
+    if (rom == NULL)
+    {
+        fclose(file);
+        return false;
+    }
+    rom_size = fread(rom, 1, MAX_ROM_SIZE, file);
+    fclose(file);
+
+    if (rom_size < CARTRIDGE_HEADER_END)
+    {
+        fprintf(stderr, P_ERROR "%s is too small to be a ROM\n", filepath);
+        return false;
+    }
+
+    block_starts = calloc(rom_size, sizeof(bool));
+    pending = malloc(rom_size * sizeof(uint32_t));
+    return block_starts != NULL && pending != NULL;
+}
+
+static void print_usage(const char *filename)
+{
+    fprintf(stderr, "Usage: %s <ROM> <OUTPUT.c> [BANK:ADDRESS ...]\n", filename);
+}
+
+int main(int argc, char const *argv[])
+{
+    if (argc < 3)
+    {
+        print_usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    if (!load_rom(argv[1]))
+        exit(EXIT_FAILURE);
+
+    // Code only reached through JP HL or a bank switch can be given by hand
+    add_block_start(1, ENTRY_POINT);
+    for (uint8_t i = 0; i < sizeof(vectors) / sizeof(vectors[0]); i++)
+        add_block_start(1, vectors[i]);
+    for (int i = 3; i < argc; i++)
+    {
+        unsigned int bank;
+        unsigned int addr;
+        if (sscanf(argv[i], "%x:%x", &bank, &addr) != 2)
+        {
+            print_usage(argv[0]);
+            exit(EXIT_FAILURE);
+        }
+        add_block_start(bank, addr);
+    }
+
+    while (nb_pending > 0)
+        walk_block(pending[--nb_pending]);
+
+    FILE *output = fopen(argv[2], "w");
+    if (output == NULL)
+    {
+        fprintf(stderr, P_ERROR "Can't open file %s\n", argv[2]);
+        exit(EXIT_FAILURE);
+    }
+
+    fprintf(output, "// Generated by the recompiler from %s, do not edit\n\n", argv[1]);
+    fprintf(output, "#include <aot.h>\n#include <scheduler.h>\n\n#define UNUSED __attribute__((unused))\n");
+
+    // Blocks cut by the page or the size limit add the next one further in
+    // the ROM, a single pass reaches them
+    uint16_t *end_pcs = calloc(rom_size, sizeof(uint16_t));
+    uint32_t nb_blocks = 0;
+    for (uint32_t rom_offset = 0; rom_offset < rom_size; rom_offset++)
+    {
+        if (block_starts[rom_offset] && (end_pcs[rom_offset] = write_block(output, rom_offset)) != 0)
+            nb_blocks++;
+    }
+
+    if (nb_blocks == 0)
+    {
+        fprintf(stderr, P_ERROR "No code found in %s\n", argv[1]);
+        fclose(output);
+        exit(EXIT_FAILURE);
+    }
+
+    fprintf(output, "\nconst uint16_t aot_rom_checksum = 0x%02x%02x;\n", rom[CARTRIDGE_HEADER_GLOBAL_CHECKSUM], rom[CARTRIDGE_HEADER_GLOBAL_CHECKSUM + 1]);
+    fprintf(output, "const uint32_t aot_nb_entries = %u;\n", nb_blocks);
+    fprintf(output, "const aot_entry_t aot_entries[] = {\n");
+    for (uint32_t rom_offset = 0; rom_offset < rom_size; rom_offset++)
+    {
+        if (end_pcs[rom_offset])
+            fprintf(output, "    {0x%06x, 0x%04x, block_%06x},\n", rom_offset, end_pcs[rom_offset], rom_offset);
+    }
+    fprintf(output, "};\n");
+    fclose(output);
+
+    fprintf(stdout, "%u blocks translated to %s\n", nb_blocks, argv[2]);
+
+    free(end_pcs);
+    free(pending);
+    free(block_starts);
+    free(rom);
+    return EXIT_SUCCESS;
+}
\ No newline at end of file
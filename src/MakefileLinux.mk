@@ -3,9 +3,16 @@ EXE=GB-emulator
 
 # Usual compilation flags
 CFLAGS=-std=c11 -Wall -Wextra -g -O2 -pg
-CPPFLAGS=-I../include -DDEBUG
-# CPPFLAGS=-I../include
-LDFLAGS=-lm -lSDL2
+CPPFLAGS=-I../include
+# CPPFLAGS=-I../include -DDEBUG
+# CPPFLAGS=-I../include -DCPU_DISPATCH_THREADED
+# CPPFLAGS=-I../include -DCPU_NO_FUSION
+# CPPFLAGS=-I../include -DCPU_JIT
+# CPPFLAGS=-I../include -DCPU_AOT, with AOT=<C file generated by the recompiler>
+# CPPFLAGS=-I../include -DPPU_RGB565
+# CPPFLAGS=-I../include -DPPU_XRGB8888
+AOT=
+LDFLAGS=-lm -lSDL2 -lpthread
 
 # Special rules and targets
 .PHONY: all clean help
@@ -13,27 +20,51 @@ LDFLAGS=-lm -lSDL2
 # Rules and targets
 all: $(EXE)
 
-$(EXE): main.o memory.o cpu.o ppu.o cartridge.o timer.o
+$(EXE): main.o memory.o cpu.o ppu.o cartridge.o timer.o scheduler.o mbc.o interrupt.o jit.o trace.o tiles.o palette.o $(AOT:.c=.o)
 	$(CC) $(CFLAGS) -o $@ $^ $(LDFLAGS)
 
-main.o : main.c ../include/memory.h ../include/common.h
+main.o : main.c ../include/memory.h ../include/common.h ../include/cpu.h ../include/ppu.h ../include/palette.h ../include/scheduler.h ../include/interrupt.h ../include/trace.h
 	$(CC) $(CFLAGS) $(CPPFLAGS) -c $<
 
-memory.o : memory.c ../include/memory.h
+memory.o : memory.c ../include/memory.h ../include/ppu.h ../include/palette.h ../include/timer.h ../include/mbc.h ../include/interrupt.h ../include/cpu.h
 	$(CC) $(CFLAGS) $(CPPFLAGS) -c $<
 
-cpu.o : cpu.c ../include/cpu.h ../include/memory.h ../include/common.h
+cpu.o : cpu.c cpu_core.h ../include/cpu.h ../include/memory.h ../include/common.h ../include/scheduler.h ../include/interrupt.h ../include/ppu.h ../include/palette.h ../include/opcodes.h ../include/jit.h ../include/aot.h ../include/cartridge.h ../include/trace.h
 	$(CC) $(CFLAGS) $(CPPFLAGS) -c $<
 
-ppu.o : ppu.c ../include/ppu.h ../include/memory.h ../include/common.h ../include/cpu.h
+ppu.o : ppu.c ../include/ppu.h ../include/palette.h ../include/tiles.h ../include/memory.h ../include/common.h ../include/cpu.h ../include/scheduler.h ../include/interrupt.h
 	$(CC) $(CFLAGS) $(CPPFLAGS) -c $<
 
-cartridge.o : cartridge.c ../include/cartridge.h ../include/memory.h ../include/common.h
+cartridge.o : cartridge.c ../include/cartridge.h ../include/memory.h ../include/common.h ../include/mbc.h ../include/scheduler.h
 	$(CC) $(CFLAGS) $(CPPFLAGS) -c $<
 
-timer.o : timer.c ../include/timer.h ../include/memory.h ../include/common.h ../include/cpu.h
+timer.o : timer.c ../include/timer.h ../include/memory.h ../include/common.h ../include/cpu.h ../include/scheduler.h ../include/interrupt.h
 	$(CC) $(CFLAGS) $(CPPFLAGS) -c $<
 
+scheduler.o : scheduler.c ../include/scheduler.h ../include/common.h
+	$(CC) $(CFLAGS) $(CPPFLAGS) -c $<
+
+mbc.o : mbc.c ../include/mbc.h ../include/cartridge.h ../include/memory.h ../include/common.h
+	$(CC) $(CFLAGS) $(CPPFLAGS) -c $<
+
+interrupt.o : interrupt.c ../include/interrupt.h ../include/memory.h ../include/common.h ../include/cpu.h
+	$(CC) $(CFLAGS) $(CPPFLAGS) -c $<
+
+trace.o : trace.c ../include/trace.h ../include/common.h ../include/mbc.h ../include/scheduler.h
+	$(CC) $(CFLAGS) $(CPPFLAGS) -c $<
+
+tiles.o : tiles.c ../include/tiles.h
+	$(CC) $(CFLAGS) $(CPPFLAGS) -c $<
+
+palette.o : palette.c ../include/palette.h
+	$(CC) $(CFLAGS) $(CPPFLAGS) -c $<
+
+jit.o : jit.c ../include/jit.h ../include/common.h ../include/scheduler.h
+	$(CC) $(CFLAGS) $(CPPFLAGS) -c $<
+
+$(AOT:.c=.o) : $(AOT) ../include/aot.h ../include/cpu.h ../include/scheduler.h
+	$(CC) $(CFLAGS) $(CPPFLAGS) -c $< -o $@
+
 clean:
 	@rm -f *~ *.o $(EXE)
 
@@ -1,20 +1,44 @@
+#define _GNU_SOURCE // sync_file_range
+
 #include <cartridge.h>
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include <common.h>
 #include <memory.h>
+#include <mbc.h>
+#include <scheduler.h>
+
+#define SAVE_EXTENSION ".sav"
+#define SAVE_FLUSH_PERIOD 70224 // One frame
 
 static cartridge_t cartridge;
 
+// Whole ROM and external RAM images, the MBC maps their banks in memory
+static uint8_t *rom_data = NULL;
+static uint8_t *ram_data = NULL;
+static uint64_t rom_data_size = 0;
+static bool rom_mapped = false; // mmap'ed file or heap copy
+static uint64_t ram_data_size = 0;
+static bool ram_mapped = false; // mmap'ed save file or heap buffer
+static int save_fd = -1;        // Kept open to start the writeback of the save
+
+static void save_event(uint64_t deadline);
+
 static void parse_header(void)
 {
     // Title
-    memory_read((uint8_t *)&cartridge.title, CARTRIDGE_HEADER_TITLE, CARTRIDGE_HEADER_TITLE_SIZE);
+    memcpy(cartridge.title, rom_data + CARTRIDGE_HEADER_TITLE, CARTRIDGE_HEADER_TITLE_SIZE);
 
     // CGB Flag
-    uint8_t cgb_flag = memory_read_8(CARTRIDGE_HEADER_CGB_FLAG);
+    uint8_t cgb_flag = rom_data[CARTRIDGE_HEADER_CGB_FLAG];
     if (cgb_flag & CARTRIDGE_HEADER_CGB_SUPPORT)
         cartridge.mode = CGB_SUPPORT;
     else if (cgb_flag & CARTRIDGE_HEADER_CGB_ONLY)
@@ -23,13 +47,19 @@ static void parse_header(void)
         cartridge.mode = UNKNOWN_MODE;
 
     // Type
-    cartridge.type = memory_read_8(CARTRIDGE_HEADER_TYPE);
+    cartridge.type = rom_data[CARTRIDGE_HEADER_TYPE];
 
     // ROM Size
-    cartridge.rom_size = ((2 * MEMORY_ROM_BANK_SIZE) << memory_read_8(CARTRIDGE_HEADER_ROM_SIZE)) / MEMORY_ROM_BANK_SIZE;
+    uint8_t rom_size_code = rom_data[CARTRIDGE_HEADER_ROM_SIZE];
+    if (rom_size_code > CARTRIDGE_HEADER_ROM_SIZE_MAX)
+    {
+        fprintf(stderr, P_ERROR "Unknown ROM size code 0x%02x\n", rom_size_code);
+        exit(EXIT_FAILURE);
+    }
+    cartridge.rom_size = ((2 * MEMORY_ROM_BANK_SIZE) << rom_size_code) / MEMORY_ROM_BANK_SIZE;
 
     // RAM Size
-    switch (memory_read_8(CARTRIDGE_HEADER_RAM_SIZE))
+    switch (rom_data[CARTRIDGE_HEADER_RAM_SIZE])
     {
     case 0x0:
         cartridge.ram_size = 0;
@@ -48,39 +78,270 @@ static void parse_header(void)
         cartridge.ram_size = 8;
         break;
     }
+}
+
+// Map the file read only: no copy and the pages are shared between every
+// process running the same ROM
+static bool map_rom(int fd, uint64_t filesize)
+{
+    void *data = mmap(NULL, filesize, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED)
+        return false;
+
+    rom_data = data;
+    rom_data_size = filesize;
+    rom_mapped = true;
+    return true;
+}
+
+// Fallback for pipes, devices and files that can't be mapped
+static void read_rom(int fd)
+{
+    uint64_t capacity = 2 * MEMORY_ROM_BANK_SIZE;
+    rom_data = malloc(capacity);
+    rom_data_size = 0;
+
+    while (rom_data != NULL)
+    {
+        ssize_t nb_read = read(fd, rom_data + rom_data_size, capacity - rom_data_size);
+        if (nb_read < 0)
+        {
+            fprintf(stderr, P_ERROR "Can't read ROM data\n");
+            exit(EXIT_FAILURE);
+        }
+        if (nb_read == 0)
+            break;
+
+        rom_data_size += nb_read;
+        if (rom_data_size == capacity)
+        {
+            capacity *= 2;
+            rom_data = realloc(rom_data, capacity);
+        }
+    }
+
+    if (rom_data == NULL)
+    {
+        fprintf(stderr, P_ERROR "Can't allocate ROM data\n");
+        exit(EXIT_FAILURE);
+    }
+    rom_mapped = false;
+}
+
+// Make sure the image holds a whole number of banks, padding with 0xFF
+static void resize_rom(uint64_t rom_bytes)
+{
+    if (rom_data_size >= rom_bytes)
+        return;
+
+    uint8_t *data = malloc(rom_bytes);
+    if (data == NULL)
+    {
+        fprintf(stderr, P_ERROR "Can't allocate ROM data\n");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(data, rom_data, rom_data_size);
+    memset(data + rom_data_size, 0xff, rom_bytes - rom_data_size);
+
+    if (rom_mapped)
+        munmap(rom_data, rom_data_size);
+    else
+        free(rom_data);
+
+    rom_data = data;
+    rom_data_size = rom_bytes;
+    rom_mapped = false;
+}
+
+static bool has_battery(uint8_t type)
+{
+    switch (type)
+    {
+    case CARTRIDGE_TYPE_MBC1_RAM_BATTERY:
+    case CARTRIDGE_TYPE_ROM_RAM_BATTERY:
+    case CARTRIDGE_TYPE_MBC3_TIMER_RAM_BATTERY:
+    case CARTRIDGE_TYPE_MBC3_RAM_BATTERY:
+    case CARTRIDGE_TYPE_MBC5_RAM_BATTERY:
+    case CARTRIDGE_TYPE_MBC5_RUMBLE_RAM_BATTERY:
+        return true;
+
+    default:
+        return false;
+    }
+}
+
+// <ROM path without extension>.sav
+static char *get_save_path(const char *rom_path)
+{
+    size_t length = strlen(rom_path);
+
+    const char *extension = strrchr(rom_path, '.');
+    const char *basename = strrchr(rom_path, '/');
+    if (extension != NULL && (basename == NULL || extension > basename))
+        length = extension - rom_path;
+
+    char *save_path = malloc(length + sizeof(SAVE_EXTENSION));
+    if (save_path == NULL)
+        return NULL;
+
+    memcpy(save_path, rom_path, length);
+    memcpy(save_path + length, SAVE_EXTENSION, sizeof(SAVE_EXTENSION));
+    return save_path;
+}
+
+// Map the save file shared: the game writes straight into the page cache and
+// only the dirty pages have to be written back
+static bool map_save(const char *rom_path)
+{
+    char *save_path = get_save_path(rom_path);
+    if (save_path == NULL)
+        return false;
+
+    int fd = open(save_path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0)
+    {
+        fprintf(stderr, P_ERROR "Can't open save file %s\n", save_path);
+        free(save_path);
+        return false;
+    }
+    free(save_path);
+
+    // A new save starts zeroed, an older one is extended if needed
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0 || ((uint64_t)file_stat.st_size < ram_data_size && ftruncate(fd, ram_data_size) != 0))
+    {
+        close(fd);
+        return false;
+    }
+
+    void *data = mmap(NULL, ram_data_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED)
+    {
+        close(fd);
+        return false;
+    }
 
-    // Update MBC handler with type
+    ram_data = data;
+    ram_mapped = true;
+    save_fd = fd;
+    return true;
+}
+
+// Start writing the range to the disk without waiting for it. On Linux,
+// msync with MS_ASYNC does not start anything on a shared mapping, the pages
+// would wait for the periodic writeback of the kernel.
+static void flush_save_range(uint8_t *data, uint32_t size)
+{
+#ifdef __linux__
+    sync_file_range(save_fd, data - ram_data, size, SYNC_FILE_RANGE_WRITE);
+#else
+    // msync works on whole host pages
+    uintptr_t page_size = sysconf(_SC_PAGESIZE);
+    uintptr_t start = (uintptr_t)data & ~(page_size - 1);
+
+    msync((void *)start, size + ((uintptr_t)data - start), MS_ASYNC);
+#endif
+}
+
+// Scheduled every frame when the RAM is backed by a save file
+static void save_event(uint64_t deadline)
+{
+    mbc_flush_ram(flush_save_range);
+    scheduler_schedule(SCHEDULER_EVENT_SAVE, deadline + SAVE_FLUSH_PERIOD);
 }
 
 void cartridge_load_rom(const char *filepath)
 {
     // Open ROM file
-    FILE *fd = fopen(filepath, "rb");
-    if (fd == NULL)
+    int fd = open(filepath, O_RDONLY);
+    if (fd < 0)
     {
         fprintf(stderr, P_ERROR "Can't open file %s\n", filepath);
         exit(EXIT_FAILURE);
     }
 
-    // Get file size
-    fseek(fd, 0, SEEK_END);
-    uint64_t filesize = ftell(fd);
-    rewind(fd);
-
     // Get ROM data
-    uint8_t *rom_data = malloc(filesize * sizeof(uint8_t));
-    if (fread(rom_data, 1, filesize, fd) <= 0)
+    struct stat file_stat;
+    bool mappable = fstat(fd, &file_stat) == 0 && S_ISREG(file_stat.st_mode) && file_stat.st_size > 0;
+    if (!mappable || !map_rom(fd, file_stat.st_size))
+        read_rom(fd);
+    close(fd);
+
+    if (rom_data_size < CARTRIDGE_HEADER_END)
     {
-        fprintf(stderr, P_ERROR "Can't read ROM data\n");
+        fprintf(stderr, P_ERROR "%s is too small to be a ROM\n", filepath);
         exit(EXIT_FAILURE);
     }
 
-    // Put ROM data in memory
-    memory_write(rom_data, MEMORY_ROM_BANK_0_START_ADDR, filesize);
-    free(rom_data);
-
     // Parse cartridge header
     parse_header();
+
+    // Trust the file over the header when it holds more banks
+    uint64_t file_banks = (rom_data_size + MEMORY_ROM_BANK_SIZE - 1) / MEMORY_ROM_BANK_SIZE;
+    if (file_banks > cartridge.rom_size)
+        cartridge.rom_size = file_banks;
+
+    // A truncated dump is copied, the mapping can't be extended
+    resize_rom((uint64_t)cartridge.rom_size * MEMORY_ROM_BANK_SIZE);
+
+    // External RAM, persisted in the save file when battery backed
+    ram_data_size = (uint64_t)cartridge.ram_size * MEMORY_EXTERNAL_RAM_BANK_SIZE;
+    bool battery = cartridge.ram_size > 0 && has_battery(cartridge.type);
+    if (battery && !map_save(filepath))
+        fprintf(stderr, P_ERROR "Can't map the save file, progress won't be saved\n");
+
+    if (cartridge.ram_size > 0 && !ram_mapped)
+    {
+        ram_data = calloc(cartridge.ram_size, MEMORY_EXTERNAL_RAM_BANK_SIZE);
+        if (ram_data == NULL)
+        {
+            fprintf(stderr, P_ERROR "Can't allocate RAM data\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // Map the banks through the memory bank controller
+    mbc_init(cartridge.type, rom_data, cartridge.rom_size, ram_data, cartridge.ram_size, ram_mapped);
+
+    if (ram_mapped)
+    {
+        scheduler_register(SCHEDULER_EVENT_SAVE, save_event);
+        scheduler_schedule(SCHEDULER_EVENT_SAVE, scheduler_clock + SAVE_FLUSH_PERIOD);
+    }
+}
+
+void cartridge_destroy(void)
+{
+    if (rom_mapped)
+        munmap(rom_data, rom_data_size);
+    else
+        free(rom_data);
+
+    if (ram_mapped)
+    {
+        // Wait for the last writes to reach the save file
+        msync(ram_data, ram_data_size, MS_SYNC);
+        munmap(ram_data, ram_data_size);
+        close(save_fd);
+        save_fd = -1;
+    }
+    else
+    {
+        free(ram_data);
+    }
+
+    rom_data = NULL;
+    ram_data = NULL;
+    rom_data_size = 0;
+    ram_data_size = 0;
+    rom_mapped = false;
+    ram_mapped = false;
+}
+
+const uint8_t *cartridge_get_rom(uint64_t *size)
+{
+    *size = rom_data_size;
+    return rom_data;
 }
 
 void cartridge_print_infos(void)
@@ -1,95 +1,285 @@
 #include <cpu.h>
 
 #include <stdint.h>
+#include <inttypes.h>
 #include <stdio.h>
 #include <stdbool.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stddef.h>
+#include <signal.h>
 
 #include <memory.h>
 #include <common.h>
+#include <scheduler.h>
+#include <interrupt.h>
+#include <ppu.h>
+#include <opcodes.h>
+#include <trace.h>
+#ifdef CPU_JIT
+#include <jit.h>
+#endif
+#ifdef CPU_AOT
+#include <aot.h>
+#include <cartridge.h>
+#endif
+
+#if defined(CPU_JIT) && defined(CPU_DISPATCH_THREADED)
+#error "The JIT runs the blocks of the table dispatch"
+#endif
+#if defined(CPU_AOT) && defined(CPU_DISPATCH_THREADED)
+#error "The translated blocks run from the table dispatch"
+#endif
 
 #define FLAG_Z 7 // Bit position in Flags register
 #define FLAG_N 6
 #define FLAG_H 5
 #define FLAG_C 4
 
+// Operation behind the lazy flags
+#define FLAGS_KIND_F 0     // N and H are in F
+#define FLAGS_KIND_ADD 1   // ADD, INC
+#define FLAGS_KIND_SUB 2   // SUB, CP, DEC
+#define FLAGS_KIND_AND 3   // AND, BIT
+#define FLAGS_KIND_LOGIC 4 // XOR, OR, SWAP
+
 #define COMMAND_MAX_SIZE 128
+#define DISASSEMBLY_MAX_SIZE 32
+#define DISASSEMBLY_DEFAULT_NB_INST 8
+
+#define JR_TAKEN_DURATION 12
+#define IDLE_LOOP_NB_INST 3
+#define IDLE_LOOP_LDH_DURATION 32 // LD A, (FF00+nn) / CP or AND nn / JR cc taken
+#define IDLE_LOOP_LD_DURATION 36  // LD A, (nnnn) / CP or AND nn / JR cc taken
+
+#define BLOCK_MAX_INST 16
+#define FUSION_NONE 0
+#define BLOCK_CACHE_SIZE 4096 // Blocks are indexed by the low bits of their address
+#define JIT_HOT_THRESHOLD 32  // Unchecked runs of a block before it is compiled
 
 #define SET_BIT(val, nb_bit) (val |= (1U << nb_bit))
 #define CLEAR_BIT(val, nb_bit) (val &= ~(1U << nb_bit))
 #define FLIP_BIT(val, nb_bit) (val ^= (1U << nb_bit))
 #define CHECK_BIT(val, nb_bit) ((val >> nb_bit) & 1U)
 
-#define HAS_HALF_CARRY_ON_SUB(op1, result) (((result) & (~(op1))) & 0xf)
-#define HAS_HALF_CARRY_ON_ADD(op1, op2) (((op1) & 0xf) & ((op2) & 0xf))
+#define HAS_HALF_CARRY_ON_SUB(op1, op2) (((op1) & 0xf) < ((op2) & 0xf))
+#define HAS_HALF_CARRY_ON_ADD(op1, op2) ((((op1) & 0xf) + ((op2) & 0xf)) > 0xf)
+#define HAS_HALF_CARRY_ON_ADD_16(op1, op2) ((((op1) & 0xfff) + ((op2) & 0xfff)) > 0xfff)
+
+#define UNUSED __attribute__((unused))
+
+#define REG_8_IND_HL 6 // Register field of the opcodes working on (HL)
+
+/*
+    Instruction handler
+    The dispatcher has already fetched the immediate operand (0, 1 or 2 bytes)
+    and moved PC past the whole instruction, it adds the duration of the
+    opcode from opcodes.h. Return the clock cycles spent on top of it (taken
+    branches, CB prefixed operations).
+*/
+typedef uint8_t (*cpu_handler_t)(cpu_registers_t *regs, uint8_t opcode, uint16_t operand);
+
+#define INST_HANDLER(name) static inline uint8_t name(UNUSED cpu_registers_t *regs, UNUSED uint8_t opcode, UNUSED uint16_t operand)
+
+// Built from opcodes.h once the handlers are defined
+static const uint8_t opcode_lengths[256];
+static const uint8_t opcode_cycles[256];
+static const uint8_t opcode_branch_cycles[256]; // Added when the branch is taken
+
+/*
+    Predecoded basic blocks
+    A block is a straight run of instructions decoded once. It ends on the
+    first instruction that can change the control flow or the interrupt
+    state and never crosses a page. Blocks are tagged with the host page
+    they were decoded from, so a bank switch makes them miss, and a write
+    to a RAM page holding blocks drops them.
+*/
+typedef struct
+{
+    cpu_handler_t handler;
+    uint16_t operand;
+    uint8_t opcode;
+    uint8_t length;
+    uint8_t cycles; // Without the branches
+    uint8_t fusion; // Pair merged into this entry, FUSION_NONE for a single instruction
+    bool writes_memory;
+} cpu_decoded_inst_t;
+
+typedef struct
+{
+    const uint8_t *host_page; // Page the block was decoded from
+    uint16_t pc;
+    uint16_t end_pc;    // Address following the last instruction
+    uint16_t cycles;    // Duration of the whole block with every branch taken
+    uint8_t nb_inst;    // 0 for a free entry
+    uint8_t nb_fused;   // Instructions merged into the entry before them
+    bool writes_memory; // Any instruction but the last one can write to the bus
+#ifdef CPU_JIT
+    uint8_t heat;
+    jit_block_t code; // Native translation, NULL until the block is hot
+#endif
+#ifdef CPU_AOT
+    aot_block_t translation; // Translated ahead of time, NULL if the recompiler didn't reach it
+#endif
+    cpu_decoded_inst_t insts[BLOCK_MAX_INST];
+} cpu_block_t;
+
+static cpu_registers_t registers;
+
+// Register fields of the opcodes, in their encoding order
+static const uint8_t reg_8_offsets[8] = {
+    offsetof(cpu_registers_t, b),
+    offsetof(cpu_registers_t, c),
+    offsetof(cpu_registers_t, d),
+    offsetof(cpu_registers_t, e),
+    offsetof(cpu_registers_t, h),
+    offsetof(cpu_registers_t, l),
+    0, // (HL)
+    offsetof(cpu_registers_t, a),
+};
+
+static uint64_t nb_exec_inst = 0;
+static uint64_t nb_dispatches = 0; // Decoded entries run, a fused pair counts once
+static uint64_t nb_skipped_cycles = 0; // Spent in skipped idle loops
+static uint64_t run_end_clock = 0;     // End of the budget of the current cpu_run
+
+static cpu_block_t block_cache[BLOCK_CACHE_SIZE];
+static cpu_block_t uncached_block; // Single instruction from a page of the slow path
+#ifdef CPU_JIT
+static bool jit_enabled = false;
+#endif
+#ifdef CPU_AOT
+static const uint8_t *aot_rom = NULL; // NULL if the translation is for another ROM
+#endif
+
+static bool running = true;
+static bool unimplemented = false; // Reported by cpu_run once the instructions are counted
+#ifdef DEBUG
+static bool to_continue = false; // Start in the debugger
+uint8_t verbose = VERBOSE_CPU;   // Extern
+#else
+static bool to_continue = true;
+uint8_t verbose = VERBOSE_NONE; // Extern
+#endif
+static uint16_t to_execute = 0;
+static bool has_breakpoint = false;
+static uint16_t breakpoint_addr = 0x0000;
+static bool recording = false; // Binary trace, see trace.h
+
+/*
+    Execution cores
+    cpu_core.h is compiled twice: a clean core without a single debugger
+    check and a traced one that prints the instructions and stops on the
+    breakpoint and at every step. The debugger swaps them when its state
+    changes, a SIGUSR1 (see cpu_request_break) brings it up at any time.
+*/
+typedef uint64_t (*cpu_core_t)(uint64_t cycle_budget);
+
+static uint64_t run_clean(uint64_t cycle_budget);
+static uint64_t run_traced(uint64_t cycle_budget);
 
-static struct
+static cpu_core_t run_core = run_clean;
+static bool tracing = false; // run_core is run_traced
+static volatile sig_atomic_t break_requested = 0;
+
+static char last_command[COMMAND_MAX_SIZE];
+
+static void print_disassembly(uint16_t addr, uint16_t nb_inst);
+
+/*
+    Lazy flags
+    The ALU operations record their operands and their result instead of
+    computing every flag, the conditional instructions only look at Z or C.
+    F is built when PUSH AF or the debugger needs all of it.
+*/
+static inline void record_flags(cpu_registers_t *regs, uint8_t kind, uint8_t op1, uint8_t op2, uint8_t result)
 {
-    union
-    {
-        struct
-        {
-            uint8_t f;
-            uint8_t a;
-        };
-        uint16_t af;
-    };
+    regs->flags_kind = kind;
+    regs->flags_op1 = op1;
+    regs->flags_op2 = op2;
+    regs->flags_result = result;
+}
 
-    union
-    {
-        struct
-        {
-            uint8_t c;
-            uint8_t b;
-        };
-        uint16_t bc;
-    };
+static inline bool get_flag_z(const cpu_registers_t *regs)
+{
+    return !regs->flags_result;
+}
 
-    union
-    {
-        struct
-        {
-            uint8_t e;
-            uint8_t d;
-        };
-        uint16_t de;
-    };
+static uint8_t get_flags(const cpu_registers_t *regs)
+{
+    uint8_t flags = 0;
 
-    union
+    switch (regs->flags_kind)
     {
-        struct
-        {
-            uint8_t l;
-            uint8_t h;
-        };
-        uint16_t hl;
-    };
+    case FLAGS_KIND_F:
+        flags = regs->f & ((1U << FLAG_N) | (1U << FLAG_H));
+        break;
 
-    uint16_t sp;
-    uint16_t pc;
-    bool ime;
+    case FLAGS_KIND_ADD:
+        flags = HAS_HALF_CARRY_ON_ADD(regs->flags_op1, regs->flags_op2) << FLAG_H;
+        break;
 
-} registers;
+    case FLAGS_KIND_SUB:
+        flags = (1U << FLAG_N) | HAS_HALF_CARRY_ON_SUB(regs->flags_op1, regs->flags_op2) << FLAG_H;
+        break;
 
-static uint64_t nb_exec_inst = 0;
+    case FLAGS_KIND_AND:
+        flags = 1U << FLAG_H;
+        break;
+    }
 
-static bool running = true;
-static bool to_continue = false;
-static uint16_t to_execute = 0;
-uint8_t verbose = VERBOSE_CPU; // Extern
-static uint16_t breakpoint_addr = 0x0000;
+    return flags | get_flag_z(regs) << FLAG_Z | regs->flags_carry << FLAG_C;
+}
 
-static char last_command[COMMAND_MAX_SIZE];
+// Start over from a whole F value
+static inline void load_flags(cpu_registers_t *regs, uint8_t flags)
+{
+    regs->f = flags & 0xf0;
+    regs->flags_kind = FLAGS_KIND_F;
+    regs->flags_result = !CHECK_BIT(flags, FLAG_Z);
+    regs->flags_carry = CHECK_BIT(flags, FLAG_C);
+}
+
+static void flush_block_cache(void)
+{
+    for (uint16_t i = 0; i < BLOCK_CACHE_SIZE; i++)
+        block_cache[i].nb_inst = 0;
+}
+
+static void select_core(void)
+{
+    bool traced = !to_continue || to_execute || (verbose & VERBOSE_CPU) || has_breakpoint || recording;
+    if (traced == tracing)
+        return;
+
+    // The pairs fused by the clean core would run as a single step
+    flush_block_cache();
+    tracing = traced;
+    run_core = traced ? run_traced : run_clean;
+}
 
 void cpu_init(void)
 {
     registers.pc = 0x100; // EntryPoint
     registers.af = 0x01B0;
+    load_flags(&registers, registers.f);
     registers.bc = 0x0013;
     registers.de = 0x00D8;
     registers.hl = 0x014D;
     registers.sp = 0xFFFE;
+    select_core();
+
+#ifdef CPU_JIT
+    jit_enabled = jit_init();
+#endif
+#ifdef CPU_AOT
+    uint64_t rom_size;
+    const uint8_t *rom = cartridge_get_rom(&rom_size);
+    if (rom != NULL && (rom[CARTRIDGE_HEADER_GLOBAL_CHECKSUM] << 8 | rom[CARTRIDGE_HEADER_GLOBAL_CHECKSUM + 1]) == aot_rom_checksum)
+        aot_rom = rom;
+    else
+        fprintf(stderr, P_ERROR "The translation was generated from another ROM, running the interpreter\n");
+#endif
 }
 
 bool cpu_is_running(void)
@@ -97,8 +287,32 @@ bool cpu_is_running(void)
     return running;
 }
 
+uint64_t cpu_get_skipped_cycles(void)
+{
+    return nb_skipped_cycles;
+}
+
+uint64_t cpu_get_nb_exec_inst(void)
+{
+    return nb_exec_inst;
+}
+
+uint64_t cpu_get_nb_dispatches(void)
+{
+    return nb_dispatches;
+}
+
+void cpu_request_break(void)
+{
+    break_requested = 1;
+}
+
 void cpu_debugger(void)
 {
+    // Nothing to do while the clean core runs
+    if (!tracing)
+        return;
+
     // Update Step
     if (to_execute)
     {
@@ -130,6 +344,8 @@ void cpu_debugger(void)
             fprintf(stderr, "- continue\n");
             fprintf(stderr, "- verbose (0-NONE, 1-CPU, 2-PPU, 3-TIMER, 4-ALL)\n");
             fprintf(stderr, "- breakpoint <address>\n");
+            fprintf(stderr, "- disassemble [address] [NB]\n");
+            fprintf(stderr, "- record [file] (stop without file)\n");
         }
         else if (!strncmp(command, "quit", 4) || !strncmp(command, "q\n", 2))
         {
@@ -188,28 +404,74 @@ void cpu_debugger(void)
             else
             {
                 breakpoint_addr = addr;
+                has_breakpoint = true;
                 fprintf(stderr, "Breakpoint set to 0x%x\n", breakpoint_addr);
             }
         }
+        else if (!strncmp(command, "disassemble", 11))
+        {
+            char *check;
+            uint16_t addr = strtol(command + 11, &check, 16);
+            if (command + 11 == check)
+                addr = registers.pc;
+
+            char *nb_check;
+            uint16_t nb_inst = strtol(check, &nb_check, 10);
+            if (check == nb_check)
+                nb_inst = DISASSEMBLY_DEFAULT_NB_INST;
+
+            print_disassembly(addr, nb_inst);
+        }
+        else if (!strncmp(command, "record", 6))
+        {
+            char filename[COMMAND_MAX_SIZE];
+            if (sscanf(command + 6, "%s", filename) == 1)
+            {
+                recording = trace_start(filename);
+                if (recording)
+                    fprintf(stderr, "Recording the trace to %s\n", filename);
+            }
+            else if (recording)
+            {
+                trace_stop();
+                recording = false;
+                fprintf(stderr, "Trace recorded\n");
+            }
+        }
         else
         {
             fprintf(stderr, "Unknown command\n");
         }
     }
+
+    select_core();
 }
 
-static void print_flags(void)
+static void print_flags(const cpu_registers_t *regs)
 {
+    uint8_t flags = get_flags(regs);
+
     fprintf(stderr, P_INFO "Flags [Z=%d, N=%d, H=%d, C=%d]\n",
-            CHECK_BIT(registers.f, FLAG_Z),
-            CHECK_BIT(registers.f, FLAG_N),
-            CHECK_BIT(registers.f, FLAG_H),
-            CHECK_BIT(registers.f, FLAG_C));
+            CHECK_BIT(flags, FLAG_Z),
+            CHECK_BIT(flags, FLAG_N),
+            CHECK_BIT(flags, FLAG_H),
+            CHECK_BIT(flags, FLAG_C));
 }
 
-static void breakpoint_check(void)
+static void print_registers(const cpu_registers_t *regs)
 {
-    if (breakpoint_addr == registers.pc)
+    fprintf(stderr, P_INFO "Registers [AF=0x%04x, BC=0x%04x, DE=0x%04x, HL=0x%04x, SP=0x%04x, PC=0x%04x]\n",
+            regs->a << 8 | get_flags(regs),
+            regs->bc,
+            regs->de,
+            regs->hl,
+            regs->sp,
+            regs->pc);
+}
+
+static void breakpoint_check(const cpu_registers_t *regs)
+{
+    if (has_breakpoint && breakpoint_addr == regs->pc)
     {
         to_execute = 0;
         to_continue = false;
@@ -217,2105 +479,1629 @@ static void breakpoint_check(void)
     }
 }
 
-uint64_t handle_cb_inst(uint8_t inst)
+/*
+    Shared instruction helpers
+*/
+static inline void inc_8(cpu_registers_t *regs, uint8_t *reg)
 {
-    uint64_t clock_cycles = 0;
-
-    // tmp vars
-    uint8_t bit;
-
-    switch (inst)
-    {
-    case 0x37: // SWAP A
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO "Exec CB 0x%x - SWAP A\n", inst);
-        }
-#endif
-        registers.a = ((registers.a & 0x0f) << 4) | ((registers.a & 0xf0) >> 4);
-
-        registers.f = 0;
-        if (!registers.a)
-            SET_BIT(registers.f, FLAG_Z);
-
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO "Set A to 0x%x\n", registers.a);
-            print_flags();
-        }
-#endif
+    (*reg)++;
+    record_flags(regs, FLAGS_KIND_ADD, *reg - 1, 1, *reg);
+}
 
-        clock_cycles = 8;
-        break;
+static inline void dec_8(cpu_registers_t *regs, uint8_t *reg)
+{
+    (*reg)--;
+    record_flags(regs, FLAGS_KIND_SUB, *reg + 1, 1, *reg);
+}
 
-    case 0x41: // BIT 0, C
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO_INST "(0x%04x) Exec 0x%x - BIT 0, C\n", registers.pc, inst);
-        }
-#endif
-        bit = CHECK_BIT(registers.c, 0);
+static inline void add_a(cpu_registers_t *regs, uint8_t value)
+{
+    regs->flags_carry = regs->a + value > 0xff;
+    record_flags(regs, FLAGS_KIND_ADD, regs->a, value, regs->a + value);
 
-        // Z = !bit
-        if (!bit)
-            SET_BIT(registers.f, FLAG_Z);
-        else
-            CLEAR_BIT(registers.f, FLAG_Z);
+    regs->a += value;
+}
 
-        CLEAR_BIT(registers.f, FLAG_N);
-        SET_BIT(registers.f, FLAG_H);
+// Compute A - value and update flags, return the full result
+static inline int16_t compare_a(cpu_registers_t *regs, uint8_t value)
+{
+    int16_t sub = (int16_t)regs->a - (int16_t)value;
 
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO "Test bit 0 of C(%x)\n", CHECK_BIT(registers.c, 0));
-            print_flags();
-        }
-#endif
-        clock_cycles = 8;
-        break;
+    regs->flags_carry = sub < 0;
+    record_flags(regs, FLAGS_KIND_SUB, regs->a, value, sub);
 
-    case 0x79: // BIT 7, C
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO_INST "(0x%04x) Exec 0x%x - BIT 7, C\n", registers.pc, inst);
-        }
-#endif
-        bit = CHECK_BIT(registers.c, 7);
+    return sub;
+}
 
-        // Z = !bit
-        if (!bit)
-            SET_BIT(registers.f, FLAG_Z);
-        else
-            CLEAR_BIT(registers.f, FLAG_Z);
+static inline void and_a(cpu_registers_t *regs, uint8_t value)
+{
+    regs->a &= value;
+    regs->flags_carry = false;
+    record_flags(regs, FLAGS_KIND_AND, 0, 0, regs->a);
+}
 
-        CLEAR_BIT(registers.f, FLAG_N);
-        SET_BIT(registers.f, FLAG_H);
+static inline void xor_a(cpu_registers_t *regs, uint8_t value)
+{
+    regs->a ^= value;
+    regs->flags_carry = false;
+    record_flags(regs, FLAGS_KIND_LOGIC, 0, 0, regs->a);
+}
 
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO "Test bit 7 of C(%x)\n", CHECK_BIT(registers.c, 7));
-            print_flags();
-        }
-#endif
-        clock_cycles = 8;
-        break;
+static inline void or_a(cpu_registers_t *regs, uint8_t value)
+{
+    regs->a |= value;
+    regs->flags_carry = false;
+    record_flags(regs, FLAGS_KIND_LOGIC, 0, 0, regs->a);
+}
 
-    case 0x87: // RES 0, A
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO "Exec CB 0x%x - RES 0, A\n", inst);
-        }
-#endif
-        CLEAR_BIT(registers.a, 0);
+static inline void push_16(cpu_registers_t *regs, uint16_t value)
+{
+    regs->sp -= 2;
+    memory_write_16(regs->sp, value);
+}
 
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO "Set bit 0 of A to 0\n");
-            print_flags();
-        }
-#endif
+static inline uint16_t pop_16(cpu_registers_t *regs)
+{
+    uint16_t value = memory_read_16(regs->sp);
+    regs->sp += 2;
+    return value;
+}
 
-        clock_cycles = 8;
-        break;
+/*
+    Idle loops
+    A loop that reads LY or STAT, tests the value with CP or AND and jumps
+    back leaves the CPU in the same state at every iteration until the PPU
+    changes the register, the iterations in between are skipped at once.
+*/
+static bool is_ppu_polled_reg(uint16_t addr)
+{
+    return addr == MEMORY_REG_LY || addr == MEMORY_REG_STAT;
+}
 
-    case 0xff: // SET 7, A
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO "Exec CB 0x%x - SET 7, A\n", inst);
-        }
-#endif
-        SET_BIT(registers.a, 7);
+// Return the duration of one iteration of an idle loop or 0 if the code
+// between the head and the jump does anything else
+static uint8_t get_idle_loop_duration(uint16_t head_addr, uint16_t jr_addr)
+{
+    uint8_t duration = 0;
+    uint8_t test_opcode = memory_read_8(jr_addr - 2);
 
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO "Set bit 7 of A to 1\n");
-            print_flags();
-        }
-#endif
+    if (test_opcode != 0xfe && test_opcode != 0xe6) // CP nn, AND nn
+        return 0;
 
-        clock_cycles = 8;
+    switch (jr_addr - head_addr)
+    {
+    case 4: // LD A, (FF00+nn)
+        if (memory_read_8(head_addr) == 0xf0 && is_ppu_polled_reg(MEMORY_IO_START_ADDR + memory_read_8(head_addr + 1)))
+            duration = IDLE_LOOP_LDH_DURATION;
         break;
 
-    default:
-        running = false;
-        fprintf(stderr, P_FATAL "Successfully executed %ld instructions\n", nb_exec_inst);
-        fprintf(stderr, P_FATAL "At 0x%x - CB instruction 0x%02x not implemented yet!\n", registers.pc, inst);
+    case 5: // LD A, (nnnn)
+        if (memory_read_8(head_addr) == 0xfa && is_ppu_polled_reg(memory_read_16(head_addr + 1)))
+            duration = IDLE_LOOP_LD_DURATION;
         break;
     }
 
-    return clock_cycles;
+    return duration;
 }
 
-uint64_t cpu_execute_inst(void)
+// Called on a backward jump that is about to be taken, regs->pc is the head
+// of the loop. Move the clock to the first iteration that can see a new value
+static void skip_idle_loop(const cpu_registers_t *regs, uint16_t jr_addr)
 {
-    uint64_t clock_cycles = 0;
+    uint8_t duration = get_idle_loop_duration(regs->pc, jr_addr);
 
-    // Get Instruction
-    uint8_t inst = memory_read_8(registers.pc);
+    // An interrupt would leave the loop
+    if (!duration || interrupt_pending)
+        return;
 
-    uint8_t offset;
-    uint8_t value;
-    uint8_t cb_inst;
-    uint16_t call_addr;
-    uint16_t addr;
-    uint16_t value_addr;
-    uint8_t mem_val;
-    int16_t sub;
+    // Let the debugger see every iteration
+    if (tracing && (!to_continue || (verbose & VERBOSE_CPU) || recording || (has_breakpoint && breakpoint_addr >= regs->pc && breakpoint_addr <= jr_addr)))
+        return;
 
-    switch (inst)
-    {
-    case 0x00: // NOP
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO_INST "(0x%04x) Exec 0x%x - NOP\n", registers.pc, inst);
-        }
-#endif
-        registers.pc++;
-        clock_cycles = 4;
-        break;
+    // Every interrupt source is either a scheduled event or a PPU transition,
+    // don't go past the budget or the next event
+    uint64_t head_clock = scheduler_clock + JR_TAKEN_DURATION;
+    uint64_t change_clock = ppu_next_transition();
+    uint64_t limit_clock = run_end_clock < scheduler_deadline ? run_end_clock : scheduler_deadline;
 
-    case 0x01: // LD BC, nnnn
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO_INST "(0x%04x) Exec 0x%x - LD BC, nnnn\n", registers.pc, inst);
-        }
-#endif
-        registers.bc = memory_read_16(registers.pc + 1);
+    if (change_clock <= head_clock || limit_clock <= head_clock)
+        return;
 
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO "Load 0x%x in BC\n", registers.bc);
-        }
-#endif
-        registers.pc += 3;
-        clock_cycles = 12;
-        break;
+    uint64_t nb_iterations = (change_clock - head_clock + duration - 1) / duration;
+    uint64_t max_iterations = (limit_clock - head_clock) / duration;
+    if (nb_iterations > max_iterations)
+        nb_iterations = max_iterations;
 
-    case 0x03: // INC BC
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO_INST "(0x%04x) Exec 0x%x - INC BC\n", registers.pc, inst);
-        }
-#endif
-        registers.bc++;
+    scheduler_clock += nb_iterations * duration;
+    nb_skipped_cycles += nb_iterations * duration;
+    nb_exec_inst += nb_iterations * IDLE_LOOP_NB_INST;
+}
 
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO "Set BC to 0x%x\n", registers.bc);
-        }
-#endif
-        registers.pc++;
-        clock_cycles = 8;
-        break;
+static inline uint8_t jump_relative(cpu_registers_t *regs, uint8_t opcode, bool condition, uint16_t operand)
+{
+    if (!condition)
+        return 0;
 
-    case 0x04: // INC B
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO_INST "(0x%04x) Exec 0x%x - INC B\n", registers.pc, inst);
-        }
-#endif
-        registers.b++;
+    uint16_t jr_addr = regs->pc - 2;
+    regs->pc += (int8_t)operand;
 
-        CLEAR_BIT(registers.f, FLAG_N);
-        if (!registers.b)
-            SET_BIT(registers.f, FLAG_Z);
-        else
-            CLEAR_BIT(registers.f, FLAG_Z);
-        if (HAS_HALF_CARRY_ON_ADD(registers.b - 1, 1))
-            SET_BIT(registers.f, FLAG_H);
-        else
-            CLEAR_BIT(registers.f, FLAG_H);
+    if ((int8_t)operand < 0)
+        skip_idle_loop(regs, jr_addr);
 
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO "Inc B to 0x%x\n", registers.b);
-            print_flags();
-        }
-#endif
-        registers.pc++;
-        clock_cycles = 4;
-        break;
+    return opcode_branch_cycles[opcode];
+}
 
-    case 0x05: // DEC B
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO_INST "(0x%04x) Exec 0x%x - DEC B\n", registers.pc, inst);
-        }
-#endif
-        registers.b--;
+static inline void bit_test(cpu_registers_t *regs, uint8_t value, uint8_t bit)
+{
+    // Z = !bit, C is left untouched
+    record_flags(regs, FLAGS_KIND_AND, 0, 0, value & (1U << bit));
+}
 
-        SET_BIT(registers.f, FLAG_N);
-        if (!registers.b)
-            SET_BIT(registers.f, FLAG_Z);
-        else
-            CLEAR_BIT(registers.f, FLAG_Z);
-        if (HAS_HALF_CARRY_ON_SUB(registers.b + 1, registers.b))
-            SET_BIT(registers.f, FLAG_H);
-        else
-            CLEAR_BIT(registers.f, FLAG_H);
+/*
+    CB prefixed instructions
+    The opcode is split in fields: the operation in bits 7-3 (bits 7-6 only
+    for BIT, RES and SET), the bit number in bits 5-3 and the register in
+    bits 2-0, looked up in reg_8_offsets. (HL) has no offset and goes
+    through the bus. The prefix handler accounts for the duration
+*/
+#define CB_FIELD_BIT(opcode) (((opcode) >> 3) & 0x07)
+#define CB_FIELD_REG(opcode) ((opcode) & 0x07)
+
+static inline uint8_t cb_read(cpu_registers_t *regs, uint8_t reg)
+{
+    if (reg == REG_8_IND_HL)
+        return memory_read_8(regs->hl);
+    return *((uint8_t *)regs + reg_8_offsets[reg]);
+}
 
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO "Dec B to 0x%x\n", registers.b);
-            print_flags();
-        }
-#endif
-        registers.pc++;
-        clock_cycles = 4;
-        break;
+static inline void cb_write(cpu_registers_t *regs, uint8_t reg, uint8_t value)
+{
+    if (reg == REG_8_IND_HL)
+        memory_write_8(regs->hl, value);
+    else
+        *((uint8_t *)regs + reg_8_offsets[reg]) = value;
+}
 
-    case 0x06: // LD B, nn
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO_INST "(0x%04x) Exec 0x%x - LD B, nn\n", registers.pc, inst);
-        }
-#endif
-        registers.b = memory_read_8(registers.pc + 1);
+// Write back the result of a rotation or a shift
+static inline uint8_t cb_shift_done(cpu_registers_t *regs, uint8_t opcode, uint8_t result, bool carry)
+{
+    regs->flags_carry = carry;
+    record_flags(regs, FLAGS_KIND_LOGIC, 0, 0, result);
+    cb_write(regs, CB_FIELD_REG(opcode), result);
+    return 0;
+}
 
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO "Load 0x%x in B\n", registers.b);
-        }
-#endif
-        registers.pc += 2;
-        clock_cycles = 8;
-        break;
+INST_HANDLER(inst_cb_rlc)
+{
+    uint8_t value = cb_read(regs, CB_FIELD_REG(opcode));
+    return cb_shift_done(regs, opcode, value << 1 | value >> 7, value >> 7);
+}
 
-    case 0x0b: // DEC BC
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO_INST "(0x%04x) Exec 0x%x - DEC BC\n", registers.pc, inst);
-        }
-#endif
-        registers.bc--;
+INST_HANDLER(inst_cb_rrc)
+{
+    uint8_t value = cb_read(regs, CB_FIELD_REG(opcode));
+    return cb_shift_done(regs, opcode, value >> 1 | value << 7, value & 0x01);
+}
 
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO "Dec BC to 0x%x\n", registers.bc);
-            print_flags();
-        }
-#endif
-        registers.pc++;
-        clock_cycles = 8;
-        break;
+INST_HANDLER(inst_cb_rl)
+{
+    uint8_t value = cb_read(regs, CB_FIELD_REG(opcode));
+    return cb_shift_done(regs, opcode, value << 1 | regs->flags_carry, value >> 7);
+}
 
-    case 0x0c: // INC C
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO_INST "(0x%04x) Exec 0x%x - INC C\n", registers.pc, inst);
-        }
-#endif
-        registers.c++;
+INST_HANDLER(inst_cb_rr)
+{
+    uint8_t value = cb_read(regs, CB_FIELD_REG(opcode));
+    return cb_shift_done(regs, opcode, value >> 1 | regs->flags_carry << 7, value & 0x01);
+}
 
-        CLEAR_BIT(registers.f, FLAG_N);
-        if (!registers.c)
-            SET_BIT(registers.f, FLAG_Z);
-        else
-            CLEAR_BIT(registers.f, FLAG_Z);
-        if (HAS_HALF_CARRY_ON_ADD(registers.c - 1, 1))
-            SET_BIT(registers.f, FLAG_H);
-        else
-            CLEAR_BIT(registers.f, FLAG_H);
+INST_HANDLER(inst_cb_sla)
+{
+    uint8_t value = cb_read(regs, CB_FIELD_REG(opcode));
+    return cb_shift_done(regs, opcode, value << 1, value >> 7);
+}
 
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO "Inc C to 0x%x\n", registers.c);
-            print_flags();
-        }
-#endif
-        registers.pc++;
-        clock_cycles = 4;
-        break;
+INST_HANDLER(inst_cb_sra)
+{
+    uint8_t value = cb_read(regs, CB_FIELD_REG(opcode));
+    return cb_shift_done(regs, opcode, value >> 1 | (value & 0x80), value & 0x01);
+}
 
-    case 0x0d: // DEC C
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO_INST "(0x%04x) Exec 0x%x - DEC C\n", registers.pc, inst);
-        }
-#endif
-        registers.c--;
+INST_HANDLER(inst_cb_swap)
+{
+    uint8_t value = cb_read(regs, CB_FIELD_REG(opcode));
+    return cb_shift_done(regs, opcode, value << 4 | value >> 4, false);
+}
 
-        SET_BIT(registers.f, FLAG_N);
-        if (!registers.c)
-            SET_BIT(registers.f, FLAG_Z);
-        else
-            CLEAR_BIT(registers.f, FLAG_Z);
-        if (HAS_HALF_CARRY_ON_SUB(registers.c + 1, registers.c))
-            SET_BIT(registers.f, FLAG_H);
-        else
-            CLEAR_BIT(registers.f, FLAG_H);
+INST_HANDLER(inst_cb_srl)
+{
+    uint8_t value = cb_read(regs, CB_FIELD_REG(opcode));
+    return cb_shift_done(regs, opcode, value >> 1, value & 0x01);
+}
 
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO "Dec C to 0x%x\n", registers.c);
-            print_flags();
-        }
-#endif
-        registers.pc++;
-        clock_cycles = 4;
-        break;
+INST_HANDLER(inst_cb_bit)
+{
+    bit_test(regs, cb_read(regs, CB_FIELD_REG(opcode)), CB_FIELD_BIT(opcode));
+    return 0;
+}
 
-    case 0x0e: // LD C, nn
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO_INST "(0x%04x) Exec 0x%x - LD C, nn\n", registers.pc, inst);
-        }
-#endif
-        registers.c = memory_read_8(registers.pc + 1);
+INST_HANDLER(inst_cb_res)
+{
+    uint8_t reg = CB_FIELD_REG(opcode);
 
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO "Load 0x%x in C\n", registers.c);
-        }
-#endif
-        registers.pc += 2;
-        clock_cycles = 8;
-        break;
+    cb_write(regs, reg, cb_read(regs, reg) & ~(1U << CB_FIELD_BIT(opcode)));
+    return 0;
+}
 
-    case 0x11: // LD DE, nnnn
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO_INST "(0x%04x) Exec 0x%x - LD DE, nnnn\n", registers.pc, inst);
-        }
-#endif
-        registers.de = memory_read_16(registers.pc + 1);
+INST_HANDLER(inst_cb_set)
+{
+    uint8_t reg = CB_FIELD_REG(opcode);
 
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO "Load 0x%x in DE\n", registers.de);
-        }
-#endif
-        registers.pc += 3;
-        clock_cycles = 12;
-        break;
+    cb_write(regs, reg, cb_read(regs, reg) | 1U << CB_FIELD_BIT(opcode));
+    return 0;
+}
 
-    case 0x12: // LD (DE), A
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO_INST "(0x%04x) Exec 0x%x - LD (DE), A\n", registers.pc, inst);
-        }
-#endif
-        memory_write_8(registers.de, registers.a);
+/*
+    Instructions
+*/
 
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO "Save A(0x%x) at *DE(0x%x)\n", registers.a, registers.de);
-        }
-#endif
-        registers.pc++;
-        clock_cycles = 8;
-        break;
+INST_HANDLER(inst_unimplemented)
+{
+    // Rewind PC on the faulty instruction
+    regs->pc -= opcode_lengths[opcode];
 
-    case 0x13: // INC DE
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO_INST "(0x%04x) Exec 0x%x - INC DE\n", registers.pc, inst);
-        }
-#endif
-        registers.de++;
+    running = false;
+    unimplemented = true;
+    return 0;
+}
 
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO "Set DE to 0x%x\n", registers.de);
-        }
-#endif
-        registers.pc++;
-        clock_cycles = 8;
-        break;
+INST_HANDLER(inst_nop)
+{
+    return 0;
+}
 
-    case 0x14: // INC D
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO_INST "(0x%04x) Exec 0x%x - INC D\n", registers.pc, inst);
-        }
-#endif
-        registers.d++;
+INST_HANDLER(inst_ld_bc_nnnn)
+{
+    regs->bc = operand;
+    return 0;
+}
 
-        CLEAR_BIT(registers.f, FLAG_N);
-        if (!registers.d)
-            SET_BIT(registers.f, FLAG_Z);
-        else
-            CLEAR_BIT(registers.f, FLAG_Z);
-        if (HAS_HALF_CARRY_ON_ADD(registers.d - 1, 1))
-            SET_BIT(registers.f, FLAG_H);
-        else
-            CLEAR_BIT(registers.f, FLAG_H);
+INST_HANDLER(inst_inc_bc)
+{
+    regs->bc++;
+    return 0;
+}
 
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO "Inc D to 0x%x\n", registers.d);
-            print_flags();
-        }
-#endif
-        registers.pc++;
-        clock_cycles = 4;
-        break;
+INST_HANDLER(inst_inc_b)
+{
+    inc_8(regs, &regs->b);
+    return 0;
+}
 
-    case 0x15: // DEC D
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO_INST "(0x%04x) Exec 0x%x - DEC D\n", registers.pc, inst);
-        }
-#endif
-        registers.d--;
+INST_HANDLER(inst_dec_b)
+{
+    dec_8(regs, &regs->b);
+    return 0;
+}
 
-        SET_BIT(registers.f, FLAG_N);
-        if (!registers.d)
-            SET_BIT(registers.f, FLAG_Z);
-        else
-            CLEAR_BIT(registers.f, FLAG_Z);
-        if (HAS_HALF_CARRY_ON_SUB(registers.d + 1, registers.d))
-            SET_BIT(registers.f, FLAG_H);
-        else
-            CLEAR_BIT(registers.f, FLAG_H);
+INST_HANDLER(inst_ld_b_nn)
+{
+    regs->b = operand;
+    return 0;
+}
 
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO "Dec D to 0x%x\n", registers.d);
-            print_flags();
-        }
-#endif
-        registers.pc++;
-        clock_cycles = 4;
-        break;
+INST_HANDLER(inst_dec_bc)
+{
+    regs->bc--;
+    return 0;
+}
 
-    case 0x16: // LD D, nn
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO_INST "(0x%04x) Exec 0x%x - LD D, nn\n", registers.pc, inst);
-        }
-#endif
-        registers.d = memory_read_8(registers.pc + 1);
+INST_HANDLER(inst_inc_c)
+{
+    inc_8(regs, &regs->c);
+    return 0;
+}
 
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO "Load 0x%x in D\n", registers.d);
-        }
-#endif
-        registers.pc += 2;
-        clock_cycles = 8;
-        break;
+INST_HANDLER(inst_dec_c)
+{
+    dec_8(regs, &regs->c);
+    return 0;
+}
 
-    case 0x19: // ADD HL, DE
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO_INST "(0x%04x) Exec 0x%x - ADD HL, DE\n", registers.pc, inst);
-        }
-#endif
-        registers.hl += registers.de;
+INST_HANDLER(inst_ld_c_nn)
+{
+    regs->c = operand;
+    return 0;
+}
 
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO "Set HL to 0x%x\n", registers.hl);
-        }
-#endif
-        registers.pc++;
-        clock_cycles = 8;
-        break;
+// Without a joypad to wake it up, STOP behaves like HALT and resets DIV
+INST_HANDLER(inst_stop)
+{
+    memory_write_8(MEMORY_REG_DIV, 0);
+    interrupt_halt();
+    return 0;
+}
 
-    case 0x1a: // LD A, (DE)
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO_INST "(0x%04x) Exec 0x%x - LD A, (DE)\n", registers.pc, inst);
-        }
-#endif
-        registers.a = memory_read_8(registers.de);
+INST_HANDLER(inst_ld_de_nnnn)
+{
+    regs->de = operand;
+    return 0;
+}
 
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO "Load *DE(0x%x) in A(0x%x)\n", registers.de, registers.a);
-        }
-#endif
-        registers.pc++;
-        clock_cycles = 8;
-        break;
+INST_HANDLER(inst_ld_ind_de_a)
+{
+    memory_write_8(regs->de, regs->a);
+    return 0;
+}
 
-    case 0x1c: // INC E
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO_INST "(0x%04x) Exec 0x%x - INC E\n", registers.pc, inst);
-        }
-#endif
-        registers.e++;
+INST_HANDLER(inst_inc_de)
+{
+    regs->de++;
+    return 0;
+}
 
-        CLEAR_BIT(registers.f, FLAG_N);
-        if (!registers.e)
-            SET_BIT(registers.f, FLAG_Z);
-        else
-            CLEAR_BIT(registers.f, FLAG_Z);
-        if (HAS_HALF_CARRY_ON_ADD(registers.e - 1, 1))
-            SET_BIT(registers.f, FLAG_H);
-        else
-            CLEAR_BIT(registers.f, FLAG_H);
+INST_HANDLER(inst_inc_d)
+{
+    inc_8(regs, &regs->d);
+    return 0;
+}
 
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO "Inc E to 0x%x\n", registers.c);
-            print_flags();
-        }
-#endif
-        registers.pc++;
-        clock_cycles = 4;
-        break;
+INST_HANDLER(inst_dec_d)
+{
+    dec_8(regs, &regs->d);
+    return 0;
+}
 
-    case 0x18: // JR nn
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO_INST "(0x%04x) Exec 0x%x - JR nn\n", registers.pc, inst);
-        }
-#endif
-        registers.pc += (int8_t)memory_read_8(registers.pc + 1);
+INST_HANDLER(inst_ld_d_nn)
+{
+    regs->d = operand;
+    return 0;
+}
 
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO "Jump at 0x%x\n", registers.pc + 2);
-        }
-#endif
+INST_HANDLER(inst_jr)
+{
+    regs->pc += (int8_t)operand;
+    return 0;
+}
 
-        registers.pc += 2;
-        clock_cycles = 12;
-        break;
+INST_HANDLER(inst_add_hl_de)
+{
+    // Z is left untouched
+    regs->f = HAS_HALF_CARRY_ON_ADD_16(regs->hl, regs->de) << FLAG_H;
+    regs->flags_kind = FLAGS_KIND_F;
+    regs->flags_carry = regs->hl + regs->de > 0xffff;
 
-    case 0x20: // JR NZ,nn
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO_INST "(0x%04x) Exec 0x%x - JR NZ,nn\n", registers.pc, inst);
-        }
-#endif
-        clock_cycles = 8;
-        if (!CHECK_BIT(registers.f, FLAG_Z))
-        {
-            registers.pc += (int8_t)memory_read_8(registers.pc + 1);
+    regs->hl += regs->de;
+    return 0;
+}
 
-            clock_cycles = 12;
-#ifdef DEBUG
-            if (verbose & VERBOSE_CPU)
-            {
-                fprintf(stderr, P_INFO "Jump at 0x%x\n", registers.pc + 2);
-            }
-#endif
-        }
-#ifdef DEBUG
-        else
-        {
-            if (verbose & VERBOSE_CPU)
-            {
-                fprintf(stderr, P_INFO "No Jump\n");
-            }
-        }
-#endif
-        registers.pc += 2;
-        // clock_cycles = 12; // 12 or 8
-        break;
+INST_HANDLER(inst_ld_a_ind_de)
+{
+    regs->a = memory_read_8(regs->de);
+    return 0;
+}
 
-    case 0x21: // LD HL, nnnn
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO_INST "(0x%04x) Exec 0x%x - LD HL, nnnn\n", registers.pc, inst);
-        }
-#endif
-        registers.hl = memory_read_16(registers.pc + 1);
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO "Load 0x%x in HL\n", registers.hl);
-        }
-#endif
-        registers.pc += 3;
-        clock_cycles = 12;
-        break;
+INST_HANDLER(inst_inc_e)
+{
+    inc_8(regs, &regs->e);
+    return 0;
+}
 
-    case 0x22: // LDI (HL), A - (HL)=A, HL=HL+1
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO_INST "(0x%04x) Exec 0x%x - LDI (HL), A - (HL)=A, HL=HL+1\n", registers.pc, inst);
-        }
-#endif
-        memory_write_8(registers.hl, registers.a);
-        registers.hl++;
+INST_HANDLER(inst_jr_nz)
+{
+    return jump_relative(regs, opcode, !get_flag_z(regs), operand);
+}
 
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO "Save A(0x%x) at *HL(0x%x)\n", registers.a, registers.hl - 1);
-            fprintf(stderr, P_INFO "Set HL to 0x%x\n", registers.hl);
-        }
-#endif
-        registers.pc++;
-        clock_cycles = 8;
-        break;
+INST_HANDLER(inst_ld_hl_nnnn)
+{
+    regs->hl = operand;
+    return 0;
+}
 
-    case 0x23: // INC HL
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO_INST "(0x%04x) Exec 0x%x - INC HL\n", registers.pc, inst);
-        }
-#endif
-        registers.hl++;
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO "Load 0x%x in HL\n", registers.hl);
-        }
-#endif
-        registers.pc++;
-        clock_cycles = 8;
-        break;
+INST_HANDLER(inst_ldi_ind_hl_a)
+{
+    memory_write_8(regs->hl, regs->a);
+    regs->hl++;
+    return 0;
+}
 
-    case 0x28: // JR Z,nn
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO_INST "(0x%04x) Exec 0x%x - JR Z,nn\n", registers.pc, inst);
-        }
-#endif
-        clock_cycles = 8;
-        if (CHECK_BIT(registers.f, FLAG_Z))
-        {
-            registers.pc += (int8_t)memory_read_8(registers.pc + 1);
+INST_HANDLER(inst_inc_hl)
+{
+    regs->hl++;
+    return 0;
+}
 
-            clock_cycles = 12;
-#ifdef DEBUG
-            if (verbose & VERBOSE_CPU)
-            {
-                fprintf(stderr, P_INFO "Jump at 0x%x\n", registers.pc + 2);
-            }
-#endif
-        }
-#ifdef DEBUG
-        else
-        {
-            if (verbose & VERBOSE_CPU)
-            {
-                fprintf(stderr, P_INFO "No Jump\n");
-            }
-        }
-#endif
-        registers.pc += 2;
-        // clock_cycles = 12; // 12 or 8
-        break;
+INST_HANDLER(inst_jr_z)
+{
+    return jump_relative(regs, opcode, get_flag_z(regs), operand);
+}
 
-    case 0x2a: // LDI A, (HL); HL=HL+1
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO_INST "(0x%04x) Exec 0x%x - LDI A, (HL); HL=HL+1\n", registers.pc, inst);
-        }
-#endif
-        registers.a = memory_read_8(registers.hl);
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO "Load *HL(0x%x) in A(0x%x)\n", registers.hl, registers.a);
-        }
-#endif
-        registers.hl++;
-        registers.pc++;
-        clock_cycles = 8;
-        break;
+INST_HANDLER(inst_ldi_a_ind_hl)
+{
+    regs->a = memory_read_8(regs->hl);
+    regs->hl++;
+    return 0;
+}
 
-    case 0x2f: // CPL, A = A xor FF
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO_INST "(0x%04x) Exec 0x%x - CPL, A = A xor FF\n", registers.pc, inst);
-        }
-#endif
-        registers.a ^= 0xff;
-        SET_BIT(registers.f, FLAG_N);
-        SET_BIT(registers.f, FLAG_H);
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO "Set A to 0x%x\n", registers.a);
-            print_flags();
-        }
-#endif
-        registers.pc++;
-        clock_cycles = 4;
-        break;
+INST_HANDLER(inst_cpl)
+{
+    regs->a ^= 0xff;
 
-    case 0x30: // JR NC, nn
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO_INST "(0x%04x) Exec 0x%x - JR NC, nn\n", registers.pc, inst);
-        }
-#endif
-        clock_cycles = 8;
-        if (!CHECK_BIT(registers.f, FLAG_C))
-        {
-            registers.pc += (int8_t)memory_read_8(registers.pc + 1);
+    // Z and C are left untouched
+    regs->f = (1U << FLAG_N) | (1U << FLAG_H);
+    regs->flags_kind = FLAGS_KIND_F;
+    return 0;
+}
 
-            clock_cycles = 12;
-#ifdef DEBUG
-            if (verbose & VERBOSE_CPU)
-            {
-                fprintf(stderr, P_INFO "Jump at 0x%x\n", registers.pc + 2);
-            }
-#endif
-        }
-#ifdef DEBUG
-        else
-        {
-            if (verbose & VERBOSE_CPU)
-            {
-                fprintf(stderr, P_INFO "No Jump\n");
-            }
-        }
-#endif
-        registers.pc += 2;
-        // clock_cycles = 12; // 12 or 8
-        break;
+INST_HANDLER(inst_jr_nc)
+{
+    return jump_relative(regs, opcode, !regs->flags_carry, operand);
+}
 
-    case 0x31: // LD SP, nnnn
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO_INST "(0x%04x) Exec 0x%x - LD SP, nnnn\n", registers.pc, inst);
-        }
-#endif
-        registers.sp = memory_read_16(registers.pc + 1);
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO "Load 0x%x in SP\n", registers.sp);
-        }
-#endif
-        registers.pc += 3;
-        clock_cycles = 12;
-        break;
+INST_HANDLER(inst_ld_sp_nnnn)
+{
+    regs->sp = operand;
+    return 0;
+}
 
-    case 0x32: // LDD (HL), A; HL=HL-1
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO_INST "(0x%04x) Exec 0x%x - LDD (HL), A; HL=HL-1\n", registers.pc, inst);
-        }
-#endif
-        memory_write_8(registers.hl, registers.a);
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO "Save A(0x%x) in *HL(0x%x)\n", registers.a, registers.hl);
-        }
-#endif
-        registers.hl--;
-        registers.pc++;
-        clock_cycles = 8;
-        break;
+INST_HANDLER(inst_ldd_ind_hl_a)
+{
+    memory_write_8(regs->hl, regs->a);
+    regs->hl--;
+    return 0;
+}
 
-    case 0x36: // LD (HL), nn
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO_INST "(0x%04x) Exec 0x%x - LD (HL), nn\n", registers.pc, inst);
-        }
-#endif
-        value = memory_read_8(registers.pc + 1);
-        memory_write_8(registers.hl, value);
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO "Save 0x%x in *HL(0x%x)\n", value, registers.hl);
-        }
-#endif
-        registers.pc += 2;
-        clock_cycles = 12;
-        break;
+INST_HANDLER(inst_ld_ind_hl_nn)
+{
+    memory_write_8(regs->hl, operand);
+    return 0;
+}
 
-    case 0x3c: // INC A
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO_INST "(0x%04x) Exec 0x%x - INC A\n", registers.pc, inst);
-        }
-#endif
-        registers.a++;
+INST_HANDLER(inst_inc_a)
+{
+    inc_8(regs, &regs->a);
+    return 0;
+}
 
-        CLEAR_BIT(registers.f, FLAG_N);
-        if (!registers.a)
-            SET_BIT(registers.f, FLAG_Z);
-        else
-            CLEAR_BIT(registers.f, FLAG_Z);
-        if (HAS_HALF_CARRY_ON_ADD(registers.a - 1, 1))
-            SET_BIT(registers.f, FLAG_H);
-        else
-            CLEAR_BIT(registers.f, FLAG_H);
+INST_HANDLER(inst_ld_a_nn)
+{
+    regs->a = operand;
+    return 0;
+}
 
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO "Inc A to 0x%x\n", registers.a);
-            print_flags();
-        }
-#endif
-        registers.pc++;
-        clock_cycles = 4;
-        break;
+INST_HANDLER(inst_ccf)
+{
+    regs->f = 0;
+    regs->flags_kind = FLAGS_KIND_F;
+    regs->flags_carry = !regs->flags_carry;
+    return 0;
+}
 
-    case 0x3e: // LD A, nn
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO_INST "(0x%04x) Exec 0x%x - LD A, nn\n", registers.pc, inst);
-        }
-#endif
-        registers.a = memory_read_8(registers.pc + 1);
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO "Load 0x%x in A\n", registers.a);
-        }
-#endif
-        registers.pc += 2;
-        clock_cycles = 8;
-        break;
+INST_HANDLER(inst_ld_b_b)
+{
+    return 0;
+}
 
-    case 0x3f: // CCF
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO_INST "(0x%04x) Exec 0x%x - CCF\n", registers.pc, inst);
-        }
-#endif
-        CLEAR_BIT(registers.f, FLAG_N);
-        CLEAR_BIT(registers.f, FLAG_H);
-        FLIP_BIT(registers.f, FLAG_C);
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            print_flags();
-        }
-#endif
+INST_HANDLER(inst_ld_b_a)
+{
+    regs->b = regs->a;
+    return 0;
+}
 
-        registers.pc += 1;
-        clock_cycles = 4;
-        break;
+INST_HANDLER(inst_ld_c_a)
+{
+    regs->c = regs->a;
+    return 0;
+}
 
-    case 0x40: // LD B, B
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO_INST "(0x%04x) Exec 0x%x - LD B, B\n", registers.pc, inst);
-        }
-#endif
-        registers.b = registers.b;
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO "Load B(0x%x) in B\n", registers.b);
-        }
-#endif
-        registers.pc++;
-        clock_cycles = 4;
-        break;
+INST_HANDLER(inst_ld_d_b)
+{
+    regs->d = regs->b;
+    return 0;
+}
 
-    case 0x47: // LD B, A
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO_INST "(0x%04x) Exec 0x%x - LD B, A\n", registers.pc, inst);
-        }
-#endif
-        registers.b = registers.a;
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO "Load A(0x%x) in B\n", registers.a);
-        }
-#endif
-        registers.pc++;
-        clock_cycles = 4;
-        break;
+INST_HANDLER(inst_ld_d_ind_hl)
+{
+    regs->d = memory_read_8(regs->hl);
+    return 0;
+}
 
-    case 0x4f: // LD C, A
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO_INST "(0x%04x) Exec 0x%x - LD C, A\n", registers.pc, inst);
-        }
-#endif
-        registers.c = registers.a;
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO "Load A(0x%x) in C\n", registers.a);
-        }
-#endif
-        registers.pc++;
-        clock_cycles = 4;
-        break;
+INST_HANDLER(inst_ld_e_ind_hl)
+{
+    regs->e = memory_read_8(regs->hl);
+    return 0;
+}
 
-    case 0x50: // LD D, B
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO_INST "(0x%04x) Exec 0x%x - LD D, B\n", registers.pc, inst);
-        }
-#endif
-        registers.d = registers.b;
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO "Load B(0x%x) in D\n", registers.a);
-        }
-#endif
-        registers.pc++;
-        clock_cycles = 4;
-        break;
+INST_HANDLER(inst_ld_e_a)
+{
+    regs->e = regs->a;
+    return 0;
+}
 
-    case 0x56: // LD D, (HL)
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO_INST "(0x%04x) Exec 0x%x - LD D, (HL)\n", registers.pc, inst);
-        }
-#endif
-        registers.d = memory_read_8(registers.hl);
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO "Load *HL(0x%x) in D(0x%x)\n", registers.hl, registers.d);
-        }
-#endif
-        registers.pc++;
-        clock_cycles = 8;
-        break;
+INST_HANDLER(inst_ld_h_a)
+{
+    regs->h = regs->a;
+    return 0;
+}
 
-    case 0x5e: // LD E, (HL)
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO_INST "(0x%04x) Exec 0x%x - LD E, (HL)\n", registers.pc, inst);
-        }
-#endif
-        registers.e = memory_read_8(registers.hl);
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO "Load *HL(0x%x) in E(0x%x)\n", registers.hl, registers.e);
-        }
-#endif
-        registers.pc++;
-        clock_cycles = 8;
-        break;
+INST_HANDLER(inst_ld_l_a)
+{
+    regs->l = regs->a;
+    return 0;
+}
 
-    case 0x5f: // LD E, A
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO_INST "(0x%04x) Exec 0x%x - LD E, A\n", registers.pc, inst);
-        }
-#endif
-        registers.e = registers.a;
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO "Load A(0x%x) in E\n", registers.a);
-        }
-#endif
-        registers.pc++;
-        clock_cycles = 4;
-        break;
+INST_HANDLER(inst_ld_ind_hl_b)
+{
+    memory_write_8(regs->hl, regs->b);
+    return 0;
+}
 
-    case 0x67: // LD H, A
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO_INST "(0x%04x) Exec 0x%x - LD H, A\n", registers.pc, inst);
-        }
-#endif
-        registers.h = registers.a;
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO "Load A(0x%x) in H\n", registers.a);
-        }
-#endif
-        registers.pc++;
-        clock_cycles = 4;
-        break;
+INST_HANDLER(inst_halt)
+{
+    interrupt_halt();
+    return 0;
+}
 
-    case 0x6f: // LD L, A
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO_INST "(0x%04x) Exec 0x%x - LD L, A\n", registers.pc, inst);
-        }
-#endif
-        registers.l = registers.a;
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO "Load A(0x%x) in L\n", registers.a);
-        }
-#endif
-        registers.pc++;
-        clock_cycles = 4;
-        break;
+INST_HANDLER(inst_ld_a_b)
+{
+    regs->a = regs->b;
+    return 0;
+}
 
-    case 0x70: // LD (HL), B
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO_INST "(0x%04x) Exec 0x%x - LD (HL), B\n", registers.pc, inst);
-        }
-#endif
-        memory_write_8(registers.hl, registers.b);
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO "Save B(0x%x) to *HL(0x%x)\n", registers.b, registers.hl);
-        }
-#endif
-        registers.pc++;
-        clock_cycles = 8;
-        break;
+INST_HANDLER(inst_ld_a_c)
+{
+    regs->a = regs->c;
+    return 0;
+}
 
-    case 0x78: // LD A, B
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO_INST "(0x%04x) Exec 0x%x - LD A, B\n", registers.pc, inst);
-        }
-#endif
-        registers.a = registers.b;
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO "Load B(0x%x) in A\n", registers.b);
-        }
-#endif
-        registers.pc++;
-        clock_cycles = 4;
-        break;
+INST_HANDLER(inst_ld_a_h)
+{
+    regs->a = regs->h;
+    return 0;
+}
 
-    case 0x79: // LD A, C
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO_INST "(0x%04x) Exec 0x%x - LD A, C\n", registers.pc, inst);
-        }
-#endif
-        registers.a = registers.c;
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO "Load C(0x%x) in A\n", registers.c);
-        }
-#endif
-        registers.pc++;
-        clock_cycles = 4;
-        break;
+INST_HANDLER(inst_ld_a_l)
+{
+    regs->a = regs->l;
+    return 0;
+}
 
-    case 0x7c: // LD A, H
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO_INST "(0x%04x) Exec 0x%x - LD A, H\n", registers.pc, inst);
-        }
-#endif
-        registers.a = registers.h;
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO "Load H(0x%x) in A\n", registers.h);
-        }
-#endif
-        registers.pc++;
-        clock_cycles = 4;
-        break;
+INST_HANDLER(inst_ld_a_ind_hl)
+{
+    regs->a = memory_read_8(regs->hl);
+    return 0;
+}
 
-    case 0x7d: // LD A, L
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO_INST "(0x%04x) Exec 0x%x - LD A, L\n", registers.pc, inst);
-        }
-#endif
-        registers.a = registers.l;
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO "Load L(0x%x) in A\n", registers.l);
-        }
-#endif
-        registers.pc++;
-        clock_cycles = 4;
-        break;
+INST_HANDLER(inst_ld_a_a)
+{
+    return 0;
+}
 
-    case 0x7e: // LD A, (HL)
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO_INST "(0x%04x) Exec 0x%x - LD A, (HL)\n", registers.pc, inst);
-        }
-#endif
-        registers.a = memory_read_8(registers.hl);
+INST_HANDLER(inst_add_a_b)
+{
+    add_a(regs, regs->b);
+    return 0;
+}
 
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO "Load *HL(0x%x) in A(0x%x)\n", registers.hl, registers.a);
-        }
-#endif
-        registers.pc++;
-        clock_cycles = 8;
-        break;
+INST_HANDLER(inst_add_a_c)
+{
+    add_a(regs, regs->c);
+    return 0;
+}
 
-    case 0x7f: // LD A, A
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO_INST "(0x%04x) Exec 0x%x - LD A, A\n", registers.pc, inst);
-        }
-#endif
-        registers.a = registers.a;
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO "Load A(0x%x) in A\n", registers.a);
-        }
-#endif
-        registers.pc++;
-        clock_cycles = 4;
-        break;
+INST_HANDLER(inst_add_a_a)
+{
+    add_a(regs, regs->a);
+    return 0;
+}
 
-    case 0x80: // ADD A, B
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO_INST "(0x%04x) Exec 0x%x - ADD A, B\n", registers.pc, inst);
-        }
-#endif
-        registers.f = 0;
-        if (HAS_HALF_CARRY_ON_ADD(registers.a, registers.b))
-            SET_BIT(registers.f, FLAG_H);
-        if (((uint16_t)registers.a + (uint16_t)registers.b) > 0xff)
-            SET_BIT(registers.f, FLAG_C);
+INST_HANDLER(inst_sub_a)
+{
+    regs->a = compare_a(regs, regs->a) & 0xff;
+    return 0;
+}
 
-        registers.a += registers.b;
+INST_HANDLER(inst_and_c)
+{
+    and_a(regs, regs->c);
+    return 0;
+}
 
-        if (!registers.a)
-            SET_BIT(registers.f, FLAG_Z);
+INST_HANDLER(inst_and_a)
+{
+    and_a(regs, regs->a);
+    return 0;
+}
 
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO "Set A to 0x%x\n", registers.a);
-            print_flags();
-        }
-#endif
-        registers.pc++;
-        clock_cycles = 4;
-        break;
+INST_HANDLER(inst_xor_c)
+{
+    xor_a(regs, regs->c);
+    return 0;
+}
 
-    case 0x81: // ADD A, C
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO_INST "(0x%04x) Exec 0x%x - ADD A, C\n", registers.pc, inst);
-        }
-#endif
-        registers.f = 0;
-        if (HAS_HALF_CARRY_ON_ADD(registers.a, registers.c))
-            SET_BIT(registers.f, FLAG_H);
-        if (((uint16_t)registers.a + (uint16_t)registers.c) > 0xff)
-            SET_BIT(registers.f, FLAG_C);
+INST_HANDLER(inst_xor_a)
+{
+    xor_a(regs, regs->a);
+    return 0;
+}
 
-        registers.a += registers.c;
+INST_HANDLER(inst_or_b)
+{
+    or_a(regs, regs->b);
+    return 0;
+}
 
-        if (!registers.a)
-            SET_BIT(registers.f, FLAG_Z);
+INST_HANDLER(inst_or_c)
+{
+    or_a(regs, regs->c);
+    return 0;
+}
 
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO "Set A to 0x%x\n", registers.a);
-            print_flags();
-        }
-#endif
-        registers.pc++;
-        clock_cycles = 4;
-        break;
+INST_HANDLER(inst_cp_a)
+{
+    compare_a(regs, regs->a);
+    return 0;
+}
 
-    case 0x87: // ADD A, A
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO_INST "(0x%04x) Exec 0x%x - ADD A, A\n", registers.pc, inst);
-        }
-#endif
-        registers.f = 0;
-        if (HAS_HALF_CARRY_ON_ADD(registers.a, registers.a))
-            SET_BIT(registers.f, FLAG_H);
-        if (((uint16_t)registers.a + (uint16_t)registers.a) > 0xff)
-            SET_BIT(registers.f, FLAG_C);
+INST_HANDLER(inst_pop_bc)
+{
+    regs->bc = pop_16(regs);
+    return 0;
+}
 
-        registers.a += registers.a;
+INST_HANDLER(inst_jp)
+{
+    regs->pc = operand;
+    return 0;
+}
 
-        if (!registers.a)
-            SET_BIT(registers.f, FLAG_Z);
+INST_HANDLER(inst_call_nz)
+{
+    if (get_flag_z(regs))
+        return 0;
 
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO "Set A to 0x%x\n", registers.a);
-            print_flags();
-        }
-#endif
-        registers.pc++;
-        clock_cycles = 4;
-        break;
+    push_16(regs, regs->pc);
+    regs->pc = operand;
+    return opcode_branch_cycles[opcode];
+}
 
-    case 0x97: // SUB A
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO_INST "(0x%04x) Exec 0x%x - SUB A\n", registers.pc, inst);
-        }
-#endif
-        sub = (int16_t)registers.a - (int16_t)registers.a;
+INST_HANDLER(inst_push_bc)
+{
+    push_16(regs, regs->bc);
+    return 0;
+}
 
-        SET_BIT(registers.f, FLAG_N);
-        if (!sub)
-            SET_BIT(registers.f, FLAG_Z);
-        else
-            CLEAR_BIT(registers.f, FLAG_Z);
-        if (HAS_HALF_CARRY_ON_SUB(registers.a, sub))
-            SET_BIT(registers.f, FLAG_H);
-        else
-            CLEAR_BIT(registers.f, FLAG_H);
-        if (sub < 0)
-            SET_BIT(registers.f, FLAG_C);
-        else
-            CLEAR_BIT(registers.f, FLAG_C);
+INST_HANDLER(inst_ret_z)
+{
+    if (!get_flag_z(regs))
+        return 0;
 
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO "SUB A(0x%x) to A(0x%x)\n", registers.a, registers.a);
-            print_flags();
-        }
-#endif
-        registers.a = (sub & 0xff);
+    regs->pc = pop_16(regs);
+    return opcode_branch_cycles[opcode];
+}
 
-        registers.pc++;
-        clock_cycles = 4;
-        break;
+INST_HANDLER(inst_ret)
+{
+    regs->pc = pop_16(regs);
+    return 0;
+}
 
-    case 0xa1: // AND A, C
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO_INST "(0x%04x) Exec 0x%x - AND A, C\n", registers.pc, inst);
-        }
-#endif
-        registers.a &= registers.c;
-        registers.f = 0;
-        SET_BIT(registers.f, FLAG_H);
-        if (!registers.a)
-            SET_BIT(registers.f, FLAG_Z);
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO "Set A to 0x%x\n", registers.a);
-            print_flags();
-        }
-#endif
-        registers.pc++;
-        clock_cycles = 4;
-        break;
+INST_HANDLER(inst_jp_z)
+{
+    if (!get_flag_z(regs))
+        return 0;
 
-    case 0xa7: // AND A, A
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO_INST "(0x%04x) Exec 0x%x - AND A, A\n", registers.pc, inst);
-        }
-#endif
-        registers.a &= registers.a;
-        registers.f = 0;
-        SET_BIT(registers.f, FLAG_H);
-        if (!registers.a)
-            SET_BIT(registers.f, FLAG_Z);
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO "Set A to 0x%x\n", registers.a);
-            print_flags();
-        }
-#endif
-        registers.pc++;
-        clock_cycles = 4;
-        break;
+    regs->pc = operand;
+    return opcode_branch_cycles[opcode];
+}
 
-    case 0xa9: // XOR A, C
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO_INST "(0x%04x) Exec 0x%x - XOR A, C\n", registers.pc, inst);
-        }
-#endif
-        registers.a ^= registers.c;
-        registers.f = 0;
-        if (!registers.a)
-            SET_BIT(registers.f, FLAG_Z);
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO "Set A to 0x%x\n", registers.a);
-            print_flags();
-        }
-#endif
-        registers.pc++;
-        clock_cycles = 4;
-        break;
+static const cpu_handler_t cb_opcode_handlers[256];
+static const uint8_t cb_opcode_cycles[256];
 
-    case 0xaf: // XOR A, A
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO_INST "(0x%04x) Exec 0x%x - XOR A, A\n", registers.pc, inst);
-        }
-#endif
-        registers.a = 0;
-        registers.f = 0;
-        if (!registers.a)
-            SET_BIT(registers.f, FLAG_Z);
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO "Set A to 0x0\n");
-            print_flags();
-        }
-#endif
-        registers.pc++;
-        clock_cycles = 4;
-        break;
+INST_HANDLER(inst_prefix_cb)
+{
+    cb_opcode_handlers[operand](regs, operand, 0);
+    return cb_opcode_cycles[operand] - opcode_cycles[opcode];
+}
+
+INST_HANDLER(inst_call)
+{
+    push_16(regs, regs->pc);
+    regs->pc = operand;
+    return 0;
+}
+
+INST_HANDLER(inst_pop_de)
+{
+    regs->de = pop_16(regs);
+    return 0;
+}
+
+INST_HANDLER(inst_push_de)
+{
+    push_16(regs, regs->de);
+    return 0;
+}
+
+INST_HANDLER(inst_reti)
+{
+    regs->pc = pop_16(regs);
+    interrupt_set_ime(true);
+    return 0;
+}
 
-    case 0xb0: // OR B, A
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO_INST "(0x%04x) Exec 0x%x - OR B, A\n", registers.pc, inst);
-        }
-#endif
-        registers.a |= registers.b;
-        registers.f = 0;
-        if (!registers.a)
-            SET_BIT(registers.f, FLAG_Z);
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO "Set A to 0x%x\n", registers.a);
-            print_flags();
-        }
-#endif
-        registers.pc++;
-        clock_cycles = 4;
-        break;
+INST_HANDLER(inst_ldh_ind_nn_a)
+{
+    memory_write_8(MEMORY_IO_START_ADDR + operand, regs->a);
+    return 0;
+}
 
-    case 0xb1: // OR C, A
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO_INST "(0x%04x) Exec 0x%x - OR C, A\n", registers.pc, inst);
-        }
-#endif
-        registers.a |= registers.c;
-        registers.f = 0;
-        if (!registers.a)
-            SET_BIT(registers.f, FLAG_Z);
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO "Set A to 0x%x\n", registers.a);
-            print_flags();
-        }
-#endif
-        registers.pc++;
-        clock_cycles = 4;
-        break;
+INST_HANDLER(inst_pop_hl)
+{
+    regs->hl = pop_16(regs);
+    return 0;
+}
 
-    case 0xbf: // CP A
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO_INST "(0x%04x) Exec 0x%x - CP A\n", registers.pc, inst);
-        }
-#endif
-        int16_t cmp = registers.a - registers.a;
+INST_HANDLER(inst_ldh_ind_c_a)
+{
+    memory_write_8(MEMORY_IO_START_ADDR + regs->c, regs->a);
+    return 0;
+}
 
-        SET_BIT(registers.f, FLAG_N);
-        if (!cmp)
-            SET_BIT(registers.f, FLAG_Z);
-        else
-            CLEAR_BIT(registers.f, FLAG_Z);
-        if (HAS_HALF_CARRY_ON_SUB(registers.a, cmp))
-            SET_BIT(registers.f, FLAG_H);
-        else
-            CLEAR_BIT(registers.f, FLAG_H);
-        if (cmp < 0)
-            SET_BIT(registers.f, FLAG_C);
-        else
-            CLEAR_BIT(registers.f, FLAG_C);
+INST_HANDLER(inst_push_hl)
+{
+    push_16(regs, regs->hl);
+    return 0;
+}
 
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            print_flags();
-        }
-#endif
+INST_HANDLER(inst_and_nn)
+{
+    and_a(regs, operand);
+    return 0;
+}
 
-        registers.pc++;
-        clock_cycles = 4;
-        break;
+INST_HANDLER(inst_jp_hl)
+{
+    regs->pc = regs->hl;
+    return 0;
+}
 
-    case 0xc1: // POP BC - RR=(SP), SP=SP+2
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO_INST "(0x%04x) Exec 0x%x - POP BC\n", registers.pc, inst);
-        }
-#endif
-        registers.bc = memory_read_16(registers.sp);
-        registers.sp += 2;
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO "Pop 0x%x in BC\n", registers.bc);
-        }
-#endif
-        registers.pc++;
-        clock_cycles = 12;
-        break;
+INST_HANDLER(inst_ld_ind_nnnn_a)
+{
+    memory_write_8(operand, regs->a);
+    return 0;
+}
 
-    case 0xc3: // JP nnnn
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO_INST "(0x%04x) Exec 0x%x - JP nnnn\n", registers.pc, inst);
-        }
-#endif
-        registers.pc = memory_read_16(registers.pc + 1);
+INST_HANDLER(inst_rst_28)
+{
+    push_16(regs, regs->pc);
+    regs->pc = MEMORY_RST_28;
+    return 0;
+}
 
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO "Jump at 0x%x\n", registers.pc);
-        }
-#endif
-        clock_cycles = 16;
-        break;
+INST_HANDLER(inst_ldh_a_ind_nn)
+{
+    regs->a = memory_read_8(MEMORY_IO_START_ADDR + operand);
+    return 0;
+}
 
-    case 0xc4: // call NZ, nnnn  , SP=SP-2, (SP)=PC, PC=nnnn
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO_INST "(0x%04x) Exec 0x%x - call NZ, nnnn    , SP=SP-2, (SP)=PC, PC=nnnn\n", registers.pc, inst);
-        }
-#endif
-        call_addr = memory_read_16(registers.pc + 1);
+INST_HANDLER(inst_pop_af)
+{
+    regs->af = pop_16(regs);
+    load_flags(regs, regs->f);
+    return 0;
+}
 
-        if (!CHECK_BIT(registers.f, FLAG_Z))
-        {
-            registers.sp -= 2;
-            memory_write_16(registers.sp, registers.pc + 3);
-            registers.pc = call_addr;
-#ifdef DEBUG
-            if (verbose & VERBOSE_CPU)
-            {
-                fprintf(stderr, P_INFO "Save PC(0x%x) at 0x%x\n", memory_read_16(registers.sp), registers.sp);
-                fprintf(stderr, P_INFO "Call to 0x%x\n", registers.pc);
-            }
-#endif
-            clock_cycles = 24;
-        }
-        else
-        {
-#ifdef DEBUG
-            if (verbose & VERBOSE_CPU)
-            {
-                fprintf(stderr, P_INFO "No call\n");
-            }
-#endif
-            registers.pc += 3;
-            clock_cycles = 12;
-        }
-        break;
+INST_HANDLER(inst_di)
+{
+    interrupt_set_ime(false);
+    return 0;
+}
 
-    case 0xc5: // PUSH BC - SP=SP-2, (SP)=rr
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO_INST "(0x%04x) Exec 0x%x - PUSH BC\n", registers.pc, inst);
-        }
-#endif
-        registers.sp -= 2;
-        memory_write_16(registers.sp, registers.bc);
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO "PUSH BC(0x%x) at SP(0x%x)\n", registers.bc, registers.sp);
-        }
-#endif
-        registers.pc++;
-        clock_cycles = 16;
-        break;
+INST_HANDLER(inst_push_af)
+{
+    push_16(regs, regs->a << 8 | get_flags(regs));
+    return 0;
+}
 
-    case 0xc8: // RET Z, PC=(SP), SP=SP+2
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO_INST "(0x%04x) Exec 0x%x - RET Z, PC=(SP), SP=SP+2\n", registers.pc, inst);
-        }
-#endif
-        if (CHECK_BIT(registers.f, FLAG_Z))
-        {
-            clock_cycles = 20;
-            registers.pc = memory_read_16(registers.sp);
-            registers.sp += 2;
+INST_HANDLER(inst_ld_a_ind_nnnn)
+{
+    regs->a = memory_read_8(operand);
+    return 0;
+}
 
-#ifdef DEBUG
-            if (verbose & VERBOSE_CPU)
-            {
-                fprintf(stderr, P_INFO "RET to 0x%x\n", registers.pc);
-                fprintf(stderr, P_INFO "Set SP to 0x%x\n", registers.sp);
-            }
-#endif
-        }
-        else
-        {
-            clock_cycles = 8;
-            registers.pc++;
-#ifdef DEBUG
-            if (verbose & VERBOSE_CPU)
-            {
-                fprintf(stderr, P_INFO "No Ret\n");
-            }
-#endif
-        }
+INST_HANDLER(inst_ei)
+{
+    interrupt_enable_delayed();
+    return 0;
+}
 
-        break;
+INST_HANDLER(inst_cp_nn)
+{
+    compare_a(regs, operand);
+    return 0;
+}
 
-    case 0xc9: // RET, PC=(SP), SP=SP+2
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO_INST "(0x%04x) Exec 0x%x - RET, PC=(SP), SP=SP+2\n", registers.pc, inst);
-        }
-#endif
-        registers.pc = memory_read_16(registers.sp);
-        registers.sp += 2;
+INST_HANDLER(inst_rst_38)
+{
+    push_16(regs, regs->pc);
+    regs->pc = MEMORY_RST_38;
+    return 0;
+}
 
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO "RET to 0x%x\n", registers.pc);
-            fprintf(stderr, P_INFO "Set SP to 0x%x\n", registers.sp);
-        }
-#endif
-        clock_cycles = 16;
-        break;
+/*
+    Fused pairs (CPU_FUSED_PAIRS in opcodes.h)
+    The operands of both instructions are packed in the operand of the entry,
+    the first one in the low byte. The clock is moved past the first
+    instruction while the second one runs, so its bus accesses (the writes
+    through HL or DE may reach the VRAM, the OAM or a synchronized I/O
+    register) happen at the same cycle as without fusion.
+*/
+#define FUSED_NAME(first, second) inst_fused_##first##_##second
+
+// PC is already past both instructions, the handlers of the relative jumps
+// only look behind the second one. The caller adds the cycles of the whole
+// entry, so the clock is put back after the second instruction.
+#define FUSED_HANDLER(first, first_handler, second, second_handler, mnemonic)            \
+    INST_HANDLER(FUSED_NAME(first, second))                                              \
+    {                                                                                    \
+        uint8_t shift = (opcode_lengths[first] - 1) * 8;                                 \
+        uint8_t cycles = first_handler(regs, first, operand & ((1U << shift) - 1));      \
+        uint8_t first_cycles = opcode_cycles[first] + cycles;                            \
+        scheduler_clock += first_cycles;                                                 \
+        cycles += second_handler(regs, second, operand >> shift);                        \
+        scheduler_clock -= first_cycles;                                                 \
+        return cycles;                                                                   \
+    }
 
-    case 0xca: // JP Z, nnnn
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO_INST "(0x%04x) Exec 0x%x - JP Z, nnnn\n", registers.pc, inst);
-        }
-#endif
-        clock_cycles = 12;
-        if (CHECK_BIT(registers.f, FLAG_Z))
-        {
-            clock_cycles = 16;
-            registers.pc = memory_read_16(registers.pc + 1);
-#ifdef DEBUG
-            if (verbose & VERBOSE_CPU)
-            {
-                fprintf(stderr, P_INFO "Jump at 0x%x\n", registers.pc);
-            }
-#endif
-        }
-        else
-        {
-            registers.pc += 3;
-#ifdef DEBUG
-            if (verbose & VERBOSE_CPU)
-            {
-                fprintf(stderr, P_INFO "No Jump\n");
-            }
-#endif
-        }
-        break;
+CPU_FUSED_PAIRS(FUSED_HANDLER)
+
+#define OPCODE_HANDLER(opcode, handler, ...) [opcode] = handler,
+#define OPCODE_LENGTH(opcode, handler, operand, ...) [opcode] = OPERAND_LENGTH(operand),
+#define OPCODE_OPERAND(opcode, handler, operand, ...) [opcode] = operand,
+#define OPCODE_CYCLES(opcode, handler, operand, cycles, ...) [opcode] = cycles,
+#define OPCODE_TAKEN_CYCLES(opcode, handler, operand, cycles, taken_cycles, ...) [opcode] = taken_cycles,
+#define OPCODE_BRANCH_CYCLES(opcode, handler, operand, cycles, taken_cycles, ...) [opcode] = taken_cycles - cycles,
+#define OPCODE_FLAGS(opcode, handler, operand, cycles, taken_cycles, flags, mnemonic) [opcode] = flags,
+#define OPCODE_MNEMONIC(opcode, handler, operand, cycles, taken_cycles, flags, mnemonic) [opcode] = mnemonic,
+#define CB_OPCODE_CYCLES(opcode, handler, cycles, ...) [opcode] = cycles,
+#define CB_OPCODE_FLAGS(opcode, handler, cycles, flags, mnemonic) [opcode] = flags,
+#define CB_OPCODE_MNEMONIC(opcode, handler, cycles, flags, mnemonic) [opcode] = mnemonic,
+
+static const uint8_t opcode_lengths[256] = {CPU_OPCODES(OPCODE_LENGTH)};
+static const uint8_t opcode_operands[256] = {CPU_OPCODES(OPCODE_OPERAND)};
+static const uint8_t opcode_cycles[256] = {CPU_OPCODES(OPCODE_CYCLES)};
+static const uint8_t opcode_taken_cycles[256] = {CPU_OPCODES(OPCODE_TAKEN_CYCLES)};
+static const uint8_t opcode_branch_cycles[256] = {CPU_OPCODES(OPCODE_BRANCH_CYCLES)};
+static const cpu_handler_t opcode_handlers[256] = {CPU_OPCODES(OPCODE_HANDLER)};
+static const cpu_handler_t cb_opcode_handlers[256] = {CPU_CB_OPCODES(OPCODE_HANDLER)};
+static const uint8_t cb_opcode_cycles[256] = {CPU_CB_OPCODES(CB_OPCODE_CYCLES)};
+static const char *const opcode_flags[256] = {CPU_OPCODES(OPCODE_FLAGS)};
+static const char *const opcode_mnemonics[256] = {CPU_OPCODES(OPCODE_MNEMONIC)};
+static const char *const cb_opcode_flags[256] = {CPU_CB_OPCODES(CB_OPCODE_FLAGS)};
+static const char *const cb_opcode_mnemonics[256] = {CPU_CB_OPCODES(CB_OPCODE_MNEMONIC)};
+
+typedef struct
+{
+    uint8_t first;
+    uint8_t second;
+    cpu_handler_t handler;
+} cpu_fused_pair_t;
 
-    case 0xcb: // CB nn
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO_INST "(0x%04x) Exec 0x%x - CB NN\n", registers.pc, inst);
-        }
-#endif
-        cb_inst = memory_read_8(registers.pc + 1);
-        clock_cycles = handle_cb_inst(cb_inst);
+#define FUSED_INDEX(first, first_handler, second, second_handler, mnemonic) FUSED_INDEX_##first##_##second,
+#define FUSED_PAIR(first, first_handler, second, second_handler, mnemonic) \
+    [FUSED_INDEX_##first##_##second] = {first, second, FUSED_NAME(first, second)},
 
-        registers.pc += 2;
-        break;
+enum
+{
+    FUSED_INDEX_NONE = FUSION_NONE,
+    CPU_FUSED_PAIRS(FUSED_INDEX)
+    NB_FUSED_PAIRS
+};
 
-    case 0xcd: // call nnnn, SP=SP-2, (SP)=PC, PC=nnnn
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO_INST "(0x%04x) Exec 0x%x - call nnnn, SP=SP-2, (SP)=PC, PC=nnnn\n", registers.pc, inst);
-        }
-#endif
-        call_addr = memory_read_16(registers.pc + 1);
-        registers.sp -= 2;
-        memory_write_16(registers.sp, registers.pc + 3);
-        registers.pc = call_addr;
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO "Save PC(0x%x) at 0x%x\n", memory_read_16(registers.sp), registers.sp);
-            fprintf(stderr, P_INFO "Call to 0x%x\n", registers.pc);
-        }
-#endif
-        clock_cycles = 24;
+static const cpu_fused_pair_t fused_pairs[NB_FUSED_PAIRS] = {CPU_FUSED_PAIRS(FUSED_PAIR)};
+
+static inline uint16_t fetch_operand(uint16_t pc, uint8_t length)
+{
+    if (length == 3)
+        return memory_read_16(pc + 1);
+    if (length == 2)
+        return memory_read_8(pc + 1);
+    return 0;
+}
+
+/*
+    Disassembler
+    The nn or nnnn placeholder of the mnemonic is replaced by the operand,
+    relative jumps show their target
+*/
+uint8_t cpu_disassemble(uint16_t addr, char *text, size_t size)
+{
+    uint8_t opcode = memory_read_8(addr);
+    uint8_t length = opcode_lengths[opcode];
+    uint16_t operand = fetch_operand(addr, length);
+    const char *mnemonic = opcode_mnemonics[opcode];
+    const char *placeholder = strstr(mnemonic, "nn");
+    char value[8];
+
+    switch (opcode_operands[opcode])
+    {
+    case OPERAND_D8:
+    case OPERAND_A8:
+        snprintf(value, sizeof(value), "0x%02x", operand);
         break;
 
-    case 0xd1: // POP DE - RR=(SP), SP=SP+2
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO_INST "(0x%04x) Exec 0x%x - POP DE\n", registers.pc, inst);
-        }
-#endif
-        registers.de = memory_read_16(registers.sp);
-        registers.sp += 2;
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO "Pop 0x%x in DE\n", registers.de);
-        }
-#endif
-        registers.pc++;
-        clock_cycles = 12;
+    case OPERAND_S8:
+        // SP+nn becomes SP+2 or SP-2
+        if (placeholder > mnemonic && placeholder[-1] == '+')
+            placeholder--;
+        snprintf(value, sizeof(value), placeholder[0] == '+' ? "%+d" : "%d", (int8_t)operand);
         break;
 
-    case 0xd5: // PUSH DE - SP=SP-2, (SP)=rr
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO_INST "(0x%04x) Exec 0x%x - PUSH DE\n", registers.pc, inst);
-        }
-#endif
-        registers.sp -= 2;
-        memory_write_16(registers.sp, registers.de);
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO "PUSH DE(0x%x) at SP(0x%x)\n", registers.de, registers.sp);
-        }
-#endif
-        registers.pc++;
-        clock_cycles = 16;
+    case OPERAND_R8:
+        snprintf(value, sizeof(value), "0x%04x", (uint16_t)(addr + length + (int8_t)operand));
         break;
 
-    case 0xe0: // LD (FF00+nn),A
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO_INST "(0x%04x) Exec 0x%x - LD (FF00+nn),A\n", registers.pc, inst);
-        }
-#endif
-        offset = memory_read_8(registers.pc + 1);
-        memory_write_8(MEMORY_IO_START_ADDR + offset, registers.a);
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO "Save A(0x%x) at 0x%x\n", registers.a, MEMORY_IO_START_ADDR + offset);
-        }
-#endif
-        registers.pc += 2;
-        clock_cycles = 12;
+    case OPERAND_D16:
+    case OPERAND_A16:
+        snprintf(value, sizeof(value), "0x%04x", operand);
         break;
 
-    case 0xe1: // POP HL - RR=(SP), SP=SP+2
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO_INST "(0x%04x) Exec 0x%x - POP HL\n", registers.pc, inst);
-        }
-#endif
-        registers.hl = memory_read_16(registers.sp);
-        registers.sp += 2;
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO "Pop 0x%x in HL\n", registers.hl);
-        }
-#endif
-        registers.pc++;
-        clock_cycles = 12;
+    case OPERAND_CB:
+        mnemonic = cb_opcode_mnemonics[operand];
+        // Fallthrough
+    default:
+        placeholder = NULL;
         break;
+    }
+
+    if (placeholder == NULL)
+    {
+        snprintf(text, size, "%s", mnemonic);
+    }
+    else
+    {
+        const char *rest = placeholder + (placeholder[0] == '+') + (length == 3 ? 4 : 2);
+        snprintf(text, size, "%.*s%s%s", (int)(placeholder - mnemonic), mnemonic, value, rest);
+    }
+
+    return length;
+}
+
+static const char *get_flags_effect(uint16_t addr)
+{
+    uint8_t opcode = memory_read_8(addr);
+
+    if (opcode_operands[opcode] == OPERAND_CB)
+        return cb_opcode_flags[memory_read_8(addr + 1)];
+    return opcode_flags[opcode];
+}
+
+static void print_disassembly(uint16_t addr, uint16_t nb_inst)
+{
+    for (uint16_t i = 0; i < nb_inst; i++)
+    {
+        char text[DISASSEMBLY_MAX_SIZE];
+        uint8_t length = cpu_disassemble(addr, text, DISASSEMBLY_MAX_SIZE);
+
+        // Flags in the Z N H C order, see opcodes.h
+        fprintf(stderr, "0x%04x: %-24s %s\n", addr, text, get_flags_effect(addr));
+        addr += length;
+    }
+}
+
+// Control flow, interrupt state changes and unimplemented instructions end a block
+static bool is_block_end(uint8_t opcode)
+{
+    if (opcode_ends_block(opcode))
+        return true;
+
+    return opcode_handlers[opcode] == inst_unimplemented;
+}
 
+// A write may hit an I/O register, which can request an interrupt or bring
+// an event closer, or the code itself
+static bool is_memory_write(uint8_t opcode, uint16_t operand)
+{
+    switch (opcode)
+    {
+    case 0x02: // LD (BC), A
+    case 0x08: // LD (nnnn), SP
+    case 0x12: // LD (DE), A
+    case 0x22: // LDI (HL), A
+    case 0x32: // LDD (HL), A
+    case 0x34: // INC (HL)
+    case 0x35: // DEC (HL)
+    case 0x36: // LD (HL), nn
+    case 0xc5: // PUSH
+    case 0xd5:
+    case 0xe5:
+    case 0xf5:
+    case 0xe0: // LD (FF00+nn), A
     case 0xe2: // LD (FF00+C), A
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO_INST "(0x%04x) Exec 0x%x - LD (FF00+C),A\n", registers.pc, inst);
-        }
-#endif
-        memory_write_8(MEMORY_IO_START_ADDR + registers.c, registers.a);
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO "Save A(0x%x) at 0x%x\n", registers.a, MEMORY_IO_START_ADDR + registers.c);
-        }
-#endif
-        registers.pc++;
-        clock_cycles = 8;
-        break;
+    case 0xea: // LD (nnnn), A
+        return true;
 
-    case 0xe5: // PUSH HL - SP=SP-2, (SP)=rr
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO_INST "(0x%04x) Exec 0x%x - PUSH HL\n", registers.pc, inst);
-        }
-#endif
-        registers.sp -= 2;
-        memory_write_16(registers.sp, registers.hl);
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO "PUSH HL(0x%x) at SP(0x%x)\n", registers.hl, registers.sp);
-        }
+    case 0xcb:
+        // Every operation on (HL) but BIT writes it back
+        return (operand & 0x07) == 0x06 && (operand < 0x40 || operand >= 0x80);
+    }
+
+    // LD (HL), r
+    return opcode >= 0x70 && opcode <= 0x77 && opcode != 0x76;
+}
+
+// Return the pair formed with the last decoded entry or FUSION_NONE
+static uint8_t find_fusion(UNUSED const cpu_block_t *block, UNUSED uint8_t opcode)
+{
+#ifdef CPU_NO_FUSION
+    return FUSION_NONE;
+#else
+    // Let the debugger step and stop on the second instruction
+    if (!block->nb_inst || tracing)
+        return FUSION_NONE;
+
+    const cpu_decoded_inst_t *last = &block->insts[block->nb_inst - 1];
+    if (last->fusion != FUSION_NONE)
+        return FUSION_NONE;
+
+    for (uint8_t i = FUSION_NONE + 1; i < NB_FUSED_PAIRS; i++)
+    {
+        if (fused_pairs[i].first == last->opcode && fused_pairs[i].second == opcode)
+            return i;
+    }
+    return FUSION_NONE;
 #endif
-        registers.pc++;
-        clock_cycles = 16;
-        break;
+}
 
-    case 0xe6: // AND nn, A=A & nn
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO_INST "(0x%04x) Exec 0x%x - AND nn, A=A & n\n", registers.pc, inst);
-        }
-#endif
-        registers.a &= memory_read_8(registers.pc + 1);
-        registers.f = 0;
-        SET_BIT(registers.f, FLAG_H);
-        if (!registers.a)
-            SET_BIT(registers.f, FLAG_Z);
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO "Set A to 0x%x\n", registers.a);
-            print_flags();
-        }
-#endif
-        registers.pc += 2;
-        clock_cycles = 8;
-        break;
+static void decode_block(cpu_block_t *block, uint16_t pc, uint8_t max_inst, bool in_page)
+{
+    uint32_t page_end = (pc / MEMORY_PAGE_SIZE + 1) * MEMORY_PAGE_SIZE;
 
-    case 0xe9: // JP HL
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO_INST "(0x%04x) Exec 0x%x - JP HL\n", registers.pc, inst);
-        }
+    block->pc = pc;
+    block->cycles = 0;
+    block->nb_inst = 0;
+    block->nb_fused = 0;
+    block->writes_memory = false;
+#ifdef CPU_JIT
+    block->heat = 0;
+    block->code = NULL;
 #endif
-        registers.pc = registers.hl;
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO "Jump to HL(0x%x)\n", registers.pc);
-            print_flags();
-        }
+#ifdef CPU_AOT
+    block->translation = NULL;
 #endif
-        clock_cycles = 4;
-        break;
 
-    case 0xea: // LD (nnnn), A
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO_INST "(0x%04x) Exec 0x%x - LD (nnnn), A\n", registers.pc, inst);
+    while (block->nb_inst < max_inst)
+    {
+        uint8_t opcode = memory_read_8(pc);
+        uint8_t length = opcode_lengths[opcode];
+        if (in_page && pc + length > page_end)
+            break;
+
+        uint16_t operand = fetch_operand(pc, length);
+        uint8_t fusion = find_fusion(block, opcode);
+        cpu_decoded_inst_t *inst;
+
+        if (fusion != FUSION_NONE)
+        {
+            // Merge into the last entry, which keeps its opcode
+            inst = &block->insts[block->nb_inst - 1];
+            inst->handler = fused_pairs[fusion].handler;
+            inst->operand |= operand << ((inst->length - 1) * 8);
+            inst->length += length;
+            inst->cycles += opcode_cycles[opcode];
+            inst->fusion = fusion;
+            inst->writes_memory |= is_memory_write(opcode, operand);
+            block->nb_fused++;
         }
-#endif
-        addr = memory_read_16(registers.pc + 1);
-        memory_write_8(addr, registers.a);
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
+        else
         {
-            fprintf(stderr, P_INFO "Save A(0x%x) at 0x%x\n", registers.a, addr);
+            inst = &block->insts[block->nb_inst];
+            inst->handler = opcode_handlers[opcode];
+            inst->operand = operand;
+            inst->opcode = opcode;
+            inst->length = length;
+            inst->cycles = opcode_cycles[opcode];
+            inst->fusion = FUSION_NONE;
+            inst->writes_memory = is_memory_write(opcode, operand);
+            block->nb_inst++;
         }
-#endif
-        registers.pc += 3;
-        clock_cycles = 16;
-        break;
 
-    case 0xef: // RST 28 - Call to 0x28, SP=SP-2, (SP)=PC, PC=nnnn
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO_INST "(0x%04x) Exec 0x%x - RST 28 - Call to 0x28\n", registers.pc, inst);
-        }
-#endif
+        block->cycles += opcode_taken_cycles[opcode];
+        pc += length;
 
-        registers.sp -= 2;
-        memory_write_16(registers.sp, registers.pc + 1);
-        registers.pc = MEMORY_RST_28;
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO "Save PC(0x%x) at 0x%x\n", memory_read_16(registers.sp), registers.sp);
-            fprintf(stderr, P_INFO "Call to 0x%x\n", registers.pc);
-        }
-#endif
-        clock_cycles = 16;
-        break;
+        if (is_block_end(opcode))
+            break;
+        block->writes_memory |= inst->writes_memory;
+    }
 
-    case 0xf0: // LD A,(FF00+nn)
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO_INST "(0x%04x) Exec 0x%x - LD A,(FF00+nn)\n", registers.pc, inst);
-        }
+    block->end_pc = pc;
+}
+
+#ifdef CPU_AOT
+uint8_t cpu_execute_opcode(cpu_registers_t *regs, uint8_t opcode, uint16_t operand)
+{
+    return opcode_handlers[opcode](regs, opcode, operand);
+}
+
+// The translation is keyed by ROM offset, so any bank mapped anywhere finds
+// its own blocks
+static aot_block_t find_translation(const cpu_block_t *block)
+{
+    if (aot_rom == NULL)
+        return NULL;
+
+    uint32_t rom_offset = block->host_page - aot_rom + block->pc % MEMORY_PAGE_SIZE;
+    uint32_t low = 0;
+    uint32_t high = aot_nb_entries;
+
+    while (low < high)
+    {
+        uint32_t middle = (low + high) / 2;
+        if (aot_entries[middle].rom_offset < rom_offset)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+
+    // The recompiler may have cut the block elsewhere
+    if (low < aot_nb_entries && aot_entries[low].rom_offset == rom_offset && aot_entries[low].end_pc == block->end_pc)
+        return aot_entries[low].run;
+    return NULL;
+}
 #endif
-        offset = memory_read_8(registers.pc + 1);
-        registers.a = memory_read_8(MEMORY_IO_START_ADDR + offset);
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO "Load 0x%x from 0x%x in A\n", registers.a, MEMORY_IO_START_ADDR + offset);
-        }
+
+static cpu_block_t *get_block(uint16_t pc)
+{
+    uint8_t page = pc / MEMORY_PAGE_SIZE;
+    const uint8_t *host_page = memory_read_pages[page];
+
+    // The other pages of the slow path (I/O, OAM, disabled RAM) are decoded
+    // at every execution
+    if (host_page == NULL && pc < MEMORY_HRAM_START_ADDR)
+    {
+        decode_block(&uncached_block, pc, 1, false);
+        return &uncached_block;
+    }
+
+    cpu_block_t *block = &block_cache[pc % BLOCK_CACHE_SIZE];
+    if (block->nb_inst && block->pc == pc && block->host_page == host_page)
+        return block;
+
+    decode_block(block, pc, BLOCK_MAX_INST, true);
+    if (!block->nb_inst)
+    {
+        // The first instruction crosses the end of the page
+        decode_block(&uncached_block, pc, 1, false);
+        return &uncached_block;
+    }
+    block->host_page = host_page;
+
+    // The ROM only changes with a bank switch, caught by the tag
+    if (pc >= MEMORY_VRAM_START_ADDR)
+        memory_watch_code_page(page);
+#ifdef CPU_AOT
+    else
+        block->translation = find_translation(block);
 #endif
-        registers.pc += 2;
-        clock_cycles = 12;
+
+    return block;
+}
+
+// False once a write dropped the block or switched the bank it comes from
+static inline bool is_block_current(const cpu_block_t *block)
+{
+    return block->nb_inst && memory_read_pages[block->pc / MEMORY_PAGE_SIZE] == block->host_page;
+}
+
+void cpu_invalidate_code_page(uint8_t page)
+{
+    // The blocks of a page sit in consecutive entries of the cache
+    cpu_block_t *blocks = &block_cache[(page * MEMORY_PAGE_SIZE) % BLOCK_CACHE_SIZE];
+
+    for (uint16_t i = 0; i < MEMORY_PAGE_SIZE; i++)
+    {
+        if (blocks[i].pc / MEMORY_PAGE_SIZE == page)
+            blocks[i].nb_inst = 0;
+    }
+}
+
+#ifdef CPU_JIT
+/*
+    Recompiler
+    Register loads and moves, 8 bits ALU operations, accesses through HL,
+    16 bits increments and jumps are translated to native code, every other
+    instruction calls its handler with PC already past it, exactly like the
+    interpreter. The halves of a fused pair are translated on their own.
+    A block may write to the bus: the store to a mapped page is as silent
+    as in the interpreter, after a write through the slow path or by a
+    handler the block stops where the interpreter would check the state.
+*/
+static const uint8_t jit_reg_16_offsets[4] = {
+    offsetof(cpu_registers_t, bc),
+    offsetof(cpu_registers_t, de),
+    offsetof(cpu_registers_t, hl),
+    offsetof(cpu_registers_t, sp),
+};
+
+// Operation field of the ALU opcodes, ADC and SBC go through their handler
+#define JIT_ALU_NONE -1
+static const int8_t jit_alu_ops[8] = {JIT_ALU_ADD, JIT_ALU_NONE, JIT_ALU_SUB, JIT_ALU_NONE, JIT_ALU_AND, JIT_ALU_XOR, JIT_ALU_OR, JIT_ALU_CP};
+static const uint8_t jit_alu_flags_kinds[6] = {
+    [JIT_ALU_ADD] = FLAGS_KIND_ADD,
+    [JIT_ALU_SUB] = FLAGS_KIND_SUB,
+    [JIT_ALU_AND] = FLAGS_KIND_AND,
+    [JIT_ALU_XOR] = FLAGS_KIND_LOGIC,
+    [JIT_ALU_OR] = FLAGS_KIND_LOGIC,
+    [JIT_ALU_CP] = FLAGS_KIND_SUB,
+};
+
+// Called by the compiled code after a write, True if the rest of the block
+// needs the checks of the interpreter
+static bool jit_must_exit(UNUSED cpu_registers_t *regs, const cpu_block_t *block, uint32_t remaining_cycles)
+{
+    return !is_block_current(block) || interrupt_pending || scheduler_clock + remaining_cycles > scheduler_deadline;
+}
+
+// Conditional jumps: Z is set when flags_result is 0, C is flags_carry
+static void compile_branch(uint8_t opcode, uint16_t target)
+{
+    uint8_t taken_cycles = opcode_branch_cycles[opcode];
+
+    switch ((opcode >> 3) & 0x03)
+    {
+    case 0: // NZ
+        jit_emit_branch(offsetof(cpu_registers_t, flags_result), false, target, taken_cycles);
+        break;
+    case 1: // Z
+        jit_emit_branch(offsetof(cpu_registers_t, flags_result), true, target, taken_cycles);
+        break;
+    case 2: // NC
+        jit_emit_branch(offsetof(cpu_registers_t, flags_carry), true, target, taken_cycles);
         break;
+    case 3: // C
+        jit_emit_branch(offsetof(cpu_registers_t, flags_carry), false, target, taken_cycles);
+        break;
+    }
+}
 
-    case 0xf1: // POP AF - RR=(SP), SP=SP+2
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
+// Return False if the instruction has to go through its handler
+static bool compile_inline(uint8_t opcode, uint16_t operand, uint16_t next_pc)
+{
+    uint8_t dst = (opcode >> 3) & 0x07;
+    uint8_t src = opcode & 0x07;
+    uint8_t hl = offsetof(cpu_registers_t, hl);
+    uint8_t a = offsetof(cpu_registers_t, a);
+
+    if (opcode_handlers[opcode] == inst_unimplemented)
+        return false;
+
+    if (opcode == 0x00) // NOP
+    {
+    }
+    else if (opcode < 0x40 && src == 0x06 && dst != REG_8_IND_HL) // LD r, nn
+    {
+        jit_emit_store_8(reg_8_offsets[dst], operand);
+    }
+    else if (opcode < 0x40 && (src == 0x04 || src == 0x05) && dst != REG_8_IND_HL) // INC r, DEC r
+    {
+        jit_emit_inc_8(reg_8_offsets[dst], src == 0x05, src == 0x05 ? FLAGS_KIND_SUB : FLAGS_KIND_ADD);
+    }
+    else if ((opcode & 0xcf) == 0x01) // LD rr, nnnn
+    {
+        jit_emit_store_16(jit_reg_16_offsets[opcode >> 4], operand);
+    }
+    else if ((opcode & 0xc7) == 0x03) // INC rr, DEC rr
+    {
+        jit_emit_add_16(jit_reg_16_offsets[opcode >> 4], opcode & 0x08 ? -1 : 1);
+    }
+    else if (opcode == 0x22 || opcode == 0x32) // LDI (HL), A, LDD (HL), A
+    {
+        jit_emit_write_8(hl, a);
+        jit_emit_add_16(hl, opcode == 0x22 ? 1 : -1);
+    }
+    else if (opcode == 0x2a || opcode == 0x3a) // LDI A, (HL), LDD A, (HL)
+    {
+        jit_emit_read_operand(hl);
+        jit_emit_store_operand(a);
+        jit_emit_add_16(hl, opcode == 0x2a ? 1 : -1);
+    }
+    else if (opcode >= 0x40 && opcode < 0x80 && opcode != 0x76) // LD r, r, LD r, (HL), LD (HL), r
+    {
+        if (dst == REG_8_IND_HL)
         {
-            fprintf(stderr, P_INFO_INST "(0x%04x) Exec 0x%x - POP AF\n", registers.pc, inst);
+            jit_emit_write_8(hl, reg_8_offsets[src]);
         }
-#endif
-        registers.af = memory_read_16(registers.sp);
-        registers.sp += 2;
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
+        else if (src == REG_8_IND_HL)
         {
-            fprintf(stderr, P_INFO "Pop 0x%x in AF\n", registers.af);
+            jit_emit_read_operand(hl);
+            jit_emit_store_operand(reg_8_offsets[dst]);
         }
-#endif
-        registers.pc++;
-        clock_cycles = 12;
-        break;
-
-    case 0xf3: // DI
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
+        else if (src != dst)
         {
-            fprintf(stderr, P_INFO_INST "(0x%04x) Exec 0x%x - DI(Disable Interrupt)\n", registers.pc, inst);
+            jit_emit_copy_8(reg_8_offsets[dst], reg_8_offsets[src]);
         }
-#endif
-        registers.ime = false;
+    }
+    else if ((opcode >= 0x80 && opcode < 0xc0) || (opcode & 0xc7) == 0xc6) // ALU A, r, ALU A, (HL), ALU A, nn
+    {
+        int8_t op = jit_alu_ops[dst];
+        if (op == JIT_ALU_NONE)
+            return false;
+
+        if (opcode >= 0xc0)
+            jit_emit_load_imm_operand(operand);
+        else if (src == REG_8_IND_HL)
+            jit_emit_read_operand(hl);
+        else
+            jit_emit_load_operand(reg_8_offsets[src]);
+        jit_emit_alu_8(op, jit_alu_flags_kinds[op]);
+    }
+    else if (opcode == 0x18) // JR nn
+    {
+        jit_emit_store_16(offsetof(cpu_registers_t, pc), next_pc + (int8_t)operand);
+    }
+    else if ((opcode & 0xe7) == 0x20) // JR cc, nn
+    {
+        // A backward jump may close an idle loop, the handler skips it
+        uint16_t target = next_pc + (int8_t)operand;
+        if ((int8_t)operand < 0 && get_idle_loop_duration(target, next_pc - 2))
+            return false;
 
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO "Set IME to 0\n");
-        }
-#endif
-        registers.pc++;
-        clock_cycles = 4;
-        break;
+        jit_emit_store_16(offsetof(cpu_registers_t, pc), next_pc);
+        compile_branch(opcode, target);
+    }
+    else if (opcode == 0xc3) // JP nnnn
+    {
+        jit_emit_store_16(offsetof(cpu_registers_t, pc), operand);
+    }
+    else if ((opcode & 0xe7) == 0xc2) // JP cc, nnnn
+    {
+        jit_emit_store_16(offsetof(cpu_registers_t, pc), next_pc);
+        compile_branch(opcode, operand);
+    }
+    else
+    {
+        return false;
+    }
 
-    case 0xf5: // PUSH AF - SP=SP-2, (SP)=rr
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
+    return true;
+}
+
+// Return True if regs->pc holds the address following the instruction
+static bool compile_inst(uint8_t opcode, uint16_t operand, uint16_t next_pc, bool *called_writer)
+{
+    bool inlined = compile_inline(opcode, operand, next_pc);
+
+    if (!inlined)
+    {
+        jit_emit_store_16(offsetof(cpu_registers_t, pc), next_pc);
+        jit_emit_call((void *)opcode_handlers[opcode], opcode, operand);
+        *called_writer |= is_memory_write(opcode, operand);
+    }
+    jit_add_cycles(opcode_cycles[opcode]);
+
+    // The inlined jumps are the only ones to set PC
+    return !inlined || opcode_ends_block(opcode);
+}
+
+static void compile_block(cpu_block_t *block)
+{
+    if (!jit_begin())
+    {
+        // The arena is full, start over and let the hot blocks compile again
+        jit_reset();
+        for (uint16_t i = 0; i < BLOCK_CACHE_SIZE; i++)
+            block_cache[i].code = NULL;
+
+        if (!jit_begin())
+            return;
+    }
+
+    uint16_t pc = block->pc;
+    uint16_t remaining_cycles = block->cycles; // With every branch taken, like block->cycles
+    bool pc_stored = true;                     // regs->pc holds the address following the last instruction
+
+    for (uint8_t i = 0; i < block->nb_inst; i++)
+    {
+        const cpu_decoded_inst_t *inst = &block->insts[i];
+        bool called_writer = false;
+
+        if (inst->fusion == FUSION_NONE)
         {
-            fprintf(stderr, P_INFO_INST "(0x%04x) Exec 0x%x - PUSH AF\n", registers.pc, inst);
+            pc += inst->length;
+            pc_stored = compile_inst(inst->opcode, inst->operand, pc, &called_writer);
+            remaining_cycles -= opcode_taken_cycles[inst->opcode];
         }
-#endif
-        registers.sp -= 2;
-        memory_write_16(registers.sp, registers.af);
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
+        else
         {
-            fprintf(stderr, P_INFO "PUSH AF(0x%x) at SP(0x%x)\n", registers.af, registers.sp);
-        }
-#endif
-        registers.pc++;
-        clock_cycles = 16;
-        break;
+            // Split the operand packed by decode_block
+            uint8_t first_length = opcode_lengths[inst->opcode];
+            uint8_t second = fused_pairs[inst->fusion].second;
 
-    case 0xfa: // LD A, (nnnn)
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO_INST "(0x%04x) Exec 0x%x - LD A, (nnnn)\n", registers.pc, inst);
+            pc += first_length;
+            compile_inst(inst->opcode, inst->operand & ((1U << ((first_length - 1) * 8)) - 1), pc, &called_writer);
+            pc += opcode_lengths[second];
+            pc_stored = compile_inst(second, inst->operand >> ((first_length - 1) * 8), pc, &called_writer);
+            remaining_cycles -= opcode_taken_cycles[inst->opcode] + opcode_taken_cycles[second];
         }
-#endif
-        value_addr = memory_read_16(registers.pc + 1);
-        registers.a = memory_read_8(value_addr);
 
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO "Load 0x%x from 0x%x in A\n", registers.a, value_addr);
-        }
-#endif
-        registers.pc += 3;
-        clock_cycles = 16;
-        break;
+        // The last entry ends the block anyway
+        if (inst->writes_memory && i + 1 < block->nb_inst)
+            jit_emit_exit_check(!called_writer, (void *)jit_must_exit, block, remaining_cycles, pc, i + 1);
+    }
 
-    case 0xfb: // EI
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO_INST "(0x%04x) Exec 0x%x - EI(Enable Interrupt)\n", registers.pc, inst);
-        }
-#endif
-        registers.ime = true;
+    if (!pc_stored)
+        jit_emit_store_16(offsetof(cpu_registers_t, pc), pc);
 
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO "Set IME to 1\n");
-        }
+    block->code = jit_end(block->nb_inst);
+}
 #endif
-        registers.pc++;
-        clock_cycles = 4;
-        break;
 
-    case 0xfe: // CP nn - compare A-n
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO_INST "(0x%04x) Exec 0x%x - CP nn\n", registers.pc, inst);
-        }
+// Run the translation of a block, the JIT compiles it once it is hot
+// Return the number of entries run, 0 if the interpreter has to run it
+static inline uint8_t run_compiled(UNUSED cpu_block_t *block, UNUSED cpu_registers_t *regs)
+{
+#ifdef CPU_AOT
+    // The translated blocks don't check anything after a write
+    if (block->translation && !block->writes_memory)
+    {
+        block->translation(regs);
+        return block->nb_inst;
+    }
 #endif
-        mem_val = memory_read_8(registers.pc + 1);
+#ifdef CPU_JIT
+    if (!block->code && jit_enabled && ++block->heat == JIT_HOT_THRESHOLD)
+        compile_block(block);
 
-        sub = (int16_t)registers.a - (int16_t)mem_val;
+    if (block->code)
+        return block->code(regs);
+#endif
+    return 0;
+}
 
-        SET_BIT(registers.f, FLAG_N);
-        if (!sub)
-            SET_BIT(registers.f, FLAG_Z);
-        else
-            CLEAR_BIT(registers.f, FLAG_Z);
-        if (HAS_HALF_CARRY_ON_SUB(registers.a, sub))
-            SET_BIT(registers.f, FLAG_H);
-        else
-            CLEAR_BIT(registers.f, FLAG_H);
-        if (sub < 0)
-            SET_BIT(registers.f, FLAG_C);
-        else
-            CLEAR_BIT(registers.f, FLAG_C);
+// Print every instruction of the entry about to run
+// Nothing is fused while tracing, the entry is a single instruction
+static inline void trace_inst(const cpu_registers_t *regs, const cpu_decoded_inst_t *inst, bool traced)
+{
+    if (traced && recording)
+        trace_record(regs->pc, inst->opcode, regs->a << 8 | get_flags(regs), regs->bc, regs->de, regs->hl, regs->sp);
 
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
+    if (traced && (verbose & VERBOSE_CPU))
+    {
+        for (uint16_t addr = regs->pc; addr != (uint16_t)(regs->pc + inst->length);)
         {
-            fprintf(stderr, P_INFO "CP A(0x%x) to 0x%x\n", registers.a, mem_val);
-            print_flags();
-        }
-#endif
-        registers.pc += 2;
-        clock_cycles = 8;
-        break;
+            char text[DISASSEMBLY_MAX_SIZE];
+            uint8_t opcode = memory_read_8(addr);
 
-    case 0xff: // RST 38 - Call to 0x38, SP=SP-2, (SP)=PC, PC=nnnn
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO_INST "(0x%04x) Exec 0x%x - RST 38 - Call to 0x38\n", registers.pc, inst);
+            fprintf(stderr, P_INFO_INST "(0x%04x) Exec 0x%x - ", addr, opcode);
+            addr += cpu_disassemble(addr, text, DISASSEMBLY_MAX_SIZE);
+            fprintf(stderr, "%s\n", text);
         }
-#endif
+    }
+}
 
-        registers.sp -= 2;
-        memory_write_16(registers.sp, registers.pc + 1);
-        registers.pc = MEMORY_RST_38;
-#ifdef DEBUG
-        if (verbose & VERBOSE_CPU)
-        {
-            fprintf(stderr, P_INFO "Save PC(0x%x) at 0x%x\n", memory_read_16(registers.sp), registers.sp);
-            fprintf(stderr, P_INFO "Call to 0x%x\n", registers.pc);
-        }
-#endif
-        clock_cycles = 16;
-        break;
+// Return True if the debugger needs to take control back
+static inline bool inst_done(const cpu_registers_t *regs, bool traced)
+{
+    if (!traced)
+        return false;
 
-    default:
-        running = false;
-        fprintf(stderr, P_FATAL "Successfully executed %ld instructions\n", nb_exec_inst);
-        fprintf(stderr, P_FATAL "At 0x%x - Instruction 0x%02x not implemented yet!\n", registers.pc, inst);
-        break;
+    if (verbose & VERBOSE_CPU)
+    {
+        print_registers(regs);
+        print_flags(regs);
     }
 
-#ifdef DEBUG
     // Check Breakpoint
-    breakpoint_check();
-#endif
+    breakpoint_check(regs);
+
+    return !to_continue;
+}
+
+// Stop at the end of the budget or as soon as an event is due, a register
+// write may have brought a deadline closer
+static inline bool cpu_has_budget(uint64_t end_clock)
+{
+    return scheduler_clock < end_clock && scheduler_clock < scheduler_deadline && running;
+}
+
+// Only called when the interrupt controller flagged something
+// Return False while the CPU is halted
+static inline bool handle_interrupts(cpu_registers_t *regs, uint64_t end_clock)
+{
+    uint16_t vector = interrupt_acknowledge();
+    if (vector)
+    {
+        push_16(regs, regs->pc);
+        regs->pc = vector;
+        scheduler_clock += INTERRUPT_DISPATCH_DURATION;
+    }
+    else if (interrupt_is_halted())
+    {
+        // Only a scheduled event can request an interrupt while the CPU is
+        // halted, skip straight to the next one or to the end of the budget
+        scheduler_clock = end_clock < scheduler_deadline ? end_clock : scheduler_deadline;
+        return false;
+    }
+
+    return true;
+}
 
-    nb_exec_inst++;
-    return clock_cycles;
-}
\ No newline at end of file
+// The whole block ends before the budget and the next event, and nothing
+// but its own writes could request an interrupt in between
+static inline bool can_skip_checks(const cpu_block_t *block, uint64_t end_clock, bool traced)
+{
+    // Let the debugger see every instruction, the address reached at the end
+    // of the block is still checked
+    if (traced && (!to_continue || (verbose & VERBOSE_CPU) || recording || (has_breakpoint && breakpoint_addr >= block->pc && breakpoint_addr < block->end_pc)))
+        return false;
+
+    uint64_t block_end_clock = scheduler_clock + block->cycles;
+    return !interrupt_pending && block_end_clock <= end_clock && block_end_clock <= scheduler_deadline;
+}
+
+// A block runs without any check between its instructions when it can't
+// write to the bus either. The compiled code of the JIT checks the state
+// itself after the writes
+static inline bool can_run_unchecked(const cpu_block_t *block, uint64_t end_clock, bool traced)
+{
+    return !block->writes_memory && can_skip_checks(block, end_clock, traced);
+}
+
+// Second instructions of the pairs among the first entries of a block
+static inline uint8_t count_fused(const cpu_block_t *block, uint8_t nb_entries)
+{
+    if (nb_entries == block->nb_inst)
+        return block->nb_fused;
+
+    uint8_t nb_fused = 0;
+    for (uint8_t i = 0; i < nb_entries; i++)
+        nb_fused += block->insts[i].fusion != FUSION_NONE;
+    return nb_fused;
+}
+
+// Checked after every instruction of the other blocks
+static inline bool can_continue_block(const cpu_block_t *block, const cpu_decoded_inst_t *inst, uint64_t end_clock)
+{
+    if (inst->writes_memory && !is_block_current(block))
+        return false;
+
+    return cpu_has_budget(end_clock) && !interrupt_pending;
+}
+
+#define CPU_CORE_NAME run_clean
+#define CPU_CORE_TRACED false
+#include "cpu_core.h"
+
+#define CPU_CORE_NAME run_traced
+#define CPU_CORE_TRACED true
+#include "cpu_core.h"
+
+uint64_t cpu_run(uint64_t cycle_budget)
+{
+    if (break_requested)
+    {
+        break_requested = 0;
+        to_execute = 0;
+        to_continue = false;
+        fprintf(stderr, P_DEBUG "Break requested at 0x%x\n", registers.pc);
+        select_core();
+    }
+
+    uint64_t elapsed = run_core(cycle_budget);
+
+    // The core counts the faulty instruction too
+    if (unimplemented)
+    {
+        unimplemented = false;
+        fprintf(stderr, P_FATAL "Successfully executed %" PRIu64 " instructions\n", nb_exec_inst - 1);
+        fprintf(stderr, P_FATAL "At 0x%x - Instruction 0x%02x not implemented yet!\n", registers.pc, memory_read_8(registers.pc));
+    }
+
+    return elapsed;
+}
+
+uint64_t cpu_execute_inst(void)
+{
+    return cpu_run(1);
+}
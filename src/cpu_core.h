@@ -0,0 +1,183 @@
+/*
+    CPU execution core, included by cpu.c once per core
+    CPU_CORE_NAME: name of the generated function
+    CPU_CORE_TRACED: true to compile the debugger checks and the tracing in
+*/
+
+#if !defined(CPU_CORE_NAME) || !defined(CPU_CORE_TRACED)
+#error "CPU_CORE_NAME and CPU_CORE_TRACED must be defined before including cpu_core.h"
+#endif
+
+static uint64_t CPU_CORE_NAME(uint64_t cycle_budget)
+{
+    /*
+        Work on a local copy, loaded and stored once per call instead of once
+        per instruction. The table dispatch hands &regs to handlers called
+        through a pointer, so the copy still lives on the stack there; only
+        the threaded dispatch, which calls the handlers by name, lets the
+        compiler keep some of it in host registers.
+    */
+    cpu_registers_t regs = registers;
+
+    // The global clock is kept up to date after every instruction so that the
+    // components can catch up when the CPU accesses one of their registers
+    uint64_t start_clock = scheduler_clock;
+    uint64_t end_clock = start_clock + cycle_budget;
+    run_end_clock = end_clock;
+    uint64_t nb_inst = 0;  // Decoded entries
+    uint64_t nb_fused = 0; // Second instructions of the fused pairs among them
+
+#ifdef CPU_DISPATCH_THREADED
+    /*
+        Threaded code: every handler ends with its own jump to the handler of
+        the next decoded instruction, with the handler inlined and the operand
+        length known at compile time
+    */
+    const cpu_block_t *block;
+    const cpu_decoded_inst_t *inst;
+    const cpu_decoded_inst_t *last;
+    bool checked = true;
+
+#define DISPATCH_NEXT()                                                      \
+    do                                                                       \
+    {                                                                        \
+        inst++;                                                              \
+        if (inst == last)                                                    \
+            goto next_block;                                                 \
+        if (checked && !can_continue_block(block, inst - 1, end_clock))      \
+            goto next_block;                                                 \
+        trace_inst(&regs, inst, CPU_CORE_TRACED);                            \
+        goto *DISPATCH_LABEL(inst);                                          \
+    } while (0)
+
+#define DISPATCH_LABEL(inst) \
+    ((inst)->fusion != FUSION_NONE ? fused_dispatch_labels[(inst)->fusion] : dispatch_labels[(inst)->opcode])
+
+#define OPCODE_LABEL(opcode, ...) [opcode] = &&op_##opcode,
+#define OPCODE_CASE(opcode, handler, operand_kind, cycles, ...)              \
+    op_##opcode:                                                              \
+    {                                                                         \
+        regs.pc += OPERAND_LENGTH(operand_kind);                              \
+        uint8_t spent = handler(&regs, opcode, inst->operand);                \
+        scheduler_clock += cycles + spent;                                    \
+        nb_inst++;                                                            \
+        if (checked && inst_done(&regs, CPU_CORE_TRACED))                     \
+            goto run_end;                                                     \
+        DISPATCH_NEXT();                                                      \
+    }
+
+    // The length of a pair is left to the decoded entry
+#define FUSED_LABEL(first, first_handler, second, second_handler, mnemonic) \
+    [FUSED_INDEX_##first##_##second] = &&fused_##first##_##second,
+#define FUSED_CASE(first, first_handler, second, second_handler, mnemonic)  \
+    fused_##first##_##second:                                                 \
+    {                                                                         \
+        regs.pc += inst->length;                                              \
+        uint8_t spent = FUSED_NAME(first, second)(&regs, first, inst->operand); \
+        scheduler_clock += inst->cycles + spent;                              \
+        nb_inst++;                                                            \
+        nb_fused++;                                                           \
+        if (checked && inst_done(&regs, CPU_CORE_TRACED))                     \
+            goto run_end;                                                     \
+        DISPATCH_NEXT();                                                      \
+    }
+
+    static const void *const dispatch_labels[256] = {CPU_OPCODES(OPCODE_LABEL)};
+    static const void *const fused_dispatch_labels[NB_FUSED_PAIRS] = {CPU_FUSED_PAIRS(FUSED_LABEL)};
+
+next_block:
+    if (!checked && inst_done(&regs, CPU_CORE_TRACED))
+        goto run_end;
+    if (!cpu_has_budget(end_clock))
+        goto run_end;
+    if (interrupt_pending && !handle_interrupts(&regs, end_clock))
+        goto next_block;
+
+    block = get_block(regs.pc);
+    inst = block->insts;
+    last = inst + block->nb_inst;
+    checked = !can_run_unchecked(block, end_clock, CPU_CORE_TRACED);
+
+    trace_inst(&regs, inst, CPU_CORE_TRACED);
+    goto *DISPATCH_LABEL(inst);
+
+    CPU_OPCODES(OPCODE_CASE)
+    CPU_FUSED_PAIRS(FUSED_CASE)
+
+run_end:
+#else
+    while (cpu_has_budget(end_clock))
+    {
+        if (interrupt_pending && !handle_interrupts(&regs, end_clock))
+            continue;
+
+        cpu_block_t *block = get_block(regs.pc);
+        const cpu_decoded_inst_t *inst = block->insts;
+        const cpu_decoded_inst_t *last = inst + block->nb_inst;
+
+        if (can_skip_checks(block, end_clock, CPU_CORE_TRACED))
+        {
+            // The compiled code may stop after a write, the next entry is
+            // decoded as the head of a new block
+            uint8_t nb_run = run_compiled(block, &regs);
+            if (!nb_run && !block->writes_memory)
+            {
+                for (; inst < last; inst++)
+                {
+                    regs.pc += inst->length;
+                    uint8_t cycles = inst->handler(&regs, inst->opcode, inst->operand);
+                    scheduler_clock += inst->cycles + cycles;
+                }
+                nb_run = block->nb_inst;
+            }
+
+            if (nb_run)
+            {
+                nb_inst += nb_run;
+                nb_fused += count_fused(block, nb_run);
+
+                if (inst_done(&regs, CPU_CORE_TRACED))
+                    break;
+                continue;
+            }
+        }
+
+        bool stop = false;
+        do
+        {
+            trace_inst(&regs, inst, CPU_CORE_TRACED);
+            regs.pc += inst->length;
+
+            // The handler may move the clock itself (idle loops)
+            uint8_t cycles = inst->handler(&regs, inst->opcode, inst->operand);
+            scheduler_clock += inst->cycles + cycles;
+            nb_inst++;
+            nb_fused += inst->fusion != FUSION_NONE;
+
+            stop = inst_done(&regs, CPU_CORE_TRACED);
+            inst++;
+        } while (!stop && inst < last && can_continue_block(block, inst - 1, end_clock));
+
+        if (stop)
+            break;
+    }
+#endif
+
+    registers = regs;
+    nb_exec_inst += nb_inst + nb_fused;
+    nb_dispatches += nb_inst;
+
+    return scheduler_clock - start_clock;
+}
+
+#ifdef CPU_DISPATCH_THREADED
+#undef DISPATCH_NEXT
+#undef DISPATCH_LABEL
+#undef OPCODE_LABEL
+#undef OPCODE_CASE
+#undef FUSED_LABEL
+#undef FUSED_CASE
+#endif
+
+#undef CPU_CORE_NAME
+#undef CPU_CORE_TRACED
@@ -0,0 +1,109 @@
+#include <interrupt.h>
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include <memory.h>
+#include <common.h>
+#include <cpu.h>
+
+#define EI_DELAY 2 // Acknowledges until IME is set, the one before the next instruction and the one after
+
+uint8_t interrupt_pending = 0; // Extern
+
+static bool ime = false;
+static uint8_t ei_delay = 0;
+static bool halted = false;
+
+static uint8_t get_requested(void)
+{
+    return memory_read_reg(MEMORY_REG_IE) & memory_read_reg(MEMORY_REG_IF) & INTERRUPT_MASK;
+}
+
+static void update_pending(void)
+{
+    interrupt_pending = halted || ei_delay || (ime && get_requested());
+}
+
+void interrupt_init(void)
+{
+    ime = false;
+    ei_delay = 0;
+    halted = false;
+    update_pending();
+}
+
+void interrupt_request(uint8_t flag)
+{
+    memory_write_reg_value(MEMORY_REG_IF, flag, true);
+    update_pending();
+}
+
+void interrupt_write_reg(uint16_t reg_addr, uint8_t val)
+{
+    memory_write_reg(reg_addr, val);
+    update_pending();
+}
+
+void interrupt_set_ime(bool enabled)
+{
+    ime = enabled;
+    ei_delay = 0;
+    update_pending();
+}
+
+void interrupt_enable_delayed(void)
+{
+    if (ime)
+        return;
+
+    ei_delay = EI_DELAY;
+    update_pending();
+}
+
+void interrupt_halt(void)
+{
+    halted = true;
+    update_pending();
+}
+
+bool interrupt_is_halted(void)
+{
+    return halted;
+}
+
+uint16_t interrupt_acknowledge(void)
+{
+    if (ei_delay)
+    {
+        ei_delay--;
+        if (ei_delay == 0)
+            ime = true;
+    }
+
+    uint8_t requested = get_requested();
+    uint16_t vector = 0;
+
+    // Any enabled request ends HALT, it is only serviced with IME set
+    if (requested)
+        halted = false;
+
+    if (ime && requested)
+    {
+        // The lowest bit has the highest priority
+        uint8_t flag = __builtin_ctz(requested);
+
+        memory_write_reg(MEMORY_REG_IF, memory_read_reg(MEMORY_REG_IF) & ~(1 << flag));
+        ime = false;
+        vector = INTERRUPT_VECTOR_START + flag * INTERRUPT_VECTOR_SIZE;
+
+        if (verbose & VERBOSE_CPU)
+        {
+            fprintf(stderr, P_INFO "Interrupt %u, jump to 0x%04x\n", flag, vector);
+        }
+    }
+
+    update_pending();
+
+    return vector;
+}
\ No newline at end of file
@@ -0,0 +1,693 @@
+#define _DEFAULT_SOURCE
+
+#include <jit.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#include <common.h>
+#include <scheduler.h>
+
+#if defined(__x86_64__)
+
+#include <stddef.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <cpu.h>
+#include <memory.h>
+
+#define JIT_ARENA_SIZE (1024 * 1024)
+#define JIT_MAX_BLOCK_SIZE 8192 // Bigger than any block of the CPU
+
+#define REG_OFFSET(field) offsetof(cpu_registers_t, field)
+
+static uint8_t *arena = NULL;
+static uint32_t arena_used = 0;
+static uintptr_t host_page_size = 0;
+
+static uint8_t *block_start = NULL;
+static uint8_t *code = NULL;
+static uint32_t pending_cycles = 0;
+
+static void emit_8(uint8_t val)
+{
+    *code++ = val;
+}
+
+static void emit_16(uint16_t val)
+{
+    memcpy(code, &val, sizeof(val));
+    code += sizeof(val);
+}
+
+static void emit_32(uint32_t val)
+{
+    memcpy(code, &val, sizeof(val));
+    code += sizeof(val);
+}
+
+static void emit_64(uint64_t val)
+{
+    memcpy(code, &val, sizeof(val));
+    code += sizeof(val);
+}
+
+// Emit a jump with a 32 bits displacement, return where to patch it
+static uint8_t *emit_jump(uint8_t opcode)
+{
+    if (opcode == 0xe9) // jmp
+    {
+        emit_8(opcode);
+    }
+    else // jcc
+    {
+        emit_8(0x0f);
+        emit_8(opcode + 0x10);
+    }
+
+    uint8_t *displacement = code;
+    emit_32(0);
+    return displacement;
+}
+
+// Point a jump of emit_jump to the current position
+static void patch_jump(uint8_t *displacement)
+{
+    int32_t val = code - (displacement + 4);
+    memcpy(displacement, &val, sizeof(val));
+}
+
+// add qword [r12], imm32 with r12 = &scheduler_clock
+static void emit_add_clock(uint32_t cycles)
+{
+    emit_8(0x49);
+    emit_8(0x81);
+    emit_8(0x04);
+    emit_8(0x24);
+    emit_32(cycles);
+}
+
+// sub qword [r12], imm32
+static void emit_sub_clock(uint32_t cycles)
+{
+    emit_8(0x49);
+    emit_8(0x81);
+    emit_8(0x2c);
+    emit_8(0x24);
+    emit_32(cycles);
+}
+
+static void flush_cycles(void)
+{
+    if (!pending_cycles)
+        return;
+
+    emit_add_clock(pending_cycles);
+    pending_cycles = 0;
+}
+
+// mov rax, function / call rax
+static void emit_call(void *function)
+{
+    emit_8(0x48);
+    emit_8(0xb8);
+    emit_64((uint64_t)(uintptr_t)function);
+    emit_8(0xff);
+    emit_8(0xd0);
+}
+
+// mov eax, nb_done / pop r13 / pop r12 / pop rbx / ret
+static void emit_return(uint8_t nb_done)
+{
+    emit_8(0xb8);
+    emit_32(nb_done);
+    emit_8(0x41);
+    emit_8(0x5d);
+    emit_8(0x41);
+    emit_8(0x5c);
+    emit_8(0x5b);
+    emit_8(0xc3);
+}
+
+// Load the page table entry of the address held in a 16 bits field:
+// edi = address, rdx = host page, ZF set if it goes to the slow path
+static void emit_page_lookup(uint8_t *const pages[], uint8_t addr_offset)
+{
+    // movzx edi, word [rbx + addr_offset] / mov eax, edi / shr eax, 8
+    emit_8(0x0f);
+    emit_8(0xb7);
+    emit_8(0x7b);
+    emit_8(addr_offset);
+    emit_8(0x89);
+    emit_8(0xf8);
+    emit_8(0xc1);
+    emit_8(0xe8);
+    emit_8(8);
+
+    // mov rdx, pages / mov rdx, [rdx + rax * 8] / test rdx, rdx
+    emit_8(0x48);
+    emit_8(0xba);
+    emit_64((uint64_t)(uintptr_t)pages);
+    emit_8(0x48);
+    emit_8(0x8b);
+    emit_8(0x14);
+    emit_8(0xc2);
+    emit_8(0x48);
+    emit_8(0x85);
+    emit_8(0xd2);
+
+    // movzx eax, dil, the offset in the page
+    emit_8(0x40);
+    emit_8(0x0f);
+    emit_8(0xb6);
+    emit_8(0xc7);
+}
+
+bool jit_init(void)
+{
+    // Written through read/write pages, each block is made executable once
+    // finished
+    arena = mmap(NULL, JIT_ARENA_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (arena == MAP_FAILED)
+    {
+        arena = NULL;
+        fprintf(stderr, P_ERROR "Can't map the JIT arena, running the interpreter only\n");
+        return false;
+    }
+
+    host_page_size = sysconf(_SC_PAGESIZE);
+    arena_used = 0;
+    return true;
+}
+
+void jit_reset(void)
+{
+    arena_used = 0;
+}
+
+// Host pages holding the block being written
+static void *get_block_pages(size_t *size)
+{
+    uintptr_t start = (uintptr_t)block_start & ~(host_page_size - 1);
+    uintptr_t end = ((uintptr_t)block_start + JIT_MAX_BLOCK_SIZE + host_page_size - 1) & ~(host_page_size - 1);
+
+    *size = end - start;
+    return (void *)start;
+}
+
+bool jit_begin(void)
+{
+    if (!arena || arena_used + JIT_MAX_BLOCK_SIZE > JIT_ARENA_SIZE)
+        return false;
+
+    block_start = arena + arena_used;
+    code = block_start;
+    pending_cycles = 0;
+
+    // The end of the previous block may share the first page, nothing runs
+    // while the block is written
+    size_t size;
+    void *pages = get_block_pages(&size);
+    if (mprotect(pages, size, PROT_READ | PROT_WRITE))
+        return false;
+
+    // push rbx / push r12 / push r13, keeps the stack aligned for the calls
+    emit_8(0x53);
+    emit_8(0x41);
+    emit_8(0x54);
+    emit_8(0x41);
+    emit_8(0x55);
+
+    // mov rbx, rdi
+    emit_8(0x48);
+    emit_8(0x89);
+    emit_8(0xfb);
+
+    // mov r12, &scheduler_clock
+    emit_8(0x49);
+    emit_8(0xbc);
+    emit_64((uint64_t)(uintptr_t)&scheduler_clock);
+
+    // xor r13d, r13d, set by a write through the slow path
+    emit_8(0x45);
+    emit_8(0x31);
+    emit_8(0xed);
+
+    return true;
+}
+
+void jit_add_cycles(uint8_t cycles)
+{
+    pending_cycles += cycles;
+}
+
+void jit_emit_store_8(uint8_t offset, uint8_t val)
+{
+    // mov byte [rbx + offset], imm8
+    emit_8(0xc6);
+    emit_8(0x43);
+    emit_8(offset);
+    emit_8(val);
+}
+
+void jit_emit_store_16(uint8_t offset, uint16_t val)
+{
+    // mov word [rbx + offset], imm16
+    emit_8(0x66);
+    emit_8(0xc7);
+    emit_8(0x43);
+    emit_8(offset);
+    emit_16(val);
+}
+
+void jit_emit_copy_8(uint8_t dst_offset, uint8_t src_offset)
+{
+    // movzx eax, byte [rbx + src_offset]
+    emit_8(0x0f);
+    emit_8(0xb6);
+    emit_8(0x43);
+    emit_8(src_offset);
+
+    // mov byte [rbx + dst_offset], al
+    emit_8(0x88);
+    emit_8(0x43);
+    emit_8(dst_offset);
+}
+
+void jit_emit_add_16(uint8_t offset, int8_t val)
+{
+    // add word [rbx + offset], imm8 (sign extended)
+    emit_8(0x66);
+    emit_8(0x83);
+    emit_8(0x43);
+    emit_8(offset);
+    emit_8((uint8_t)val);
+}
+
+void jit_emit_load_operand(uint8_t offset)
+{
+    // movzx ecx, byte [rbx + offset]
+    emit_8(0x0f);
+    emit_8(0xb6);
+    emit_8(0x4b);
+    emit_8(offset);
+}
+
+void jit_emit_load_imm_operand(uint8_t val)
+{
+    // mov ecx, imm32
+    emit_8(0xb9);
+    emit_32(val);
+}
+
+void jit_emit_read_operand(uint8_t addr_offset)
+{
+    emit_page_lookup(memory_read_pages, addr_offset);
+    uint8_t *slow = emit_jump(0x74);
+
+    // movzx ecx, byte [rdx + rax]
+    emit_8(0x0f);
+    emit_8(0xb6);
+    emit_8(0x0c);
+    emit_8(0x02);
+    uint8_t *done = emit_jump(0xe9);
+
+    // The owner of the address catches up to the start of the instruction
+    patch_jump(slow);
+    if (pending_cycles)
+        emit_add_clock(pending_cycles);
+    emit_call((void *)memory_read_slow);
+    if (pending_cycles)
+        emit_sub_clock(pending_cycles);
+
+    // movzx ecx, al
+    emit_8(0x0f);
+    emit_8(0xb6);
+    emit_8(0xc8);
+
+    patch_jump(done);
+}
+
+void jit_emit_store_operand(uint8_t offset)
+{
+    // mov byte [rbx + offset], cl
+    emit_8(0x88);
+    emit_8(0x4b);
+    emit_8(offset);
+}
+
+void jit_emit_write_8(uint8_t addr_offset, uint8_t src_offset)
+{
+    // movzx esi, byte [rbx + src_offset]
+    emit_8(0x0f);
+    emit_8(0xb6);
+    emit_8(0x73);
+    emit_8(src_offset);
+
+    emit_page_lookup(memory_write_pages, addr_offset);
+    uint8_t *slow = emit_jump(0x74);
+
+    // mov byte [rdx + rax], sil
+    emit_8(0x40);
+    emit_8(0x88);
+    emit_8(0x34);
+    emit_8(0x02);
+    uint8_t *done = emit_jump(0xe9);
+
+    patch_jump(slow);
+    if (pending_cycles)
+        emit_add_clock(pending_cycles);
+    emit_call((void *)memory_write_slow);
+    if (pending_cycles)
+        emit_sub_clock(pending_cycles);
+
+    // mov r13b, 1
+    emit_8(0x41);
+    emit_8(0xb5);
+    emit_8(1);
+
+    patch_jump(done);
+}
+
+void jit_emit_alu_8(jit_alu_op_t op, uint8_t flags_kind)
+{
+    // op r/m8, r8 opcodes
+    static const uint8_t alu_opcodes[] = {
+        [JIT_ALU_ADD] = 0x00,
+        [JIT_ALU_SUB] = 0x28,
+        [JIT_ALU_AND] = 0x20,
+        [JIT_ALU_XOR] = 0x30,
+        [JIT_ALU_OR] = 0x08,
+        [JIT_ALU_CP] = 0x28,
+    };
+    bool arithmetic = op == JIT_ALU_ADD || op == JIT_ALU_SUB || op == JIT_ALU_CP;
+
+    // movzx eax, byte [rbx + a]
+    emit_8(0x0f);
+    emit_8(0xb6);
+    emit_8(0x43);
+    emit_8(REG_OFFSET(a));
+
+    if (arithmetic)
+    {
+        // mov [rbx + flags_op1], al / mov [rbx + flags_op2], cl
+        emit_8(0x88);
+        emit_8(0x43);
+        emit_8(REG_OFFSET(flags_op1));
+        emit_8(0x88);
+        emit_8(0x4b);
+        emit_8(REG_OFFSET(flags_op2));
+    }
+    else
+    {
+        jit_emit_store_8(REG_OFFSET(flags_op1), 0);
+        jit_emit_store_8(REG_OFFSET(flags_op2), 0);
+    }
+
+    // op al, cl
+    emit_8(alu_opcodes[op]);
+    emit_8(0xc8);
+
+    if (arithmetic)
+    {
+        // setc byte [rbx + flags_carry]
+        emit_8(0x0f);
+        emit_8(0x92);
+        emit_8(0x43);
+        emit_8(REG_OFFSET(flags_carry));
+    }
+    else
+    {
+        jit_emit_store_8(REG_OFFSET(flags_carry), 0);
+    }
+
+    // mov [rbx + flags_result], al / mov [rbx + a], al
+    emit_8(0x88);
+    emit_8(0x43);
+    emit_8(REG_OFFSET(flags_result));
+    if (op != JIT_ALU_CP)
+    {
+        emit_8(0x88);
+        emit_8(0x43);
+        emit_8(REG_OFFSET(a));
+    }
+
+    jit_emit_store_8(REG_OFFSET(flags_kind), flags_kind);
+}
+
+void jit_emit_inc_8(uint8_t offset, bool decrement, uint8_t flags_kind)
+{
+    // movzx eax, byte [rbx + offset] / mov [rbx + flags_op1], al
+    emit_8(0x0f);
+    emit_8(0xb6);
+    emit_8(0x43);
+    emit_8(offset);
+    emit_8(0x88);
+    emit_8(0x43);
+    emit_8(REG_OFFSET(flags_op1));
+
+    // sub al, 1 / add al, 1
+    emit_8(decrement ? 0x2c : 0x04);
+    emit_8(1);
+
+    // mov [rbx + offset], al / mov [rbx + flags_result], al
+    emit_8(0x88);
+    emit_8(0x43);
+    emit_8(offset);
+    emit_8(0x88);
+    emit_8(0x43);
+    emit_8(REG_OFFSET(flags_result));
+
+    jit_emit_store_8(REG_OFFSET(flags_op2), 1);
+    jit_emit_store_8(REG_OFFSET(flags_kind), flags_kind);
+}
+
+void jit_emit_branch(uint8_t flag_offset, bool if_zero, uint16_t target, uint8_t taken_cycles)
+{
+    // cmp byte [rbx + flag_offset], 0 / jnz or jz over the taken branch
+    emit_8(0x80);
+    emit_8(0x7b);
+    emit_8(flag_offset);
+    emit_8(0);
+    emit_8(if_zero ? 0x75 : 0x74);
+    emit_8(taken_cycles ? 14 : 6);
+
+    jit_emit_store_16(REG_OFFSET(pc), target);
+    if (taken_cycles)
+        emit_add_clock(taken_cycles);
+}
+
+void jit_emit_exit_check(bool after_slow_write, void *check, const void *arg_1, uint32_t arg_2, uint16_t pc, uint8_t nb_done)
+{
+    uint8_t *skip = NULL;
+    uint32_t cycles = pending_cycles;
+
+    if (after_slow_write)
+    {
+        // test r13b, r13b / jz skip / xor r13d, r13d
+        emit_8(0x45);
+        emit_8(0x84);
+        emit_8(0xed);
+        skip = emit_jump(0x74);
+        emit_8(0x45);
+        emit_8(0x31);
+        emit_8(0xed);
+
+        // The cycles stay pending on the path skipping the check
+        if (cycles)
+            emit_add_clock(cycles);
+    }
+    else
+    {
+        flush_cycles();
+        cycles = 0;
+    }
+
+    // mov rdi, rbx / mov rsi, arg_1 / mov edx, arg_2
+    emit_8(0x48);
+    emit_8(0x89);
+    emit_8(0xdf);
+    emit_8(0x48);
+    emit_8(0xbe);
+    emit_64((uint64_t)(uintptr_t)arg_1);
+    emit_8(0xba);
+    emit_32(arg_2);
+    emit_call(check);
+
+    // test al, al / jz resume
+    emit_8(0x84);
+    emit_8(0xc0);
+    uint8_t *resume = emit_jump(0x74);
+
+    jit_emit_store_16(REG_OFFSET(pc), pc);
+    emit_return(nb_done);
+
+    patch_jump(resume);
+    if (cycles)
+        emit_sub_clock(cycles);
+    if (skip)
+        patch_jump(skip);
+}
+
+void jit_emit_call(void *function, uint8_t arg_1, uint16_t arg_2)
+{
+    // The function may read the clock
+    flush_cycles();
+
+    // mov rdi, rbx / mov esi, arg_1 / mov edx, arg_2
+    emit_8(0x48);
+    emit_8(0x89);
+    emit_8(0xdf);
+    emit_8(0xbe);
+    emit_32(arg_1);
+    emit_8(0xba);
+    emit_32(arg_2);
+
+    emit_call(function);
+
+    // movzx eax, al / add qword [r12], rax
+    emit_8(0x0f);
+    emit_8(0xb6);
+    emit_8(0xc0);
+    emit_8(0x49);
+    emit_8(0x01);
+    emit_8(0x04);
+    emit_8(0x24);
+}
+
+jit_block_t jit_end(uint8_t nb_done)
+{
+    flush_cycles();
+    emit_return(nb_done);
+
+    arena_used += code - block_start;
+
+    size_t size;
+    void *pages = get_block_pages(&size);
+    if (mprotect(pages, size, PROT_READ | PROT_EXEC))
+        return NULL;
+
+    jit_block_t block;
+    void *entry = block_start;
+    memcpy(&block, &entry, sizeof(block));
+    return block;
+}
+
+#else
+
+// Other hosts only run the interpreter
+bool jit_init(void)
+{
+    return false;
+}
+
+void jit_reset(void)
+{
+}
+
+bool jit_begin(void)
+{
+    return false;
+}
+
+void jit_add_cycles(uint8_t cycles)
+{
+    (void)cycles;
+}
+
+void jit_emit_store_8(uint8_t offset, uint8_t val)
+{
+    (void)offset;
+    (void)val;
+}
+
+void jit_emit_store_16(uint8_t offset, uint16_t val)
+{
+    (void)offset;
+    (void)val;
+}
+
+void jit_emit_copy_8(uint8_t dst_offset, uint8_t src_offset)
+{
+    (void)dst_offset;
+    (void)src_offset;
+}
+
+void jit_emit_add_16(uint8_t offset, int8_t val)
+{
+    (void)offset;
+    (void)val;
+}
+
+void jit_emit_load_operand(uint8_t offset)
+{
+    (void)offset;
+}
+
+void jit_emit_load_imm_operand(uint8_t val)
+{
+    (void)val;
+}
+
+void jit_emit_read_operand(uint8_t addr_offset)
+{
+    (void)addr_offset;
+}
+
+void jit_emit_store_operand(uint8_t offset)
+{
+    (void)offset;
+}
+
+void jit_emit_write_8(uint8_t addr_offset, uint8_t src_offset)
+{
+    (void)addr_offset;
+    (void)src_offset;
+}
+
+void jit_emit_alu_8(jit_alu_op_t op, uint8_t flags_kind)
+{
+    (void)op;
+    (void)flags_kind;
+}
+
+void jit_emit_inc_8(uint8_t offset, bool decrement, uint8_t flags_kind)
+{
+    (void)offset;
+    (void)decrement;
+    (void)flags_kind;
+}
+
+void jit_emit_branch(uint8_t flag_offset, bool if_zero, uint16_t target, uint8_t taken_cycles)
+{
+    (void)flag_offset;
+    (void)if_zero;
+    (void)target;
+    (void)taken_cycles;
+}
+
+void jit_emit_exit_check(bool after_slow_write, void *check, const void *arg_1, uint32_t arg_2, uint16_t pc, uint8_t nb_done)
+{
+    (void)after_slow_write;
+    (void)check;
+    (void)arg_1;
+    (void)arg_2;
+    (void)pc;
+    (void)nb_done;
+}
+
+void jit_emit_call(void *function, uint8_t arg_1, uint16_t arg_2)
+{
+    (void)function;
+    (void)arg_1;
+    (void)arg_2;
+}
+
+jit_block_t jit_end(uint8_t nb_done)
+{
+    (void)nb_done;
+    return NULL;
+}
+
+#endif
\ No newline at end of file
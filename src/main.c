@@ -1,5 +1,8 @@
+#define _POSIX_C_SOURCE 200112L
+
 #include <stdlib.h>
 #include <stdio.h>
+#include <signal.h>
 #include <SDL2/SDL.h>
 
 #include <memory.h>
@@ -8,12 +11,66 @@
 #include <ppu.h>
 #include <cartridge.h>
 #include <timer.h>
+#include <scheduler.h>
+#include <interrupt.h>
+#include <trace.h>
+
+#define LCD_SCALE 4
+
+static SDL_Window *pWindowLCD = NULL;
+static SDL_Renderer *pRendererLCD = NULL;
+static SDL_Texture *pTextureLCD = NULL;
+
+static const uint32_t sdl_formats[PALETTE_FORMAT_COUNT] = {
+    [PALETTE_FORMAT_ABGR1555] = SDL_PIXELFORMAT_ABGR1555,
+    [PALETTE_FORMAT_RGB565] = SDL_PIXELFORMAT_RGB565,
+    [PALETTE_FORMAT_XRGB8888] = SDL_PIXELFORMAT_RGB888, // 8 bits unused then RGB
+};
 
 static void print_usage(const char *filename)
 {
     fprintf(stderr, "Usage: %s <ROM>\n", filename);
 }
 
+// kill -USR1 <pid> stops the running CPU in the debugger
+static void on_break_signal(int sig)
+{
+    (void)sig;
+    cpu_request_break();
+}
+
+static void open_lcd(void)
+{
+    pWindowLCD = SDL_CreateWindow("GameBoy", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, SCREEN_WIDTH * LCD_SCALE, SCREEN_HEIGHT * LCD_SCALE, 0);
+    if (pWindowLCD == NULL)
+    {
+        fprintf(stderr, P_FATAL "Could not create Window\n");
+        exit(EXIT_FAILURE);
+    }
+
+    pRendererLCD = SDL_CreateRenderer(pWindowLCD, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
+    if (pRendererLCD == NULL)
+    {
+        fprintf(stderr, P_FATAL "Could not create Renderer\n");
+        exit(EXIT_FAILURE);
+    }
+
+    pTextureLCD = SDL_CreateTexture(
+        pRendererLCD,
+        sdl_formats[PPU_PIXEL_FORMAT],
+        SDL_TEXTUREACCESS_STREAMING,
+        SCREEN_WIDTH,
+        SCREEN_HEIGHT);
+}
+
+// Show the frame the PPU just completed
+static void present_lcd(void)
+{
+    SDL_UpdateTexture(pTextureLCD, NULL, ppu_get_framebuffer(), SCREEN_WIDTH * sizeof(ppu_pixel_t));
+    SDL_RenderCopy(pRendererLCD, pTextureLCD, NULL, NULL);
+    SDL_RenderPresent(pRendererLCD);
+}
+
 static void print_banner(void)
 {
     fprintf(stdout,
@@ -38,8 +95,6 @@ static void print_banner(void)
 
 int main(int argc, char const *argv[])
 {
-    uint64_t clock_cycles = 0;
-
     if (argc != 2)
     {
         print_usage(argv[0]);
@@ -54,20 +109,29 @@ int main(int argc, char const *argv[])
         SDL_Log("Unable to initialize SDL: %s", SDL_GetError());
         return EXIT_FAILURE;
     }
+    open_lcd();
     fprintf(stdout, "OK\n");
 
+    // The cartridge maps its banks over the default memory layout
+    scheduler_init();
+    memory_init();
+
     fprintf(stdout, "Loading ROM...\n");
     cartridge_load_rom(argv[1]);
     cartridge_print_infos();
 
     fprintf(stdout, "Initializing Components...\n");
     cpu_init();
-    memory_init();
+    interrupt_init();
     ppu_init();
+    timer_init();
+
+    signal(SIGUSR1, on_break_signal);
 
     fprintf(stdout, "Starting CPU...\n");
     SDL_Event events;
     bool isRunning = true;
+    uint64_t nb_frames = 0;
     while (cpu_is_running() && isRunning)
     {
         // Input
@@ -86,20 +150,28 @@ int main(int argc, char const *argv[])
             }
         }
 
-#ifdef DEBUG
         cpu_debugger();
         if (!cpu_is_running())
             break;
-#endif
 
-        clock_cycles = cpu_execute_inst();
-        ppu_execute(clock_cycles);
-        timer_execute(clock_cycles);
-        // interrupt_execute(clock_cycles?) Probablement mettre ça dans le cpu
+        // Run the CPU uninterrupted until the next event
+        cpu_run(scheduler_next_deadline() - scheduler_clock);
+        scheduler_run_events();
+
+        if (ppu_get_nb_frames() != nb_frames)
+        {
+            nb_frames = ppu_get_nb_frames();
+            present_lcd();
+        }
     }
 
     // fprintf(stdout, "Destroying Components...\n");
+    trace_stop();
     ppu_destroy();
+    cartridge_destroy();
+
+    SDL_DestroyRenderer(pRendererLCD);
+    SDL_DestroyWindow(pWindowLCD);
 
     SDL_Quit();
 
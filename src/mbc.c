@@ -0,0 +1,341 @@
+#include <mbc.h>
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include <cartridge.h>
+#include <common.h>
+#include <memory.h>
+
+#define MBC3_RTC_FIRST_REG 0x08
+#define MBC3_RTC_LAST_REG 0x0c
+#define MBC3_RTC_NB_REGS (MBC3_RTC_LAST_REG - MBC3_RTC_FIRST_REG + 1)
+
+#define MBC_MAX_RAM_BANKS 16
+#define MBC_RAM_PAGES_PER_BANK (MEMORY_EXTERNAL_RAM_BANK_SIZE / MEMORY_PAGE_SIZE)
+#define MBC_MAX_RAM_PAGES (MBC_MAX_RAM_BANKS * MBC_RAM_PAGES_PER_BANK)
+
+typedef enum
+{
+    MBC_NONE,
+    MBC_1,
+    MBC_3,
+    MBC_5,
+} mbc_kind_t;
+
+typedef struct
+{
+    mbc_kind_t kind;
+    uint8_t *rom;
+    uint16_t rom_banks;
+    uint8_t *ram;
+    uint8_t ram_banks;
+    uint8_t *ram_bank_data; // Bank currently mapped
+
+    // Battery backed RAM pages stay write protected until their first write
+    // so that only the modified pages are flushed
+    bool battery;
+    bool ram_dirty[MBC_MAX_RAM_PAGES];
+
+    bool ram_enabled;
+    uint16_t rom_bank; // MBC1: lower 5 bits, MBC3: 7 bits, MBC5: 9 bits
+    uint8_t ram_bank;  // MBC1: upper 2 bits, MBC3: RAM bank or RTC register
+    bool banking_mode; // MBC1 only
+    uint16_t mapped_rom_banks[2]; // At 0x0000 and at 0x4000
+
+    // MBC3 real time clock, registers are stored but the clock does not tick
+    uint8_t rtc[MBC3_RTC_NB_REGS];
+    uint8_t rtc_latched[MBC3_RTC_NB_REGS];
+    uint8_t rtc_latch;
+} mbc_t;
+
+static mbc_t mbc = {
+    .kind = MBC_NONE,
+    .rom_bank = 1,
+    .mapped_rom_banks = {0, 1},
+};
+
+static void mbc_none_write(uint16_t addr, uint8_t val);
+static void mbc1_write(uint16_t addr, uint8_t val);
+static void mbc3_write(uint16_t addr, uint8_t val);
+static void mbc5_write(uint16_t addr, uint8_t val);
+
+static void (*mbc_write_handler)(uint16_t addr, uint8_t val) = mbc_none_write;
+
+static uint8_t *get_rom_bank(uint16_t bank)
+{
+    return mbc.rom + (bank % mbc.rom_banks) * MEMORY_ROM_BANK_SIZE;
+}
+
+static bool is_rtc_selected(void)
+{
+    return mbc.kind == MBC_3 && mbc.ram_bank >= MBC3_RTC_FIRST_REG && mbc.ram_bank <= MBC3_RTC_LAST_REG;
+}
+
+// Point the ROM and external RAM pages to the selected banks, no data is copied
+static void update_mapping(void)
+{
+    uint16_t bank_0 = 0;
+    uint16_t bank_n = mbc.rom_bank;
+    uint8_t ram_bank = mbc.ram_bank;
+
+    if (mbc.kind == MBC_1)
+    {
+        bank_n |= mbc.ram_bank << 5;
+
+        // Mode 1 applies the upper bits to the first ROM bank and the RAM
+        if (mbc.banking_mode)
+            bank_0 = mbc.ram_bank << 5;
+        else
+            ram_bank = 0;
+    }
+
+    mbc.mapped_rom_banks[0] = bank_0 % mbc.rom_banks;
+    mbc.mapped_rom_banks[1] = bank_n % mbc.rom_banks;
+    memory_map_pages(MEMORY_ROM_BANK_0_START_ADDR, MEMORY_ROM_BANK_N_START_ADDR, get_rom_bank(bank_0), false);
+    memory_map_pages(MEMORY_ROM_BANK_N_START_ADDR, MEMORY_VRAM_START_ADDR, get_rom_bank(bank_n), false);
+
+    if (mbc.ram_enabled && mbc.ram_banks > 0 && !is_rtc_selected())
+    {
+        mbc.ram_bank_data = mbc.ram + (ram_bank % mbc.ram_banks) * MEMORY_EXTERNAL_RAM_BANK_SIZE;
+
+        for (uint16_t addr = MEMORY_EXTERNAL_RAM_START_ADDR; addr < MEMORY_WRAM_START_ADDR; addr += MEMORY_PAGE_SIZE)
+        {
+            uint8_t *page = mbc.ram_bank_data + (addr - MEMORY_EXTERNAL_RAM_START_ADDR);
+            bool writable = !mbc.battery || mbc.ram_dirty[(page - mbc.ram) / MEMORY_PAGE_SIZE];
+
+            memory_map_pages(addr, addr + MEMORY_PAGE_SIZE, page, writable);
+        }
+    }
+    else
+    {
+        mbc.ram_bank_data = NULL;
+        memory_unmap_pages(MEMORY_EXTERNAL_RAM_START_ADDR, MEMORY_WRAM_START_ADDR);
+    }
+}
+
+void mbc_init(uint8_t type, uint8_t *rom, uint16_t rom_banks, uint8_t *ram, uint8_t ram_banks, bool battery)
+{
+    if (ram_banks > MBC_MAX_RAM_BANKS)
+        ram_banks = MBC_MAX_RAM_BANKS;
+
+    mbc = (mbc_t){
+        .rom = rom,
+        .rom_banks = rom_banks,
+        .ram = ram,
+        .ram_banks = ram_banks,
+        .battery = battery,
+        .rom_bank = 1,
+    };
+
+    switch (type)
+    {
+    case CARTRIDGE_TYPE_ROM_ONLY:
+    case CARTRIDGE_TYPE_ROM_RAM:
+    case CARTRIDGE_TYPE_ROM_RAM_BATTERY:
+        mbc.kind = MBC_NONE;
+        mbc.ram_enabled = true;
+        mbc_write_handler = mbc_none_write;
+        break;
+
+    case CARTRIDGE_TYPE_MBC1:
+    case CARTRIDGE_TYPE_MBC1_RAM:
+    case CARTRIDGE_TYPE_MBC1_RAM_BATTERY:
+        mbc.kind = MBC_1;
+        mbc_write_handler = mbc1_write;
+        break;
+
+    case CARTRIDGE_TYPE_MBC3_TIMER_BATTERY:
+    case CARTRIDGE_TYPE_MBC3_TIMER_RAM_BATTERY:
+    case CARTRIDGE_TYPE_MBC3:
+    case CARTRIDGE_TYPE_MBC3_RAM:
+    case CARTRIDGE_TYPE_MBC3_RAM_BATTERY:
+        mbc.kind = MBC_3;
+        mbc_write_handler = mbc3_write;
+        break;
+
+    case CARTRIDGE_TYPE_MBC5:
+    case CARTRIDGE_TYPE_MBC5_RAM:
+    case CARTRIDGE_TYPE_MBC5_RAM_BATTERY:
+    case CARTRIDGE_TYPE_MBC5_RUMBLE:
+    case CARTRIDGE_TYPE_MBC5_RUMBLE_RAM:
+    case CARTRIDGE_TYPE_MBC5_RUMBLE_RAM_BATTERY:
+        mbc.kind = MBC_5;
+        mbc_write_handler = mbc5_write;
+        break;
+
+    default:
+        fprintf(stderr, P_ERROR "Unsupported cartridge type 0x%02x, running it as ROM only\n", type);
+        mbc.kind = MBC_NONE;
+        mbc_write_handler = mbc_none_write;
+        break;
+    }
+
+    update_mapping();
+}
+
+uint16_t mbc_get_rom_bank(uint16_t addr)
+{
+    if (addr >= MEMORY_VRAM_START_ADDR)
+        return 0;
+
+    return mbc.mapped_rom_banks[addr >= MEMORY_ROM_BANK_N_START_ADDR];
+}
+
+void mbc_write(uint16_t addr, uint8_t val)
+{
+    mbc_write_handler(addr, val);
+}
+
+uint8_t mbc_read_ram(uint16_t addr)
+{
+    (void)addr;
+
+    if (mbc.ram_enabled && is_rtc_selected())
+        return mbc.rtc_latched[mbc.ram_bank - MBC3_RTC_FIRST_REG];
+
+    // Open bus
+    return 0xff;
+}
+
+void mbc_write_ram(uint16_t addr, uint8_t val)
+{
+    if (mbc.ram_enabled && is_rtc_selected())
+    {
+        mbc.rtc[mbc.ram_bank - MBC3_RTC_FIRST_REG] = val;
+        return;
+    }
+
+    if (mbc.ram_bank_data == NULL)
+        return;
+
+    // First write to a clean page: mark it and let the next writes through
+    uint16_t page_addr = addr - addr % MEMORY_PAGE_SIZE;
+    uint8_t *page = mbc.ram_bank_data + (page_addr - MEMORY_EXTERNAL_RAM_START_ADDR);
+
+    mbc.ram_dirty[(page - mbc.ram) / MEMORY_PAGE_SIZE] = true;
+    memory_map_pages(page_addr, page_addr + MEMORY_PAGE_SIZE, page, true);
+
+    page[addr - page_addr] = val;
+}
+
+void mbc_flush_ram(void (*flush)(uint8_t *data, uint32_t size))
+{
+    uint16_t nb_pages = mbc.ram_banks * MBC_RAM_PAGES_PER_BANK;
+    uint16_t page = 0;
+    bool flushed = false;
+
+    while (page < nb_pages)
+    {
+        if (!mbc.ram_dirty[page])
+        {
+            page++;
+            continue;
+        }
+
+        // Merge the contiguous dirty pages in a single range
+        uint16_t first_page = page;
+        while (page < nb_pages && mbc.ram_dirty[page])
+        {
+            mbc.ram_dirty[page] = false;
+            page++;
+        }
+
+        flush(mbc.ram + first_page * MEMORY_PAGE_SIZE, (page - first_page) * MEMORY_PAGE_SIZE);
+        flushed = true;
+    }
+
+    // Write protect the flushed pages of the mapped bank again, the ROM
+    // mapping is left alone
+    if (flushed && mbc.ram_bank_data != NULL)
+        memory_map_pages(MEMORY_EXTERNAL_RAM_START_ADDR, MEMORY_WRAM_START_ADDR, mbc.ram_bank_data, false);
+}
+
+static void mbc_none_write(uint16_t addr, uint8_t val)
+{
+    (void)addr;
+    (void)val;
+}
+
+static void mbc1_write(uint16_t addr, uint8_t val)
+{
+    if (addr < 0x2000)
+    {
+        mbc.ram_enabled = (val & 0x0f) == 0x0a;
+    }
+    else if (addr < 0x4000)
+    {
+        // Bank 0 can't be selected in the switchable area
+        mbc.rom_bank = val & 0x1f;
+        if (mbc.rom_bank == 0)
+            mbc.rom_bank = 1;
+    }
+    else if (addr < 0x6000)
+    {
+        mbc.ram_bank = val & 0x03;
+    }
+    else
+    {
+        mbc.banking_mode = val & 0x01;
+    }
+
+    update_mapping();
+}
+
+static void mbc3_write(uint16_t addr, uint8_t val)
+{
+    if (addr < 0x2000)
+    {
+        mbc.ram_enabled = (val & 0x0f) == 0x0a;
+    }
+    else if (addr < 0x4000)
+    {
+        mbc.rom_bank = val & 0x7f;
+        if (mbc.rom_bank == 0)
+            mbc.rom_bank = 1;
+    }
+    else if (addr < 0x6000)
+    {
+        // 0x00-0x03: RAM bank, 0x08-0x0C: RTC register
+        mbc.ram_bank = val;
+    }
+    else
+    {
+        // Writing 0 then 1 latches the clock
+        if (mbc.rtc_latch == 0x00 && val == 0x01)
+        {
+            for (uint8_t i = 0; i < MBC3_RTC_NB_REGS; i++)
+                mbc.rtc_latched[i] = mbc.rtc[i];
+        }
+        mbc.rtc_latch = val;
+        return;
+    }
+
+    update_mapping();
+}
+
+static void mbc5_write(uint16_t addr, uint8_t val)
+{
+    if (addr < 0x2000)
+    {
+        mbc.ram_enabled = (val & 0x0f) == 0x0a;
+    }
+    else if (addr < 0x3000)
+    {
+        mbc.rom_bank = (mbc.rom_bank & 0x100) | val;
+    }
+    else if (addr < 0x4000)
+    {
+        mbc.rom_bank = (mbc.rom_bank & 0xff) | ((val & 0x01) << 8);
+    }
+    else if (addr < 0x6000)
+    {
+        mbc.ram_bank = val & 0x0f;
+    }
+    else
+    {
+        return;
+    }
+
+    update_mapping();
+}
\ No newline at end of file
@@ -4,10 +4,102 @@
 #include <string.h>
 #include <stdio.h>
 
+#include <ppu.h>
+#include <timer.h>
+#include <mbc.h>
+#include <interrupt.h>
+#include <cpu.h>
+
 uint8_t memory[MEMORY_SIZE] = {0};
 
+uint8_t *memory_read_pages[MEMORY_NB_PAGES];  // Extern
+uint8_t *memory_write_pages[MEMORY_NB_PAGES]; // Extern
+
+static uint8_t *writable_pages[MEMORY_NB_PAGES]; // Write mapping without the code protection
+static bool code_pages[MEMORY_NB_PAGES];         // Pages holding decoded instructions
+
+void memory_map_pages(uint16_t start_addr, uint32_t end_addr, uint8_t *host, bool writable)
+{
+    for (uint32_t addr = start_addr; addr < end_addr; addr += MEMORY_PAGE_SIZE)
+    {
+        uint8_t *page = host + (addr - start_addr);
+
+        memory_read_pages[addr / MEMORY_PAGE_SIZE] = page;
+        writable_pages[addr / MEMORY_PAGE_SIZE] = writable ? page : NULL;
+        memory_write_pages[addr / MEMORY_PAGE_SIZE] = code_pages[addr / MEMORY_PAGE_SIZE] ? NULL : writable_pages[addr / MEMORY_PAGE_SIZE];
+    }
+}
+
+void memory_unmap_pages(uint16_t start_addr, uint32_t end_addr)
+{
+    for (uint32_t addr = start_addr; addr < end_addr; addr += MEMORY_PAGE_SIZE)
+    {
+        memory_read_pages[addr / MEMORY_PAGE_SIZE] = NULL;
+        writable_pages[addr / MEMORY_PAGE_SIZE] = NULL;
+        memory_write_pages[addr / MEMORY_PAGE_SIZE] = NULL;
+    }
+}
+
+// Return the page sharing its host memory with a WRAM or echo RAM page, the page itself otherwise
+static uint8_t get_mirror_page(uint8_t page)
+{
+    uint8_t echo_offset = (MEMORY_ECHO_RAM_START_ADDR - MEMORY_WRAM_START_ADDR) / MEMORY_PAGE_SIZE;
+
+    if (page >= MEMORY_ECHO_RAM_START_ADDR / MEMORY_PAGE_SIZE && page < MEMORY_OAM_START_ADDR / MEMORY_PAGE_SIZE)
+        return page - echo_offset;
+    if (page >= MEMORY_WRAM_START_ADDR / MEMORY_PAGE_SIZE && page < MEMORY_OAM_START_ADDR / MEMORY_PAGE_SIZE - echo_offset)
+        return page + echo_offset;
+
+    return page;
+}
+
+static void set_code_page(uint8_t page, bool is_code)
+{
+    code_pages[page] = is_code;
+    memory_write_pages[page] = is_code ? NULL : writable_pages[page];
+}
+
+void memory_watch_code_page(uint8_t page)
+{
+    set_code_page(page, true);
+    set_code_page(get_mirror_page(page), true);
+}
+
+// First write to a page holding decoded instructions since they were decoded
+static void code_page_written(uint8_t page)
+{
+    uint8_t mirror_page = get_mirror_page(page);
+
+    set_code_page(page, false);
+    set_code_page(mirror_page, false);
+
+    cpu_invalidate_code_page(page);
+    if (mirror_page != page)
+        cpu_invalidate_code_page(mirror_page);
+}
+
+static void init_pages(void)
+{
+    memory_unmap_pages(0, MEMORY_SIZE);
+
+    // ROM and external RAM until a cartridge maps its own banks
+    memory_map_pages(MEMORY_ROM_BANK_0_START_ADDR, MEMORY_VRAM_START_ADDR, memory + MEMORY_ROM_BANK_0_START_ADDR, false);
+    memory_map_pages(MEMORY_VRAM_START_ADDR, MEMORY_ECHO_RAM_START_ADDR, memory + MEMORY_VRAM_START_ADDR, true);
+
+    // The PPU keeps the tile data decoded and draws its lines late, it sees
+    // every write to the VRAM
+    memory_map_pages(MEMORY_VRAM_START_ADDR, MEMORY_EXTERNAL_RAM_START_ADDR, memory + MEMORY_VRAM_START_ADDR, false);
+
+    // Echo RAM is a mirror of the WRAM
+    memory_map_pages(MEMORY_ECHO_RAM_START_ADDR, MEMORY_OAM_START_ADDR, memory + MEMORY_WRAM_START_ADDR, true);
+
+    // OAM, unusable range, I/O registers and HRAM are left to the slow path
+}
+
 void memory_init(void)
 {
+    init_pages();
+
     memory[MEMORY_REG_TIMA] = 0x00;
     memory[MEMORY_REG_TMA] = 0x00;
     memory[MEMORY_REG_TAC] = 0x00;
@@ -51,16 +143,99 @@ void memory_read(uint8_t buff[], uint16_t mem_start_addr, uint16_t size)
     memcpy(buff, memory + mem_start_addr, size);
 }
 
-inline uint8_t memory_read_8(uint16_t mem_start_addr)
+const uint8_t *memory_get_host(uint16_t addr)
+{
+    return memory + addr;
+}
+
+// Bring the owner of the register up to date before the CPU reads it
+static uint8_t memory_read_io(uint16_t mem_start_addr)
 {
+    switch (mem_start_addr)
+    {
+    case MEMORY_REG_DIV:
+    case MEMORY_REG_TIMA:
+        timer_sync();
+        break;
+
+    case MEMORY_REG_STAT:
+    case MEMORY_REG_LY:
+        ppu_sync();
+        break;
+    }
+
     return memory[mem_start_addr];
 }
 
-inline uint16_t memory_read_16(uint16_t mem_start_addr)
+// Copy 160 bytes to the OAM, done at once instead of over 160 cycles
+static void memory_dma_transfer(uint8_t val)
 {
-    uint16_t buff = 0;
-    memory_read((uint8_t *)&buff, mem_start_addr, 2);
-    return buff;
+    uint16_t source_addr = val * MEMORY_PAGE_SIZE;
+
+    for (uint16_t i = 0; i < MEMORY_OAM_SIZE; i++)
+        ppu_write_oam(MEMORY_OAM_START_ADDR + i, memory_read_8(source_addr + i));
+}
+
+// Let the owner of the register catch up and apply the side effects of the write
+static void memory_write_io(uint16_t mem_start_addr, uint8_t val)
+{
+    switch (mem_start_addr)
+    {
+    case MEMORY_REG_DIV:
+    case MEMORY_REG_TIMA:
+    case MEMORY_REG_TMA:
+    case MEMORY_REG_TAC:
+        timer_write_reg(mem_start_addr, val);
+        break;
+
+    // The lines drawn so far use the previous values
+    case MEMORY_REG_LCDC:
+    case MEMORY_REG_STAT:
+    case MEMORY_REG_SCY:
+    case MEMORY_REG_SCX:
+    case MEMORY_REG_LYC:
+    case MEMORY_REG_BGP:
+    case MEMORY_REG_OBP0:
+    case MEMORY_REG_OBP1:
+    case MEMORY_REG_WY:
+    case MEMORY_REG_WX:
+        ppu_write_reg(mem_start_addr, val);
+        break;
+
+    case MEMORY_REG_IF:
+    case MEMORY_REG_IE:
+        interrupt_write_reg(mem_start_addr, val);
+        break;
+
+    case MEMORY_REG_DMA:
+        memory[mem_start_addr] = val;
+        memory_dma_transfer(val);
+        break;
+
+    default:
+        memory[mem_start_addr] = val;
+        break;
+    }
+}
+
+uint8_t memory_read_slow(uint16_t mem_start_addr)
+{
+    // Disabled or special external RAM (RTC registers)
+    if (mem_start_addr >= MEMORY_EXTERNAL_RAM_START_ADDR && mem_start_addr < MEMORY_WRAM_START_ADDR)
+        return mbc_read_ram(mem_start_addr);
+
+    // HRAM shares its page with the I/O registers and often holds the stack
+    if (mem_start_addr >= MEMORY_HRAM_START_ADDR && mem_start_addr != MEMORY_REG_IE)
+        return memory[mem_start_addr];
+
+    if (mem_start_addr >= MEMORY_IO_START_ADDR)
+        return memory_read_io(mem_start_addr);
+
+    // Unusable range
+    if (mem_start_addr >= MEMORY_UNUSABLE_START_ADDR)
+        return 0xff;
+
+    return memory[mem_start_addr];
 }
 
 void memory_write(uint8_t buff[], uint16_t mem_start_addr, uint16_t size)
@@ -71,16 +246,70 @@ void memory_write(uint8_t buff[], uint16_t mem_start_addr, uint16_t size)
         return;
 
     memcpy(memory + mem_start_addr, buff, size);
-}
 
-inline void memory_write_8(uint16_t mem_start_addr, uint8_t val)
-{
-    memory[mem_start_addr] = val;
+    if (mem_start_addr < MEMORY_TILE_MAPS_START_ADDR && mem_start_addr + size > MEMORY_VRAM_START_ADDR)
+        ppu_invalidate_tiles();
+    if (mem_start_addr < MEMORY_UNUSABLE_START_ADDR && mem_start_addr + size > MEMORY_OAM_START_ADDR)
+        ppu_invalidate_sprites();
 }
 
-inline void memory_write_16(uint16_t mem_start_addr, uint16_t val)
+void memory_write_slow(uint16_t mem_start_addr, uint8_t val)
 {
-    memory_write((uint8_t *)&val, mem_start_addr, 2);
+    // The I/O registers share their page with HRAM but never hold code
+    uint8_t page = mem_start_addr / MEMORY_PAGE_SIZE;
+    if (code_pages[page] && (mem_start_addr < MEMORY_IO_START_ADDR || mem_start_addr >= MEMORY_HRAM_START_ADDR))
+    {
+        code_page_written(page);
+
+        if (memory_write_pages[page] != NULL)
+        {
+            memory_write_pages[page][mem_start_addr % MEMORY_PAGE_SIZE] = val;
+            return;
+        }
+    }
+
+    if (mem_start_addr >= MEMORY_HRAM_START_ADDR && mem_start_addr != MEMORY_REG_IE)
+    {
+        memory[mem_start_addr] = val;
+        return;
+    }
+
+    if (mem_start_addr >= MEMORY_IO_START_ADDR)
+    {
+        memory_write_io(mem_start_addr, val);
+        return;
+    }
+
+    // Writes to the ROM are commands for the memory bank controller
+    if (mem_start_addr < MEMORY_VRAM_START_ADDR)
+    {
+        mbc_write(mem_start_addr, val);
+        return;
+    }
+
+    if (mem_start_addr < MEMORY_EXTERNAL_RAM_START_ADDR)
+    {
+        ppu_write_vram(mem_start_addr, val);
+        return;
+    }
+
+    if (mem_start_addr >= MEMORY_EXTERNAL_RAM_START_ADDR && mem_start_addr < MEMORY_WRAM_START_ADDR)
+    {
+        mbc_write_ram(mem_start_addr, val);
+        return;
+    }
+
+    // Unusable range
+    if (mem_start_addr >= MEMORY_UNUSABLE_START_ADDR)
+        return;
+
+    if (mem_start_addr >= MEMORY_OAM_START_ADDR)
+    {
+        ppu_write_oam(mem_start_addr, val);
+        return;
+    }
+
+    memory[mem_start_addr] = val;
 }
 
 void memory_print(uint16_t mem_start_addr, uint16_t size)
@@ -98,7 +327,7 @@ void memory_print(uint16_t mem_start_addr, uint16_t size)
         if (cur_col % 2 == 0)
             fprintf(stderr, " ");
 
-        fprintf(stderr, "%02x", memory[i]);
+        fprintf(stderr, "%02x", memory_read_8(i));
 
         cur_col = (cur_col + 1) % nb_cols;
         if (cur_col == 0)
@@ -108,6 +337,16 @@ void memory_print(uint16_t mem_start_addr, uint16_t size)
         fprintf(stderr, "\n");
 }
 
+inline uint8_t memory_read_reg(uint16_t reg_addr)
+{
+    return memory[reg_addr];
+}
+
+inline void memory_write_reg(uint16_t reg_addr, uint8_t val)
+{
+    memory[reg_addr] = val;
+}
+
 inline bool memory_get_reg_value(uint16_t reg_addr, uint8_t bit)
 {
     if (bit > 7)
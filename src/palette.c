@@ -0,0 +1,38 @@
+#include <palette.h>
+
+#define SHADE_STEP 85 // 4 shades from 0xff (white) to 0 (black)
+
+palette_tables_t palette_tables = {0};
+
+uint32_t palette_encode(palette_format_t format, uint8_t red, uint8_t green, uint8_t blue)
+{
+    switch (format)
+    {
+    case PALETTE_FORMAT_ABGR1555:
+        // A | B B B B B | G G G G G | R R R R R
+        return 1 << 15 | (blue >> 3) << 10 | (green >> 3) << 5 | red >> 3;
+
+    case PALETTE_FORMAT_RGB565:
+        // R R R R R | G G G G G G | B B B B B
+        return (red >> 3) << 11 | (green >> 2) << 5 | blue >> 3;
+
+    case PALETTE_FORMAT_XRGB8888:
+        return (uint32_t)0xff << 24 | (uint32_t)red << 16 | (uint32_t)green << 8 | blue;
+
+    default:
+        return 0;
+    }
+}
+
+void palette_update(palette_id_t id, uint8_t reg)
+{
+    for (uint8_t index = 0; index < 4; index++)
+    {
+        uint8_t shade = (reg >> (index * 2)) & 0x3;
+        uint8_t level = 0xff - shade * SHADE_STEP;
+
+        palette_tables.abgr1555[id][index] = palette_encode(PALETTE_FORMAT_ABGR1555, level, level, level);
+        palette_tables.rgb565[id][index] = palette_encode(PALETTE_FORMAT_RGB565, level, level, level);
+        palette_tables.xrgb8888[id][index] = palette_encode(PALETTE_FORMAT_XRGB8888, level, level, level);
+    }
+}
@@ -3,10 +3,14 @@
 #include <memory.h>
 #include <common.h>
 #include <cpu.h>
+#include <scheduler.h>
+#include <interrupt.h>
+#include <tiles.h>
 
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/time.h>
 #include <SDL2/SDL.h>
 
@@ -17,6 +21,24 @@
 #define OAM_SCAN_DURATION (80 * 4)
 #define DRAWING_PIXELS_DURATION (172 * 4)
 #define SCAN_LINE_DURATION (OAM_SCAN_DURATION + DRAWING_PIXELS_DURATION + HBLANK_DURATION)
+#define VBLANK_START (144 * SCAN_LINE_DURATION)
+#define FRAME_DURATION (154 * SCAN_LINE_DURATION)
+
+#define TILE_SIZE 8
+#define TILE_NB_BYTES 16
+#define TILE_MAP_WIDTH 32
+#define NB_TILES 384        // 0x8000-0x97FF
+#define TILE_SIGNED_BASE 256 // Tile 0 of the 8800 addressing mode
+#define WINDOW_X_OFFSET 7
+#define OAM_NB_SPRITES 40
+#define OAM_ENTRY_SIZE 4
+#define SPRITE_Y_OFFSET 16 // Y of a sprite on the first line
+#define SPRITES_PER_LINE 10
+
+#define SPRITE_ATTR_BG_PRIORITY 7 // 0=Above BG, 1=Behind BG colors 1-3
+#define SPRITE_ATTR_Y_FLIP 6
+#define SPRITE_ATTR_X_FLIP 5
+#define SPRITE_ATTR_PALETTE 4 // 0=OBP0, 1=OBP1
 
 typedef enum
 {
@@ -26,14 +48,65 @@ typedef enum
     DRAWING_PIXELS = 3,
 } ppu_mode_t;
 
+typedef struct
+{
+    uint8_t y; // Screen Y + 16
+    uint8_t x; // Screen X + 8
+    uint8_t tile;
+    uint8_t attributes;
+} ppu_sprite_t;
+
+static void ppu_event(uint64_t deadline);
+static void render_line(uint8_t ly);
+static void index_sprite(uint8_t entry, uint8_t y, bool covers);
+#ifdef DEBUG
 static bool get_tile_data_start_addr(uint16_t *start_addr);
 static void print_tiles(void);
 static void print_bg_tiles_map(void);
 static void print_window_tiles_map(void);
+#endif
 
 ppu_mode_t ppu_mode = OAM_SCAN;
 uint64_t scan_line_clock = 0;
+static uint64_t ppu_clock = 0; // Global clock of the last update
+
+// LCD, every line is drawn when it leaves DRAWING_PIXELS
+static ppu_pixel_t framebuffer[SCREEN_WIDTH * SCREEN_HEIGHT];
+static ppu_pixel_t blank_color; // Lightest shade, whatever the palettes
+static uint8_t window_line = 0;  // Only counts the lines showing the window
+static uint64_t nb_frames = 0;
+
+/*
+    Decoded tile cache
+    Every row of the tile data is kept as 8 color indices, also in X-flipped
+    order for the sprites, and numbered from 0x8000 (tile * 8 + row). A write
+    only marks its row dirty, it is decoded again when it is next used.
+    The second VRAM bank of the CGB will double it.
+*/
+typedef struct
+{
+    uint8_t rows[NB_TILES * TILE_SIZE][TILE_SIZE];
+    uint8_t flipped_rows[NB_TILES * TILE_SIZE][TILE_SIZE];
+    bool dirty[NB_TILES * TILE_SIZE];
+} ppu_tile_cache_t;
+
+static ppu_tile_cache_t tile_cache;
+
+/*
+    Sprites of every line
+    Bit i of a line is set when OAM entry i covers it, both for 8x8 and 8x16
+    sprites so that switching the size is free. Only a write to the Y of an
+    entry moves its bits, the renderer then reads the entries of its line
+    in OAM order without looking at the others.
+*/
+typedef struct
+{
+    uint64_t lines[2][SCREEN_HEIGHT]; // 8x8 then 8x16
+} ppu_sprite_index_t;
+
+static ppu_sprite_index_t sprite_index;
 
+#ifdef DEBUG
 static struct timeval time_last_frame;
 static uint64_t diff_sum = 0;
 static uint64_t nb_frame = 0;
@@ -56,9 +129,26 @@ static SDL_Renderer *pRendererTilesWindowMap = NULL;
 static SDL_Texture *pTextureTilesWindowMap = NULL;
 static uint16_t frameBufferTilesWindowMap[WINDOW_TILES_WIDTH * WINDOW_TILES_HEIGHT];
 
+// The viewers show the color indices from black to white, in ABGR1555
+static uint16_t viewer_colors[4];
+#endif
+
 void ppu_init(void)
 {
+    palette_update(PALETTE_BGP, memory_read_reg(MEMORY_REG_BGP));
+    palette_update(PALETTE_OBP0, memory_read_reg(MEMORY_REG_OBP0));
+    palette_update(PALETTE_OBP1, memory_read_reg(MEMORY_REG_OBP1));
+
+    blank_color = palette_encode(PPU_PIXEL_FORMAT, 0xff, 0xff, 0xff);
+    for (uint32_t i = 0; i < SCREEN_WIDTH * SCREEN_HEIGHT; i++)
+        framebuffer[i] = blank_color;
+    tiles_init();
+    ppu_invalidate_tiles();
+    ppu_invalidate_sprites();
+
 #ifdef DEBUG
+    for (uint8_t index = 0; index < 4; index++)
+        viewer_colors[index] = palette_encode(PALETTE_FORMAT_ABGR1555, index * 85, index * 85, index * 85);
     gettimeofday(&time_last_frame, NULL);
 
     pWindowTiles = SDL_CreateWindow("[DEBUG] Tiles", 0, 0, WINDOW_TILES_WIDTH, WINDOW_TILES_HEIGHT, 0);
@@ -130,6 +220,10 @@ void ppu_init(void)
     SDL_SetWindowDisplayMode(pWindowTilesBGMap, &mode);
     SDL_SetWindowDisplayMode(pWindowTilesWindowMap, &mode);
 #endif
+
+    ppu_clock = scheduler_clock;
+    scheduler_register(SCHEDULER_EVENT_PPU, ppu_event);
+    scheduler_schedule(SCHEDULER_EVENT_PPU, ppu_clock + VBLANK_START);
 }
 
 void ppu_destroy(void)
@@ -147,7 +241,7 @@ void ppu_destroy(void)
 #endif
 }
 
-void ppu_execute(uint64_t clock_cycles)
+static void ppu_execute(uint64_t clock_cycles)
 {
     uint8_t ly;
     memory_read(&ly, MEMORY_REG_LY, 1);
@@ -155,93 +249,233 @@ void ppu_execute(uint64_t clock_cycles)
     // Update Clock cycles
     scan_line_clock += clock_cycles;
 
-    switch (ppu_mode)
+    // Apply every mode transition covered by the elapsed cycles
+    bool transition = true;
+    while (transition)
     {
-    case OAM_SCAN:
-        if (scan_line_clock >= OAM_SCAN_DURATION)
+        transition = false;
+
+        switch (ppu_mode)
         {
-#ifdef DEBUG
-            if (verbose & VERBOSE_PPU)
+        case OAM_SCAN:
+            if (scan_line_clock >= OAM_SCAN_DURATION)
             {
-                fprintf(stderr, P_PPU "OAM scan\n");
-            }
-#endif
+                if (verbose & VERBOSE_PPU)
+                {
+                    fprintf(stderr, P_PPU "OAM scan\n");
+                }
 
-            scan_line_clock -= OAM_SCAN_DURATION;
-            ppu_mode = DRAWING_PIXELS;
-        }
-        break;
+                scan_line_clock -= OAM_SCAN_DURATION;
+                ppu_mode = DRAWING_PIXELS;
+                transition = true;
+            }
+            break;
 
-    case DRAWING_PIXELS:
-        if (scan_line_clock >= DRAWING_PIXELS_DURATION)
-        {
-#ifdef DEBUG
-            if (verbose & VERBOSE_PPU)
+        case DRAWING_PIXELS:
+            if (scan_line_clock >= DRAWING_PIXELS_DURATION)
             {
-                fprintf(stderr, P_PPU "Drawing pixels\n");
-            }
-#endif
+                if (verbose & VERBOSE_PPU)
+                {
+                    fprintf(stderr, P_PPU "Drawing pixels\n");
+                }
 
-            scan_line_clock -= DRAWING_PIXELS_DURATION;
-            ppu_mode = HBLANK;
-        }
-        break;
+                render_line(ly);
 
-    case HBLANK:
-        if (scan_line_clock >= HBLANK_DURATION)
-        {
-#ifdef DEBUG
-            if (verbose & VERBOSE_PPU)
-            {
-                fprintf(stderr, P_PPU "HBlank\n");
+                scan_line_clock -= DRAWING_PIXELS_DURATION;
+                ppu_mode = HBLANK;
+                transition = true;
             }
-#endif
-            ly += 1;
-            memory_write_8(MEMORY_REG_LY, ly);
+            break;
 
-            scan_line_clock -= HBLANK_DURATION;
-            if (ly >= 144)
+        case HBLANK:
+            if (scan_line_clock >= HBLANK_DURATION)
             {
-                ppu_mode = VBLANK;
+                if (verbose & VERBOSE_PPU)
+                {
+                    fprintf(stderr, P_PPU "HBlank\n");
+                }
+                ly += 1;
+                memory_write_reg(MEMORY_REG_LY, ly);
+
+                scan_line_clock -= HBLANK_DURATION;
+                if (ly >= 144)
+                {
+                    ppu_mode = VBLANK;
+                    nb_frames++;
+
+                    interrupt_request(MEMORY_IEF_VBLANK);
+                    if (memory_get_reg_value(MEMORY_REG_STAT, MEMORY_STAT_VBLANK_INT))
+                        interrupt_request(MEMORY_IEF_LCD_STAT);
+                }
+                else
+                {
+                    ppu_mode = OAM_SCAN;
+                }
+                transition = true;
             }
-            else
+            break;
+
+        case VBLANK:
+            if (scan_line_clock >= SCAN_LINE_DURATION)
             {
-                ppu_mode = OAM_SCAN;
+                if (verbose & VERBOSE_PPU)
+                {
+                    fprintf(stderr, P_PPU "VBlank\n");
+                }
+                ly += 1;
+
+                if (verbose & VERBOSE_PPU)
+                {
+                    fprintf(stderr, P_PPU "LY: %u\n", ly);
+                }
+                if (ly <= 153)
+                {
+                    memory_write_reg(MEMORY_REG_LY, ly);
+                    scan_line_clock -= SCAN_LINE_DURATION;
+                }
+                else
+                {
+                    ly = 0;
+                    memory_write_reg(MEMORY_REG_LY, 0);
+                    ppu_mode = OAM_SCAN;
+                    window_line = 0;
+                }
+                transition = true;
             }
+            break;
         }
+    }
+
+    // Mode and coincidence flags are only visible through STAT
+    uint8_t stat = memory_read_reg(MEMORY_REG_STAT);
+    stat &= ~(MEMORY_STAT_MODE_MASK | (1 << MEMORY_STAT_COINCID_FLAG));
+    stat |= ppu_mode;
+    if (memory_read_reg(MEMORY_REG_LYC) == ly)
+        stat |= 1 << MEMORY_STAT_COINCID_FLAG;
+    memory_write_reg(MEMORY_REG_STAT, stat);
+}
+
+void ppu_sync(void)
+{
+    uint64_t clock_cycles = scheduler_clock - ppu_clock;
+    ppu_clock = scheduler_clock;
+
+    ppu_execute(clock_cycles);
+}
+
+uint64_t ppu_next_transition(void)
+{
+    ppu_sync();
+
+    uint64_t mode_duration;
+    switch (ppu_mode)
+    {
+    case OAM_SCAN:
+        mode_duration = OAM_SCAN_DURATION;
         break;
 
-    case VBLANK:
-        if (scan_line_clock >= SCAN_LINE_DURATION)
-        {
-#ifdef DEBUG
-            if (verbose & VERBOSE_PPU)
-            {
-                fprintf(stderr, P_PPU "VBlank\n");
-            }
-#endif
-            ly += 1;
+    case DRAWING_PIXELS:
+        mode_duration = DRAWING_PIXELS_DURATION;
+        break;
 
-            fprintf(stderr, P_PPU "LY: %u\n", ly);
-            if (ly <= 153)
-            {
-                memory_write_8(MEMORY_REG_LY, ly);
-                scan_line_clock -= SCAN_LINE_DURATION;
-            }
-            else
-            {
-                ly = 0;
-                memory_write_8(MEMORY_REG_LY, 0);
-                ppu_mode = OAM_SCAN;
-            }
-        }
+    case HBLANK:
+        mode_duration = HBLANK_DURATION;
+        break;
+
+    default:
+        // LY changes at every line of the VBlank
+        mode_duration = SCAN_LINE_DURATION;
+        break;
+    }
+
+    return ppu_clock + mode_duration - scan_line_clock;
+}
+
+const ppu_pixel_t *ppu_get_framebuffer(void)
+{
+    return framebuffer;
+}
+
+uint64_t ppu_get_nb_frames(void)
+{
+    return nb_frames;
+}
+
+void ppu_write_vram(uint16_t addr, uint8_t val)
+{
+    ppu_sync();
+
+    memory_write_reg(addr, val);
+    if (addr < MEMORY_TILE_MAPS_START_ADDR)
+        tile_cache.dirty[(addr - MEMORY_VRAM_START_ADDR) / 2] = true;
+}
+
+void ppu_invalidate_tiles(void)
+{
+    memset(tile_cache.dirty, true, sizeof(tile_cache.dirty));
+}
+
+void ppu_write_oam(uint16_t addr, uint8_t val)
+{
+    ppu_sync();
+
+    uint8_t entry = (addr - MEMORY_OAM_START_ADDR) / OAM_ENTRY_SIZE;
+    if ((addr - MEMORY_OAM_START_ADDR) % OAM_ENTRY_SIZE == 0)
+    {
+        index_sprite(entry, memory_read_reg(addr), false);
+        index_sprite(entry, val, true);
+    }
+
+    memory_write_reg(addr, val);
+}
+
+void ppu_invalidate_sprites(void)
+{
+    const uint8_t *oam = memory_get_host(MEMORY_OAM_START_ADDR);
+
+    memset(&sprite_index, 0, sizeof(sprite_index));
+    for (uint8_t entry = 0; entry < OAM_NB_SPRITES; entry++)
+        index_sprite(entry, oam[entry * OAM_ENTRY_SIZE], true);
+}
+
+void ppu_write_reg(uint16_t reg_addr, uint8_t val)
+{
+    ppu_sync();
+
+    // The mode and coincidence flags of STAT are read only
+    if (reg_addr == MEMORY_REG_STAT)
+        val = (val & ~MEMORY_STAT_READ_ONLY_MASK) | (memory_read_reg(MEMORY_REG_STAT) & MEMORY_STAT_READ_ONLY_MASK);
+
+    memory_write_reg(reg_addr, val);
+
+    switch (reg_addr)
+    {
+    case MEMORY_REG_BGP:
+        palette_update(PALETTE_BGP, val);
+        break;
+
+    case MEMORY_REG_OBP0:
+        palette_update(PALETTE_OBP0, val);
+        break;
+
+    case MEMORY_REG_OBP1:
+        palette_update(PALETTE_OBP1, val);
         break;
     }
 
+    // Refresh the coincidence flag with the new LYC
+    ppu_execute(0);
+}
+
+// Scheduled at the start of every VBlank, the PPU is otherwise only updated
+// when the CPU accesses one of its registers
+static void ppu_event(uint64_t deadline)
+{
+    ppu_sync();
+
 #ifdef DEBUG
     static uint8_t print_counter = 0;
-    if (ly == 0)
-        print_counter++;
+    print_counter++;
     if (print_counter > 20)
     {
         print_counter = 0;
@@ -251,7 +485,7 @@ void ppu_execute(uint64_t clock_cycles)
     }
 #endif
 
-    memory_write_reg_value(MEMORY_REG_STAT, MEMORY_STAT_COINCID_FLAG, (memory_read_8(MEMORY_REG_LYC) == ly));
+    scheduler_schedule(SCHEDULER_EVENT_PPU, deadline + FRAME_DURATION);
 }
 
 // void ppu_execute(uint64_t clock_cycles)
@@ -263,7 +497,7 @@ void ppu_execute(uint64_t clock_cycles)
 //     if (!lcd_on)
 //     {
 //         // fprintf(stderr, P_PPU "LCD OFF\n");
-//         memory_write_8(MEMORY_REG_LY, 0);
+//         memory_write_reg(MEMORY_REG_LY, 0);
 //         scan_line_clock = 0;
 //         return;
 //     }
@@ -275,7 +509,7 @@ void ppu_execute(uint64_t clock_cycles)
 //     {
 //         scan_line_clock -= CLOCK_CYCLES_PER_SCANLINE;
 //         ly = (ly == 153) ? 0 : ly + 1;
-//         memory_write_8(MEMORY_REG_LY, ly);
+//         memory_write_reg(MEMORY_REG_LY, ly);
 
 //         // Render Scan lines (144 pixels in height)
 //         if (ly < 144)
@@ -342,6 +576,7 @@ void ppu_execute(uint64_t clock_cycles)
 //     }
 // }
 
+#ifdef DEBUG
 // Return True if the tile number is a signed integer
 static bool get_tile_data_start_addr(uint16_t *start_addr)
 {
@@ -357,6 +592,7 @@ static bool get_tile_data_start_addr(uint16_t *start_addr)
         return true;
     }
 }
+#endif
 
 static void get_tile_bg_map_start_addr(uint16_t *start_addr)
 {
@@ -374,56 +610,253 @@ static void get_tile_window_map_start_addr(uint16_t *start_addr)
         *start_addr = 0x9800;
 }
 
-static void decode_tile_line(uint8_t line[2], uint8_t decoded_line[8])
+static void decode_cached_rows(uint16_t first_row, uint16_t nb_rows)
 {
-    for (int8_t bit = 7; bit >= 0; bit--)
+    const uint8_t *rows = memory_get_host(MEMORY_VRAM_START_ADDR + first_row * 2);
+    if (nb_rows == 1)
+        tiles_decode_row(rows, tile_cache.rows[first_row]);
+    else
+        tiles_decode_rows(rows, nb_rows, tile_cache.rows[first_row]);
+
+    // A flipped row has its 8 indices in reverse order
+    for (uint16_t i = first_row; i < first_row + nb_rows; i++)
     {
-        uint8_t mask = 1 << bit;
-        uint8_t bit_right = (line[0] & mask) >> bit;
-        uint8_t bit_left = (line[1] & mask) >> bit;
+        uint64_t pixels;
+        memcpy(&pixels, tile_cache.rows[i], TILE_SIZE);
+        pixels = __builtin_bswap64(pixels);
+        memcpy(tile_cache.flipped_rows[i], &pixels, TILE_SIZE);
+        tile_cache.dirty[i] = false;
+    }
+}
 
-        decoded_line[7 - bit] = (bit_left << 1) | (bit_right);
+#ifdef DEBUG
+// Decode every dirty row before reading the whole cache, consecutive rows
+// are decoded at once
+static void refresh_tile_cache(void)
+{
+    uint16_t row = 0;
+    while (row < NB_TILES * TILE_SIZE)
+    {
+        uint16_t end = row;
+        while (end < NB_TILES * TILE_SIZE && tile_cache.dirty[end])
+            end++;
+
+        if (end > row)
+            decode_cached_rows(row, end - row);
+        row = end + 1;
     }
 }
+#endif
 
-static void get_tile_from_index(uint8_t index, uint8_t tile[16])
+// Decoded row of a tile numbered from 0x8000
+static inline const uint8_t *get_tile_row(uint16_t tile, uint8_t row, bool x_flip)
+{
+    uint16_t i = tile * TILE_SIZE + row;
+
+    // The following rows are likely drawn next, a whole dirty run is decoded
+    // at once through the SIMD decoder
+    if (tile_cache.dirty[i])
+    {
+        uint16_t end = i + 1;
+        while (end < NB_TILES * TILE_SIZE && tile_cache.dirty[end])
+            end++;
+        decode_cached_rows(i, end - i);
+    }
+
+    return x_flip ? tile_cache.flipped_rows[i] : tile_cache.rows[i];
+}
+
+// Tile of a map entry, the signed indices are relative to 0x9000
+static inline uint16_t get_map_tile(uint8_t index, bool signed_addr)
+{
+    return signed_addr ? TILE_SIGNED_BASE + (int8_t)index : index;
+}
+
+#ifdef DEBUG
+static uint16_t get_tile_from_index(uint8_t index)
 {
     uint16_t start_addr;
     bool signed_addr = get_tile_data_start_addr(&start_addr);
 
-    if (index < 128)
+    return get_map_tile(index, signed_addr);
+}
+#endif
+
+// Copy the decoded row of nb_tiles consecutive tiles of a map line,
+// wrapping around the map
+static void fetch_tiles(const uint8_t *map_line, uint8_t first_column, uint8_t nb_tiles, uint8_t row, bool signed_addr, uint8_t *indices)
+{
+    for (uint8_t i = 0; i < nb_tiles; i++)
     {
-        uint16_t offset = 0;
-        if (signed_addr)
-            offset = 128;
+        uint8_t index = map_line[(first_column + i) % TILE_MAP_WIDTH];
+        memcpy(indices + i * TILE_SIZE, get_tile_row(get_map_tile(index, signed_addr), row, false), TILE_SIZE);
+    }
+}
 
-        memory_read(tile, start_addr + offset + index * 16, 16);
+// Set or clear an OAM entry in the lines its Y covers
+static void index_sprite(uint8_t entry, uint8_t y, bool covers)
+{
+    uint64_t bit = (uint64_t)1 << entry;
+
+    for (uint8_t tall = 0; tall < 2; tall++)
+    {
+        int16_t first = y - SPRITE_Y_OFFSET;
+        int16_t last = first + (tall ? 2 * TILE_SIZE : TILE_SIZE) - 1;
+        if (first < 0)
+            first = 0;
+        if (last >= SCREEN_HEIGHT)
+            last = SCREEN_HEIGHT - 1;
+
+        for (int16_t ly = first; ly <= last; ly++)
+        {
+            if (covers)
+                sprite_index.lines[tall][ly] |= bit;
+            else
+                sprite_index.lines[tall][ly] &= ~bit;
+        }
     }
-    else
+}
+
+// Keep the first SPRITES_PER_LINE sprites of the line, the smallest X is
+// drawn on top then the first in OAM
+static uint8_t select_sprites(uint8_t ly, uint8_t height, ppu_sprite_t sprites[SPRITES_PER_LINE])
+{
+    const uint8_t *oam = memory_get_host(MEMORY_OAM_START_ADDR);
+    uint64_t entries = sprite_index.lines[height != TILE_SIZE][ly];
+    uint8_t nb_sprites = 0;
+
+    while (entries && nb_sprites < SPRITES_PER_LINE)
+    {
+        uint8_t entry = __builtin_ctzll(entries);
+        entries &= entries - 1;
+
+        const uint8_t *attributes = oam + entry * OAM_ENTRY_SIZE;
+        ppu_sprite_t sprite = {attributes[0], attributes[1], attributes[2], attributes[3]};
+
+        // Insertion by X, after the sprites of the same X
+        uint8_t pos = nb_sprites++;
+        while (pos > 0 && sprites[pos - 1].x > sprite.x)
+        {
+            sprites[pos] = sprites[pos - 1];
+            pos--;
+        }
+        sprites[pos] = sprite;
+    }
+
+    return nb_sprites;
+}
+
+static void render_sprites(uint8_t ly, uint8_t lcdc, const uint8_t bg_indices[SCREEN_WIDTH], ppu_pixel_t *line)
+{
+    uint8_t height = (lcdc & (1 << MEMORY_LCDC_OBJ_SIZE)) ? 2 * TILE_SIZE : TILE_SIZE;
+    ppu_sprite_t sprites[SPRITES_PER_LINE];
+    uint8_t nb_sprites = select_sprites(ly, height, sprites);
+    if (!nb_sprites)
+        return;
+
+    const ppu_pixel_t *palettes[2] = {PPU_PALETTE(PALETTE_OBP0), PPU_PALETTE(PALETTE_OBP1)};
+
+    // A pixel belongs to the first sprite with a color there, even when it
+    // is hidden behind the background
+    bool taken[SCREEN_WIDTH] = {false};
+
+    for (uint8_t i = 0; i < nb_sprites; i++)
     {
-        memory_read(tile, start_addr + index * 16, 16);
+        const ppu_sprite_t *sprite = &sprites[i];
+        uint8_t row = ly + SPRITE_Y_OFFSET - sprite->y;
+        if (sprite->attributes & (1 << SPRITE_ATTR_Y_FLIP))
+            row = height - 1 - row;
+
+        // The row of a 8x16 sprite may be in the second tile
+        uint8_t tile = height == TILE_SIZE ? sprite->tile : sprite->tile & 0xfe;
+        const uint8_t *indices = get_tile_row(tile + row / TILE_SIZE, row % TILE_SIZE, sprite->attributes & (1 << SPRITE_ATTR_X_FLIP));
+
+        bool behind_bg = sprite->attributes & (1 << SPRITE_ATTR_BG_PRIORITY);
+        const ppu_pixel_t *palette = palettes[(sprite->attributes >> SPRITE_ATTR_PALETTE) & 1];
+
+        for (uint8_t pixel = 0; pixel < TILE_SIZE; pixel++)
+        {
+            int16_t x = sprite->x - TILE_SIZE + pixel;
+            uint8_t index = indices[pixel];
+            if (x < 0 || x >= SCREEN_WIDTH || !index || taken[x])
+                continue;
+
+            taken[x] = true;
+            if (!behind_bg || !bg_indices[x])
+                line[x] = palette[index];
+        }
     }
 }
 
-static uint16_t rgba2abgr1555(uint8_t red, uint8_t green, uint8_t blue, uint8_t alpha)
+/*
+    Whole line at once: the background and the window tiles of the line are
+    decoded to color indices in a row, then go through the palette in a
+    single pass before the sprites are drawn over them.
+*/
+static void render_line(uint8_t ly)
 {
-    /*
-        ABGR1555 Encoding
-                R         | G         | B         | A
-        16bit | 1 1 1 1 1 | 1 1 1 1 1 | 1 1 1 1 1 | 1
-    */
+    ppu_pixel_t *line = framebuffer + ly * SCREEN_WIDTH;
+    uint8_t lcdc = memory_read_reg(MEMORY_REG_LCDC);
 
-    float colorAjust = 0xff / 0x1f;
+    if (!(lcdc & (1 << MEMORY_LCDC_PPU_ENABLED)))
+    {
+        for (uint8_t x = 0; x < SCREEN_WIDTH; x++)
+            line[x] = blank_color;
+        return;
+    }
+
+    const uint8_t *vram = memory_get_host(MEMORY_VRAM_START_ADDR); // Tile maps
+    bool signed_addr = !(lcdc & (1 << MEMORY_LCDC_BG_AND_WINDOW_TILE_DATA_AREA));
 
-    uint16_t color = 0;
-    color |= (alpha > 128) ? 1 : 0;
-    color |= (uint16_t)(blue / colorAjust) << 1;
-    color |= (uint16_t)(green / colorAjust) << 6;
-    color |= (uint16_t)(red / colorAjust) << 11;
+    // One more tile for the fine scrolling
+    uint8_t indices[SCREEN_WIDTH + 2 * TILE_SIZE] = {0};
+    uint8_t *bg_indices = indices;
 
-    return color;
+    // Disabling the background blanks the window too
+    if (!(lcdc & (1 << MEMORY_LCDC_BG_AND_WINDOW_ENABLED)))
+    {
+        for (uint8_t x = 0; x < SCREEN_WIDTH; x++)
+            line[x] = blank_color;
+    }
+    else
+    {
+        uint16_t map_addr;
+        uint8_t y = memory_read_reg(MEMORY_REG_SCY) + ly;
+        uint8_t scx = memory_read_reg(MEMORY_REG_SCX);
+
+        get_tile_bg_map_start_addr(&map_addr);
+        fetch_tiles(vram + map_addr - MEMORY_VRAM_START_ADDR + (y / TILE_SIZE) * TILE_MAP_WIDTH,
+                    scx / TILE_SIZE, SCREEN_WIDTH / TILE_SIZE + 1, y % TILE_SIZE, signed_addr, indices);
+        bg_indices = indices + scx % TILE_SIZE;
+
+        uint8_t wy = memory_read_reg(MEMORY_REG_WY);
+        uint8_t wx = memory_read_reg(MEMORY_REG_WX);
+        if ((lcdc & (1 << MEMORY_LCDC_WINDOW_ENABLED)) && ly >= wy && wx < SCREEN_WIDTH + WINDOW_X_OFFSET)
+        {
+            uint8_t window_indices[SCREEN_WIDTH + TILE_SIZE];
+
+            get_tile_window_map_start_addr(&map_addr);
+            fetch_tiles(vram + map_addr - MEMORY_VRAM_START_ADDR + (window_line / TILE_SIZE) * TILE_MAP_WIDTH,
+                        0, SCREEN_WIDTH / TILE_SIZE + 1, window_line % TILE_SIZE, signed_addr, window_indices);
+            window_line++;
+
+            // WX below 7 hides the first columns of the window
+            uint8_t start = wx > WINDOW_X_OFFSET ? wx - WINDOW_X_OFFSET : 0;
+            uint8_t skip = wx < WINDOW_X_OFFSET ? WINDOW_X_OFFSET - wx : 0;
+            for (uint8_t x = start; x < SCREEN_WIDTH; x++)
+                bg_indices[x] = window_indices[x - start + skip];
+        }
+
+        const ppu_pixel_t *colors = PPU_PALETTE(PALETTE_BGP);
+        for (uint8_t x = 0; x < SCREEN_WIDTH; x++)
+            line[x] = colors[bg_indices[x]];
+    }
+
+    if (lcdc & (1 << MEMORY_LCDC_OBJ_ENABLED))
+        render_sprites(ly, lcdc, bg_indices, line);
 }
 
+#ifdef DEBUG
 static void print_tiles(void)
 {
     uint16_t start_addr;
@@ -433,6 +866,8 @@ static void print_tiles(void)
     if (verbose & VERBOSE_PPU)
         fprintf(stderr, P_PPU "Tiles start addr: 0x%x, Signed:%d\n", start_addr, signed_addr);
 
+    refresh_tile_cache();
+
     uint16_t offset = 0;
     if (signed_addr)
         offset = 128;
@@ -443,8 +878,7 @@ static void print_tiles(void)
     // Display Bank 0/2
     for (uint16_t i = 0; i < 128; i++)
     {
-        uint8_t tile[16];
-        memory_read(tile, start_addr + offset + i * 16, 16);
+        uint16_t tile = (start_addr + offset - MEMORY_VRAM_START_ADDR) / TILE_NB_BYTES + i;
 
         // for (uint8_t j = 0; j < 16; j++)
         //     fprintf(stderr, "%02x", tile[j]);
@@ -452,14 +886,12 @@ static void print_tiles(void)
 
         for (uint8_t j = 0; j < 16; j += 2)
         {
-            uint8_t decoded_line[8];
-            decode_tile_line(&tile[j], decoded_line);
+            const uint8_t *decoded_line = get_tile_row(tile, j / 2, false);
 
             for (uint8_t pixel = 0; pixel < 8; pixel++)
             {
                 // fprintf(stderr, "%d ", decoded_line[pixel]);
-                uint8_t tmp_color = decoded_line[pixel] * 85;
-                uint16_t color = rgba2abgr1555(tmp_color, tmp_color, tmp_color, 255);
+                uint16_t color = viewer_colors[decoded_line[pixel]];
 
                 uint32_t x = ((i % 16) * 8) + pixel;
                 uint32_t y = ((i / 16) * 8) + (j / 2);
@@ -487,8 +919,7 @@ static void print_tiles(void)
     // Display Bank 1
     for (uint16_t i = 0; i < 128; i++)
     {
-        uint8_t tile[16];
-        memory_read(tile, start_addr + 128 + i * 16, 16);
+        uint16_t tile = (start_addr + 128 - MEMORY_VRAM_START_ADDR) / TILE_NB_BYTES + i;
 
         // for (uint8_t j = 0; j < 16; j++)
         //     fprintf(stderr, "%02x", tile[j]);
@@ -496,13 +927,11 @@ static void print_tiles(void)
 
         for (uint8_t j = 0; j < 16; j += 2)
         {
-            uint8_t decoded_line[8];
-            decode_tile_line(&tile[j], decoded_line);
+            const uint8_t *decoded_line = get_tile_row(tile, j / 2, false);
 
             for (uint8_t pixel = 0; pixel < 8; pixel++)
             {
-                uint8_t tmp_color = decoded_line[pixel] * 85;
-                uint16_t color = rgba2abgr1555(tmp_color, tmp_color, tmp_color, 255);
+                uint16_t color = viewer_colors[decoded_line[pixel]];
 
                 uint32_t x = ((i % 16) * 8) + pixel;
                 uint32_t y = ((i / 16) * 8) + (j / 2);
@@ -544,6 +973,8 @@ static void print_bg_tiles_map(void)
     if (verbose & VERBOSE_PPU)
         fprintf(stderr, P_PPU "Tiles BG Map start addr: 0x%x\n", bg_map_addr);
 
+    refresh_tile_cache();
+
     // SDL_SetRenderDrawColor(pRendererTilesBGMap, 255, 255, 255, 0);
     // SDL_RenderClear(pRendererTilesBGMap);
 
@@ -552,21 +983,18 @@ static void print_bg_tiles_map(void)
         for (uint8_t x = 0; x < 32; x++)
         {
             // fprintf(stderr, "%02x", memory_read_8(bg_map_addr + x + y));
-            uint8_t tile[16];
             uint8_t index = memory_read_8(bg_map_addr + y * 32 + x);
 
-            get_tile_from_index(index, tile);
+            uint16_t tile = get_tile_from_index(index);
 
             for (uint8_t j = 0; j < 16; j += 2)
             {
-                uint8_t decoded_line[8];
-                decode_tile_line(&tile[j], decoded_line);
+                const uint8_t *decoded_line = get_tile_row(tile, j / 2, false);
 
                 for (uint8_t pixel = 0; pixel < 8; pixel++)
                 {
                     // fprintf(stderr, "%d ", decoded_line[pixel]);
-                    uint8_t tmp_color = decoded_line[pixel] * 85;
-                    uint16_t color = rgba2abgr1555(tmp_color, tmp_color, tmp_color, 255);
+                    uint16_t color = viewer_colors[decoded_line[pixel]];
 
                     uint32_t x_display = (x * 8) + pixel;
                     uint32_t y_display = (y * 8) + (j / 2);
@@ -611,6 +1039,8 @@ static void print_window_tiles_map(void)
     if (verbose & VERBOSE_PPU)
         fprintf(stderr, P_PPU "Tiles Window Map start addr: 0x%x\n", window_map_addr);
 
+    refresh_tile_cache();
+
     // SDL_SetRenderDrawColor(pRendererTilesWindowMap, 255, 255, 255, 0);
     // SDL_RenderClear(pRendererTilesWindowMap);
 
@@ -619,21 +1049,18 @@ static void print_window_tiles_map(void)
         for (uint8_t x = 0; x < 32; x++)
         {
             // fprintf(stderr, "%02x", memory_read_8(window_map_addr + x + y));
-            uint8_t tile[16];
             uint8_t index = memory_read_8(window_map_addr + y * 32 + x);
 
-            get_tile_from_index(index, tile);
+            uint16_t tile = get_tile_from_index(index);
 
             for (uint8_t j = 0; j < 16; j += 2)
             {
-                uint8_t decoded_line[8];
-                decode_tile_line(&tile[j], decoded_line);
+                const uint8_t *decoded_line = get_tile_row(tile, j / 2, false);
 
                 for (uint8_t pixel = 0; pixel < 8; pixel++)
                 {
                     // fprintf(stderr, "%d ", decoded_line[pixel]);
-                    uint8_t tmp_color = decoded_line[pixel] * 85;
-                    uint16_t color = rgba2abgr1555(tmp_color, tmp_color, tmp_color, 255);
+                    uint16_t color = viewer_colors[decoded_line[pixel]];
 
                     uint32_t x_display = (x * 8) + pixel;
                     uint32_t y_display = (y * 8) + (j / 2);
@@ -669,4 +1096,5 @@ static void print_window_tiles_map(void)
 
     SDL_RenderCopy(pRendererTilesWindowMap, pTextureTilesWindowMap, NULL, NULL);
     SDL_RenderPresent(pRendererTilesWindowMap);
-}
\ No newline at end of file
+}
+#endif
@@ -0,0 +1,169 @@
+#include <scheduler.h>
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <common.h>
+
+/*
+    Pending events are kept in a binary min-heap ordered by deadline.
+    There is at most one pending occurrence per event, so the heap stores
+    event ids and every event remembers its own position in the heap.
+*/
+typedef struct
+{
+    scheduler_callback_t callback;
+    uint64_t deadline;
+    uint8_t heap_index;
+    bool pending;
+} scheduler_entry_t;
+
+uint64_t scheduler_clock = 0;                      // Extern
+uint64_t scheduler_deadline = SCHEDULER_NO_EVENT; // Extern
+
+static scheduler_entry_t events[SCHEDULER_EVENT_COUNT];
+static scheduler_event_t heap[SCHEDULER_EVENT_COUNT];
+static uint8_t heap_size = 0;
+
+static void heap_swap(uint8_t a, uint8_t b)
+{
+    scheduler_event_t tmp = heap[a];
+    heap[a] = heap[b];
+    heap[b] = tmp;
+
+    events[heap[a]].heap_index = a;
+    events[heap[b]].heap_index = b;
+}
+
+static void heap_sift_up(uint8_t index)
+{
+    while (index > 0)
+    {
+        uint8_t parent = (index - 1) / 2;
+        if (events[heap[parent]].deadline <= events[heap[index]].deadline)
+            break;
+
+        heap_swap(index, parent);
+        index = parent;
+    }
+}
+
+static void heap_sift_down(uint8_t index)
+{
+    while (true)
+    {
+        uint8_t smallest = index;
+        uint8_t left = 2 * index + 1;
+        uint8_t right = 2 * index + 2;
+
+        if (left < heap_size && events[heap[left]].deadline < events[heap[smallest]].deadline)
+            smallest = left;
+        if (right < heap_size && events[heap[right]].deadline < events[heap[smallest]].deadline)
+            smallest = right;
+
+        if (smallest == index)
+            break;
+
+        heap_swap(index, smallest);
+        index = smallest;
+    }
+}
+
+static void update_deadline(void)
+{
+    if (heap_size == 0)
+        scheduler_deadline = SCHEDULER_NO_EVENT;
+    else
+        scheduler_deadline = events[heap[0]].deadline;
+}
+
+static void heap_remove(uint8_t index)
+{
+    heap_size--;
+    if (index == heap_size)
+        return;
+
+    heap_swap(index, heap_size);
+
+    // The last event now fills the hole, move it up or down as needed
+    scheduler_event_t moved = heap[index];
+    heap_sift_up(index);
+    heap_sift_down(events[moved].heap_index);
+}
+
+void scheduler_init(void)
+{
+    scheduler_clock = 0;
+    scheduler_deadline = SCHEDULER_NO_EVENT;
+    heap_size = 0;
+
+    for (uint8_t i = 0; i < SCHEDULER_EVENT_COUNT; i++)
+    {
+        events[i].callback = NULL;
+        events[i].deadline = SCHEDULER_NO_EVENT;
+        events[i].pending = false;
+    }
+}
+
+void scheduler_register(scheduler_event_t event, scheduler_callback_t callback)
+{
+    events[event].callback = callback;
+}
+
+void scheduler_schedule(scheduler_event_t event, uint64_t deadline)
+{
+    scheduler_entry_t *entry = &events[event];
+
+    if (entry->callback == NULL)
+    {
+        fprintf(stderr, P_FATAL "No callback registered for scheduler event %u\n", event);
+        exit(EXIT_FAILURE);
+    }
+
+    entry->deadline = deadline;
+
+    if (!entry->pending)
+    {
+        entry->pending = true;
+        entry->heap_index = heap_size;
+        heap[heap_size++] = event;
+    }
+
+    heap_sift_up(entry->heap_index);
+    heap_sift_down(entry->heap_index);
+    update_deadline();
+}
+
+void scheduler_cancel(scheduler_event_t event)
+{
+    scheduler_entry_t *entry = &events[event];
+
+    if (!entry->pending)
+        return;
+
+    entry->pending = false;
+    heap_remove(entry->heap_index);
+    update_deadline();
+}
+
+uint64_t scheduler_next_deadline(void)
+{
+    return scheduler_deadline;
+}
+
+void scheduler_run_events(void)
+{
+    while (scheduler_deadline <= scheduler_clock)
+    {
+        scheduler_event_t event = heap[0];
+        scheduler_entry_t *entry = &events[event];
+
+        // Remove it first, the callback is allowed to schedule it again
+        entry->pending = false;
+        heap_remove(0);
+        update_deadline();
+
+        entry->callback(entry->deadline);
+    }
+}
\ No newline at end of file
@@ -0,0 +1,156 @@
+#include <tiles.h>
+
+#include <stddef.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#define ROW_NB_BYTES 2
+#define ROW_NB_PIXELS 8
+
+const char *const tiles_decoder_names[TILES_DECODER_COUNT] = {
+    [TILES_DECODER_SCALAR] = "scalar",
+    [TILES_DECODER_SSE2] = "sse2",
+    [TILES_DECODER_AVX2] = "avx2",
+};
+
+static void decode_rows_scalar(const uint8_t *rows, uint32_t nb_rows, uint8_t *indices)
+{
+    for (uint32_t i = 0; i < nb_rows; i++)
+        tiles_decode_row(rows + i * ROW_NB_BYTES, indices + i * ROW_NB_PIXELS);
+}
+
+#if defined(__x86_64__)
+/*
+    A vector holding the low plane of a row 8 times then its high plane 8
+    times is compared to the bit of every pixel, which gives 0xff per set
+    bit. Masking with 1 and 2 and merging both halves gives the indices.
+*/
+#define PIXEL_BITS 0x0102040810204080ULL // Bit 7 first in memory
+#define PLANE_VALUES 0x0202020202020202LL, 0x0101010101010101LL
+
+// Indices of 2 rows, each given as its planes spread over 8 bytes
+static inline __m128i sse2_merge_rows(__m128i row_0, __m128i row_1)
+{
+    const __m128i bits = _mm_set1_epi64x(PIXEL_BITS);
+    const __m128i values = _mm_set_epi64x(PLANE_VALUES);
+
+    row_0 = _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(row_0, bits), bits), values);
+    row_1 = _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(row_1, bits), bits), values);
+
+    return _mm_or_si128(_mm_unpacklo_epi64(row_0, row_1), _mm_unpackhi_epi64(row_0, row_1));
+}
+
+static void decode_rows_sse2(const uint8_t *rows, uint32_t nb_rows, uint8_t *indices)
+{
+    uint32_t i = 0;
+    for (; i + 8 <= nb_rows; i += 8)
+    {
+        // L0 H0 L1 H1 ... L7 H7, every byte is repeated until it fills 8 bytes
+        __m128i planes = _mm_loadu_si128((const __m128i *)(rows + i * ROW_NB_BYTES));
+        __m128i planes_0_3 = _mm_unpacklo_epi8(planes, planes);
+        __m128i planes_4_7 = _mm_unpackhi_epi8(planes, planes);
+        __m128i planes_0_1 = _mm_unpacklo_epi16(planes_0_3, planes_0_3);
+        __m128i planes_2_3 = _mm_unpackhi_epi16(planes_0_3, planes_0_3);
+        __m128i planes_4_5 = _mm_unpacklo_epi16(planes_4_7, planes_4_7);
+        __m128i planes_6_7 = _mm_unpackhi_epi16(planes_4_7, planes_4_7);
+
+        __m128i *out = (__m128i *)(indices + i * ROW_NB_PIXELS);
+        _mm_storeu_si128(out, sse2_merge_rows(_mm_unpacklo_epi32(planes_0_1, planes_0_1), _mm_unpackhi_epi32(planes_0_1, planes_0_1)));
+        _mm_storeu_si128(out + 1, sse2_merge_rows(_mm_unpacklo_epi32(planes_2_3, planes_2_3), _mm_unpackhi_epi32(planes_2_3, planes_2_3)));
+        _mm_storeu_si128(out + 2, sse2_merge_rows(_mm_unpacklo_epi32(planes_4_5, planes_4_5), _mm_unpackhi_epi32(planes_4_5, planes_4_5)));
+        _mm_storeu_si128(out + 3, sse2_merge_rows(_mm_unpacklo_epi32(planes_6_7, planes_6_7), _mm_unpackhi_epi32(planes_6_7, planes_6_7)));
+    }
+
+    decode_rows_scalar(rows + i * ROW_NB_BYTES, nb_rows - i, indices + i * ROW_NB_PIXELS);
+}
+
+// Spread the planes of row k of each 128 bits lane (k from 0 to 7)
+#define AVX2_SPREAD(k)                                                       \
+    _mm256_setr_epi8(2 * k, 2 * k, 2 * k, 2 * k, 2 * k, 2 * k, 2 * k, 2 * k, \
+                     2 * k + 1, 2 * k + 1, 2 * k + 1, 2 * k + 1,             \
+                     2 * k + 1, 2 * k + 1, 2 * k + 1, 2 * k + 1,             \
+                     2 * k, 2 * k, 2 * k, 2 * k, 2 * k, 2 * k, 2 * k, 2 * k, \
+                     2 * k + 1, 2 * k + 1, 2 * k + 1, 2 * k + 1,             \
+                     2 * k + 1, 2 * k + 1, 2 * k + 1, 2 * k + 1)
+
+__attribute__((target("avx2"))) static inline __m256i avx2_spread_row(__m256i planes, __m256i spread)
+{
+    const __m256i bits = _mm256_set1_epi64x(PIXEL_BITS);
+    const __m256i values = _mm256_set_epi64x(PLANE_VALUES, PLANE_VALUES);
+
+    __m256i row = _mm256_shuffle_epi8(planes, spread);
+    return _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_and_si256(row, bits), bits), values);
+}
+
+// Rows k and k + 1 of both lanes, the second lane holds the rows 8 further
+__attribute__((target("avx2"))) static inline void avx2_store_rows(__m256i planes, __m256i spread_0, __m256i spread_1, uint8_t *indices)
+{
+    __m256i row_0 = avx2_spread_row(planes, spread_0);
+    __m256i row_1 = avx2_spread_row(planes, spread_1);
+    __m256i merged = _mm256_or_si256(_mm256_unpacklo_epi64(row_0, row_1), _mm256_unpackhi_epi64(row_0, row_1));
+
+    _mm_storeu_si128((__m128i *)indices, _mm256_castsi256_si128(merged));
+    _mm_storeu_si128((__m128i *)(indices + 8 * ROW_NB_PIXELS), _mm256_extracti128_si256(merged, 1));
+}
+
+__attribute__((target("avx2"))) static void decode_rows_avx2(const uint8_t *rows, uint32_t nb_rows, uint8_t *indices)
+{
+    uint32_t i = 0;
+    for (; i + 16 <= nb_rows; i += 16)
+    {
+        __m256i planes = _mm256_loadu_si256((const __m256i *)(rows + i * ROW_NB_BYTES));
+        uint8_t *out = indices + i * ROW_NB_PIXELS;
+
+        avx2_store_rows(planes, AVX2_SPREAD(0), AVX2_SPREAD(1), out);
+        avx2_store_rows(planes, AVX2_SPREAD(2), AVX2_SPREAD(3), out + 2 * ROW_NB_PIXELS);
+        avx2_store_rows(planes, AVX2_SPREAD(4), AVX2_SPREAD(5), out + 4 * ROW_NB_PIXELS);
+        avx2_store_rows(planes, AVX2_SPREAD(6), AVX2_SPREAD(7), out + 6 * ROW_NB_PIXELS);
+    }
+
+    decode_rows_sse2(rows + i * ROW_NB_BYTES, nb_rows - i, indices + i * ROW_NB_PIXELS);
+}
+#endif
+
+static tiles_decoder_t decoder = decode_rows_scalar;
+
+tiles_decoder_t tiles_get_decoder(tiles_decoder_kind_t kind)
+{
+    switch (kind)
+    {
+    case TILES_DECODER_SCALAR:
+        return decode_rows_scalar;
+
+#if defined(__x86_64__)
+    // SSE2 is part of x86-64
+    case TILES_DECODER_SSE2:
+        return decode_rows_sse2;
+
+    case TILES_DECODER_AVX2:
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2") ? decode_rows_avx2 : NULL;
+#endif
+
+    default:
+        return NULL;
+    }
+}
+
+void tiles_init(void)
+{
+    for (int8_t kind = TILES_DECODER_COUNT - 1; kind >= 0; kind--)
+    {
+        tiles_decoder_t best = tiles_get_decoder(kind);
+        if (best != NULL)
+        {
+            decoder = best;
+            return;
+        }
+    }
+}
+
+void tiles_decode_rows(const uint8_t *rows, uint32_t nb_rows, uint8_t *indices)
+{
+    decoder(rows, nb_rows, indices);
+}
@@ -6,17 +6,19 @@
 #include <memory.h>
 #include <common.h>
 #include <cpu.h>
+#include <scheduler.h>
+#include <interrupt.h>
 
-static uint64_t tima_clock = 0;
+#define DIV_CLOCK_SPEED 256
 
-void timer_init(void)
-{
-    ;
-}
+static void timer_event(uint64_t deadline);
+
+static uint64_t div_clock = 0;  // Clock of the last DIV reset
+static uint64_t tima_clock = 0; // Clock of the last TIMA increment
 
 static uint64_t get_clock_speed(void)
 {
-    uint8_t select_clock = memory_read_8(MEMORY_REG_TAC) & MEMORY_TAC_INPUT_CLOCK_MASK;
+    uint8_t select_clock = memory_read_reg(MEMORY_REG_TAC) & MEMORY_TAC_INPUT_CLOCK_MASK;
 
     uint64_t clock_speed = 1;
 
@@ -42,41 +44,89 @@ static uint64_t get_clock_speed(void)
     return clock_speed;
 }
 
-void timer_execute(uint64_t clock_cycles)
+// Schedule the next TIMA overflow, the only time the timer has to act on its own
+static void timer_schedule(void)
 {
     bool timer_on = memory_get_reg_value(MEMORY_REG_TAC, MEMORY_TAC_TIMER_ENABLED);
     if (!timer_on)
     {
-        tima_clock = 0;
+        scheduler_cancel(SCHEDULER_EVENT_TIMER);
         return;
     }
 
-    tima_clock += clock_cycles;
+    uint64_t increments_to_overflow = 0x100 - memory_read_reg(MEMORY_REG_TIMA);
+    scheduler_schedule(SCHEDULER_EVENT_TIMER, tima_clock + increments_to_overflow * get_clock_speed());
+}
+
+void timer_init(void)
+{
+    div_clock = scheduler_clock;
+    tima_clock = scheduler_clock;
 
-    uint64_t clock_speed = get_clock_speed();
-    if (tima_clock >= clock_speed)
+    scheduler_register(SCHEDULER_EVENT_TIMER, timer_event);
+    timer_schedule();
+}
+
+void timer_sync(void)
+{
+    memory_write_reg(MEMORY_REG_DIV, (scheduler_clock - div_clock) / DIV_CLOCK_SPEED);
+
+    bool timer_on = memory_get_reg_value(MEMORY_REG_TAC, MEMORY_TAC_TIMER_ENABLED);
+    if (!timer_on)
     {
-        clock_speed = 0;
+        tima_clock = scheduler_clock;
+        return;
+    }
 
-        uint8_t timer_counter = memory_read_8(MEMORY_REG_TIMA);
-        if (timer_counter == 0xff)
-        {
-#ifdef DEBUG
-            if (verbose & VERBOSE_TIMER)
-            {
-                fprintf(stderr, P_TIMER "Request Timer Interrupt\n");
-            }
-#endif
-
-            uint8_t tma_value = memory_read_8(MEMORY_REG_TMA);
-            memory_write_8(MEMORY_REG_TIMA, tma_value);
-
-            // Request Timer Interrupt
-            memory_write_reg_value(MEMORY_REG_IF, MEMORY_IEF_TIMER, true);
-        }
-        else
+    uint64_t clock_speed = get_clock_speed();
+    uint64_t increments = (scheduler_clock - tima_clock) / clock_speed;
+    tima_clock += increments * clock_speed;
+
+    uint8_t timer_counter = memory_read_reg(MEMORY_REG_TIMA);
+    while (increments >= (uint64_t)(0x100 - timer_counter))
+    {
+        if (verbose & VERBOSE_TIMER)
         {
-            memory_write_8(MEMORY_REG_TIMA, timer_counter + 1);
+            fprintf(stderr, P_TIMER "Request Timer Interrupt\n");
         }
+
+        increments -= 0x100 - timer_counter;
+        timer_counter = memory_read_reg(MEMORY_REG_TMA);
+
+        interrupt_request(MEMORY_IEF_TIMER);
     }
+    timer_counter += increments;
+
+    memory_write_reg(MEMORY_REG_TIMA, timer_counter);
+}
+
+void timer_write_reg(uint16_t reg_addr, uint8_t val)
+{
+    timer_sync();
+
+    switch (reg_addr)
+    {
+    case MEMORY_REG_DIV:
+        // Any write resets DIV
+        div_clock = scheduler_clock;
+        val = 0;
+        break;
+
+    case MEMORY_REG_TAC:
+        // Restart the increment period with the new frequency
+        tima_clock = scheduler_clock;
+        break;
+    }
+
+    memory_write_reg(reg_addr, val);
+    timer_schedule();
+}
+
+// Scheduled at every TIMA overflow
+static void timer_event(uint64_t deadline)
+{
+    (void)deadline;
+
+    timer_sync();
+    timer_schedule();
 }
\ No newline at end of file
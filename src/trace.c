@@ -0,0 +1,185 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include <trace.h>
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <common.h>
+#include <mbc.h>
+#include <scheduler.h>
+
+#define TRACE_BUFFER_NB_RECORDS (1 << 16) // 1.25 MiB per buffer
+
+/*
+    Double buffering: the CPU fills one buffer while the writer thread writes
+    the other one. The CPU only waits when it fills a buffer before the
+    previous one has been written.
+*/
+typedef struct
+{
+    FILE *file;
+    trace_record_t *buffers[2];
+    trace_record_t *filling;
+    uint32_t nb_records;
+    uint64_t last_clock;
+    trace_record_t last;
+
+    // Shared with the writer thread
+    pthread_t writer;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    trace_record_t *pending; // NULL once written
+    uint32_t nb_pending;
+    bool stopping;
+} trace_t;
+
+static trace_t trace = {0};
+static bool recording = false;
+
+static void *writer_loop(void *arg)
+{
+    (void)arg;
+
+    pthread_mutex_lock(&trace.lock);
+    while (true)
+    {
+        while (trace.pending == NULL && !trace.stopping)
+            pthread_cond_wait(&trace.cond, &trace.lock);
+
+        if (trace.pending == NULL)
+            break;
+
+        // The CPU does not touch the pending buffer
+        trace_record_t *records = trace.pending;
+        uint32_t nb_records = trace.nb_pending;
+        pthread_mutex_unlock(&trace.lock);
+
+        if (fwrite(records, sizeof(trace_record_t), nb_records, trace.file) != nb_records)
+            fprintf(stderr, P_ERROR "Can't write the trace\n");
+
+        pthread_mutex_lock(&trace.lock);
+        trace.pending = NULL;
+        pthread_cond_broadcast(&trace.cond);
+    }
+    pthread_mutex_unlock(&trace.lock);
+
+    return NULL;
+}
+
+// Hand the filled buffer over to the writer and continue in the other one
+static void flush_buffer(void)
+{
+    pthread_mutex_lock(&trace.lock);
+    while (trace.pending != NULL)
+        pthread_cond_wait(&trace.cond, &trace.lock);
+
+    trace.pending = trace.filling;
+    trace.nb_pending = trace.nb_records;
+    pthread_cond_broadcast(&trace.cond);
+    pthread_mutex_unlock(&trace.lock);
+
+    trace.filling = trace.filling == trace.buffers[0] ? trace.buffers[1] : trace.buffers[0];
+    trace.nb_records = 0;
+}
+
+bool trace_start(const char *filename)
+{
+    trace_stop();
+
+    FILE *file = fopen(filename, "wb");
+    if (file == NULL)
+    {
+        fprintf(stderr, P_ERROR "Can't create %s\n", filename);
+        return false;
+    }
+
+    trace_header_t header = {
+        .magic = TRACE_MAGIC,
+        .version = TRACE_VERSION,
+        .record_size = sizeof(trace_record_t),
+        .start_clock = scheduler_clock,
+    };
+    fwrite(&header, sizeof(header), 1, file);
+
+    trace = (trace_t){
+        .file = file,
+        .buffers = {
+            malloc(TRACE_BUFFER_NB_RECORDS * sizeof(trace_record_t)),
+            malloc(TRACE_BUFFER_NB_RECORDS * sizeof(trace_record_t)),
+        },
+        .last_clock = scheduler_clock,
+    };
+    if (trace.buffers[0] == NULL || trace.buffers[1] == NULL)
+    {
+        fprintf(stderr, P_FATAL "Can't allocate the trace buffers\n");
+        exit(EXIT_FAILURE);
+    }
+    trace.filling = trace.buffers[0];
+
+    pthread_mutex_init(&trace.lock, NULL);
+    pthread_cond_init(&trace.cond, NULL);
+    if (pthread_create(&trace.writer, NULL, writer_loop, NULL) != 0)
+    {
+        fprintf(stderr, P_FATAL "Can't start the trace writer\n");
+        exit(EXIT_FAILURE);
+    }
+
+    recording = true;
+    return true;
+}
+
+void trace_stop(void)
+{
+    if (!recording)
+        return;
+
+    if (trace.nb_records)
+        flush_buffer();
+
+    pthread_mutex_lock(&trace.lock);
+    trace.stopping = true;
+    pthread_cond_broadcast(&trace.cond);
+    pthread_mutex_unlock(&trace.lock);
+    pthread_join(trace.writer, NULL);
+
+    pthread_cond_destroy(&trace.cond);
+    pthread_mutex_destroy(&trace.lock);
+    fclose(trace.file);
+    free(trace.buffers[0]);
+    free(trace.buffers[1]);
+    recording = false;
+}
+
+void trace_record(uint16_t pc, uint8_t opcode, uint16_t af, uint16_t bc, uint16_t de, uint16_t hl, uint16_t sp)
+{
+    trace_record_t current = {
+        .pc = pc,
+        .bank = mbc_get_rom_bank(pc),
+        .af = af,
+        .bc = bc,
+        .de = de,
+        .hl = hl,
+        .sp = sp,
+        .opcode = opcode,
+    };
+
+    trace_record_t *record = &trace.filling[trace.nb_records];
+    record->cycles = scheduler_clock - trace.last_clock;
+    record->pc = current.pc ^ trace.last.pc;
+    record->bank = current.bank ^ trace.last.bank;
+    record->af = current.af ^ trace.last.af;
+    record->bc = current.bc ^ trace.last.bc;
+    record->de = current.de ^ trace.last.de;
+    record->hl = current.hl ^ trace.last.hl;
+    record->sp = current.sp ^ trace.last.sp;
+    record->opcode = current.opcode ^ trace.last.opcode;
+    record->reserved = 0;
+
+    trace.last = current;
+    trace.last_clock = scheduler_clock;
+
+    if (++trace.nb_records == TRACE_BUFFER_NB_RECORDS)
+        flush_buffer();
+}